@@ -2,16 +2,57 @@
 
 
 #include "Bubble.h"
-
+#include "Bubblegun.h"
+#include "BubbleFarFieldSubsystem.h"
+#include "BubbleForceFieldSubsystem.h"
+#include "BubblePopSubsystem.h"
+#include "BubbleReplaySubsystem.h"
+#include "BubbleScalabilitySettings.h"
+#include "BubbleSDFSubsystem.h"
+#include "BubbleSimulationSubsystem.h"
+#include "BubbleSnapshot.h"
+#include "BubbleStateSubsystem.h"
+
+#include "Algo/StableSort.h"
 #include "Templates/Tuple.h"
 #include "GenericPlatform/GenericPlatformMath.h"
+#include "Components/SphereComponent.h"
 #include "Materials/MaterialInstanceDynamic.h"
+#include "Engine/StaticMesh.h"
+#include "PhysicsEngine/BodySetup.h"
+#include "WorldCollision.h"
 #include "DynamicMesh/DynamicMesh3.h"
 #include "GameFramework/Character.h"
 #include "GameFramework/CharacterMovementComponent.h"
+#include "Math/Float16.h"
+#include "Misc/App.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
+#include "UObject/ConstructorHelpers.h"
 #include <MathUtil.h>
 #include <Kismet/GameplayStatics.h>
 
+// position of a direction along a Morton curve over its octahedral map, the lower hemisphere folded out to the corners
+static uint32 GetOctahedralMortonCode(const FVector3d& Direction) {
+	FVector3d p = Direction / FMath::Max(FMath::Abs(Direction.X) + FMath::Abs(Direction.Y) + FMath::Abs(Direction.Z), UE_DOUBLE_SMALL_NUMBER);
+	double u = p.X;
+	double v = p.Y;
+	if (p.Z < 0) {
+		u = (1.0 - FMath::Abs(p.Y)) * (p.X >= 0 ? 1.0 : -1.0);
+		v = (1.0 - FMath::Abs(p.X)) * (p.Y >= 0 ? 1.0 : -1.0);
+	}
+
+	auto quantize = [](double x) { return uint32(FMath::Clamp((x + 1.0) * 0.5 * 65535.0 + 0.5, 0.0, 65535.0)); };
+	auto spread = [](uint32 x) {
+		x = (x | (x << 8)) & 0x00FF00FF;
+		x = (x | (x << 4)) & 0x0F0F0F0F;
+		x = (x | (x << 2)) & 0x33333333;
+		x = (x | (x << 1)) & 0x55555555;
+		return x;
+	};
+	return spread(quantize(u)) | (spread(quantize(v)) << 1);
+}
+
 struct MeshRepr {
 	TArray<FVector> Positions;
 
@@ -138,6 +179,37 @@ struct MeshRepr {
 		Faces = newFaces;
 	}
 
+	// renumbers the vertices so new vertex i is old vertex vertexOrder[i] and puts the faces in faceOrder, winding kept
+	void Reorder(const TArray<int32>& vertexOrder, const TArray<int32>& faceOrder) {
+		TArray<int32> newIndex;
+		newIndex.SetNumUninitialized(vertexOrder.Num());
+		TArray<FVector> positions;
+		positions.Reserve(vertexOrder.Num());
+		for (int32 i = 0; i < vertexOrder.Num(); i++) {
+			newIndex[vertexOrder[i]] = i;
+			positions.Add(Positions[vertexOrder[i]]);
+		}
+
+		for (auto& edge : Edges) {
+			int32 v0 = newIndex[edge.Get<0>()];
+			int32 v1 = newIndex[edge.Get<1>()];
+			edge = { FMath::Min(v0, v1), FMath::Max(v0, v1) };
+		}
+		Edges.Sort([](const TPair<int32, int32>& a, const TPair<int32, int32>& b) {
+			return a.Get<0>() != b.Get<0>() ? a.Get<0>() < b.Get<0>() : a.Get<1>() < b.Get<1>();
+		});
+
+		TArray<TTuple<int32, int32, int32>> faces;
+		faces.Reserve(faceOrder.Num());
+		for (int32 f : faceOrder) {
+			auto [v0, v1, v2] = Faces[f];
+			faces.Add({ newIndex[v0], newIndex[v1], newIndex[v2] });
+		}
+
+		Positions = MoveTemp(positions);
+		Faces = MoveTemp(faces);
+	}
+
 	static MeshRepr GetSphere(float radius, int32 nSubdivisions, bool bUseIcosahedron = false) {
 		auto mesh = bUseIcosahedron ? GetIcosahedron() : GetOctahedron();
 		for (int32 i = 0; i < nSubdivisions; i++) {
@@ -148,176 +220,78 @@ struct MeshRepr {
 	}
 };
 
-static FRandomStream BubbleRandomStream = FRandomStream();
-
-// Sets default values
-ABubble::ABubble()
-{
- 	// Set this actor to call Tick() every frame.  You can turn this off to improve performance if you don't need it.
-	PrimaryActorTick.bCanEverTick = true;
-
-	BubbleMesh = CreateDefaultSubobject<UDynamicMeshComponent>(TEXT("BubbleMesh"));
-	RootComponent = BubbleMesh;
-	//BubbleMesh->SetMobility(EComponentMobility::Movable);
-	//BubbleMesh->SetSimulatePhysics(true);
-	BubbleMesh->SetCollisionEnabled(ECollisionEnabled::QueryAndPhysics);
-	BubbleMesh->EnableComplexAsSimpleCollision();
-	BubbleMesh->bEnableComplexCollision = true;
-	BubbleMesh->ColorMode = EDynamicMeshComponentColorOverrideMode::None;
-
-	BubbleMesh->GetBodyInstance()->bUseCCD = true;
-}
-
-// Called when the game starts or when spawned
-void ABubble::BeginPlay()
-{
-	Super::BeginPlay();
-
-	BubbleMesh->OnComponentHit.AddDynamic(this, &ABubble::OnHit);
-	BubbleMesh->OnComponentBeginOverlap.AddDynamic(this, &ABubble::OnOverlapBegin);
-	BubbleMesh->OnComponentEndOverlap.AddDynamic(this, &ABubble::OnOverlapEnd);
-	
-	Generate();
-}
+// Subdivide appends midpoints in edge order, which scatters neighbours across memory after a few levels. Templates
+// number vertices and faces along a space-filling curve on the sphere instead, so the adjacency walks of the solver
+// and the normals stay within nearby cache lines.
+struct FBubbleMeshOrder {
+	// old index of each vertex and face of the subdivided icosahedron, by new index
+	TArray<int32> Vertices;
 
-// Called every frame
-void ABubble::Tick(float DeltaTime)
-{
-	Super::Tick(DeltaTime);
+	TArray<int32> Faces;
+};
 
-	UpdateCenterOfMass();
+static const FBubbleMeshOrder& GetMeshOrder(int32 Subdivisions) {
+	LLM_SCOPE_BYTAG(BubbleMesh);
 
-	if (BigNoiseChangeTimer <= 0 || BubbleRandomStream.GetFraction() < DeltaTime * (1.0 - BigNoiseChangeTimer / BigNoiseChangeInterval)) {
-		BigNoiseVector = BubbleRandomStream.GetUnitVector();
-		BigNoiseChangeTimer = BigNoiseChangeInterval;
+	static TMap<int32, TUniquePtr<FBubbleMeshOrder>> Orders;
+	if (const TUniquePtr<FBubbleMeshOrder>* existing = Orders.Find(Subdivisions)) {
+		return **existing;
 	}
-	BigNoiseChangeTimer -= DeltaTime;
 
-	double deltaTime = FMathf::Min(DeltaTime, 1 / 15.0);
+	MeshRepr mesh = MeshRepr::GetSphere(1.0, Subdivisions, true);
+	auto sortByCode = [](const TArray<uint32>& codes) {
+		TArray<int32> order;
+		order.SetNumUninitialized(codes.Num());
+		for (int32 i = 0; i < codes.Num(); i++) {
+			order[i] = i;
+		}
+		// ties keep their old order so the result is the same on every machine
+		Algo::StableSort(order, [&codes](int32 a, int32 b) { return codes[a] < codes[b]; });
+		return order;
+	};
+
+	TArray<uint32> codes;
+	codes.Reserve(mesh.Positions.Num());
+	for (const FVector& position : mesh.Positions) {
+		codes.Add(GetOctahedralMortonCode(position));
+	}
+	TUniquePtr<FBubbleMeshOrder> order = MakeUnique<FBubbleMeshOrder>();
+	order->Vertices = sortByCode(codes);
 
-	double VertexDisplacementSum = 0;
-	int VertexCount = 0;
+	codes.Reset();
+	for (const auto& face : mesh.Faces) {
+		auto [v0, v1, v2] = face;
+		codes.Add(GetOctahedralMortonCode(mesh.Positions[v0] + mesh.Positions[v1] + mesh.Positions[v2]));
+	}
+	order->Faces = sortByCode(codes);
 
-	TArray<FVector3d> forces;
-	forces.Init(FVector3d::Zero(), BubbleMesh->GetDynamicMesh()->GetMeshRef().MaxVertexID());
-	BubbleMesh->GetDynamicMesh()->ProcessMesh(
-		[&](const FDynamicMesh3& Mesh) {
-			for (int32 i = 0; i < Mesh.MaxVertexID(); i++) {
-				FVector3d force{ 0, 0, 0 };
-
-				FVector3d pos = Mesh.GetVertex(i);
-				FVector3d airPressureForce = (pos - CenterOfMass).GetSafeNormal();
-				airPressureForce = (airPressureForce + FVector(Mesh.GetVertexNormal(i))).GetSafeNormal();
-				double comDistance = (pos - CenterOfMass).Size();
-				airPressureForce *= 1 / (comDistance * comDistance) * AirPressureForce;
-				force += airPressureForce;
-
-				Mesh.EnumerateVertexEdges(i, [&](int32 edgeId) {
-					auto edge = Mesh.GetEdge(edgeId);
-					int32 neigh = edge.Vert.A == i ? edge.Vert.B : edge.Vert.A;
-					FVector3d neighPos = Mesh.GetVertex(neigh);
-					FVector3d springForce = (neighPos - pos).GetSafeNormal();
-					double edgeLength = (neighPos - pos).Size();
-					double targetLength = TargetEdgeLengths[edgeId] * Radius / InitialRadius;
-					springForce *= (edgeLength - targetLength) * SpringCoefficient;
-					force += springForce;
-				});
-
-				force += BubbleRandomStream.GetUnitVector() * ForceNoiseMagnitude;
-				force += (2.0 * FMath::Abs(FVector3d::DotProduct(pos - CenterOfMass, BigNoiseVector)) - 1) * (CenterOfMass - pos).GetSafeNormal() * ForceBigNoiseMagnitude;
-				force += GlobalForce / deltaTime;
-
-				forces[i] = force;
-
-				VertexDisplacementSum += (pos - CenterOfMass).Size();
-				VertexCount++;
-			}
-		});
-	ActualRadius = VertexDisplacementSum / VertexCount;
-	
-	GlobalForce = FVector3d::Zero();
-
-	FDynamicMesh3* mesh = BubbleMesh->GetDynamicMesh()->GetMeshPtr();
-	int index = -1;
-	TArray<AActor*> actorsToRemove;
-	for (auto& push : CurrentPushes) {
-		index++;
-		auto [faceIndex, velocityDelta, distance] = push.Value;
-		AActor* actor = push.Key;
-
-		if (!IsValid(actor)) {
-			actorsToRemove.Add(actor);
-			continue;
-		}
-		
-		double actorDistance = (actor->GetActorLocation() - (GetActorLocation() + CenterOfMass)).Size();
-		if (actorDistance > distance * 1.5) {
-			actorsToRemove.Add(actor);
-			continue;
-		}
+	return *Orders.Add(Subdivisions, MoveTemp(order));
+}
 
-		auto hitFace = mesh->GetTriangle(faceIndex);
-		int v0i = hitFace.A;
-		int v1i = hitFace.B;
-		int v2i = hitFace.C;
-		FVector3d vertexVelocityDelta = velocityDelta / 3 * ImpactVertexPushStrength;
-		VertexVelocities[v0i] += vertexVelocityDelta;
-		VertexVelocities[v1i] += vertexVelocityDelta;
-		VertexVelocities[v2i] += vertexVelocityDelta;
+// unit sphere with the attribute layout of a bubble, shared by all bubbles with the same subdivision level
+struct FBubbleTopologyTemplate {
+	FDynamicMesh3 Mesh{ true, true, false, false };
 
-		GlobalForce += velocityDelta * ImpactGlobalPushStrength;
-	}
-	for (auto actor : actorsToRemove) {
-		CurrentPushes.Remove(actor);
-	}
+	TArray<double> UnitEdgeLengths;
 
-	FVector3d totalBounce = FVector3d::Zero();
-	BubbleMesh->GetDynamicMesh()->EditMesh(
-		[&](FDynamicMesh3& Mesh) {
-			for (int32 i = 0; i < Mesh.MaxVertexID(); i++) {
-				double mass = 0;
-				Mesh.EnumerateVertexTriangles(i, [&](int32 face) {
-					FVector3d v0, v1, v2;
-					Mesh.GetTriVertices(face, v0, v1, v2);
-					double faceArea = FMath::Abs(FVector3d::CrossProduct(v1 - v0, v2 - v0).Size() / 2);
-					mass += faceArea;
-				});
-				mass /= 3;
-				FVector3d vel = VertexVelocities[i];
-				FVector3d force = forces[i];
-				vel += force * deltaTime;
-				VertexVelocities[i] = vel * VelocityDamping;
-				FVector3d newPos = Mesh.GetVertex(i) + vel * deltaTime;
-				auto params = FCollisionQueryParams::DefaultQueryParam;
-				params.AddIgnoredActor(this);
-				FHitResult Hit;
-				FVector3d ActorPos = GetActorLocation();
-				if (GetWorld()->LineTraceSingleByChannel(Hit, Mesh.GetVertex(i) + ActorPos, newPos + ActorPos, ECC_WorldDynamic, params)) {
-					//Mesh.SetVertex(i, Mesh.GetVertex(i) - vel * deltaTime);
-					// proper reflection taking Hit.ImpactNormal into account
-					FVector3d bounce = -FVector3d::DotProduct(VertexVelocities[i], Hit.ImpactNormal) * Hit.ImpactNormal;
-					VertexVelocities[i] = (VertexVelocities[i] + 1.9 * bounce);
-					totalBounce += bounce;
-				}
-				else {
-					Mesh.SetVertex(i, newPos);
-				}
-			}
-		}
-	);
-	GlobalForce += totalBounce * GlobalBounceMultiplier;
+	double UnitAverageVertexArea = 0;
+};
 
-	UpdateNormals();
-}
+static const FBubbleTopologyTemplate& GetTopologyTemplate(int32 Subdivisions) {
+	LLM_SCOPE_BYTAG(BubbleMesh);
 
-void ABubble::Generate() {
-	// BubbleMesh->SetOverrideRenderMaterial(BubbleMaterial);
-	BubbleMesh->SetMaterial(0, BubbleMaterial);
+	static TMap<int32, TUniquePtr<FBubbleTopologyTemplate>> Templates;
+	if (const TUniquePtr<FBubbleTopologyTemplate>* existing = Templates.Find(Subdivisions)) {
+		return **existing;
+	}
 
-	Radius = InitialRadius;
-	auto mesh = MeshRepr::GetSphere(Radius, Subdivisions, true);
+	TUniquePtr<FBubbleTopologyTemplate> topology = MakeUnique<FBubbleTopologyTemplate>();
+	auto mesh = MeshRepr::GetSphere(1.0, Subdivisions, true);
+	const FBubbleMeshOrder& order = GetMeshOrder(Subdivisions);
+	mesh.Reorder(order.Vertices, order.Faces);
 
-	FDynamicMesh3 dynMesh{ true, true, false, false };
+	// edges, and with them the rest lengths, are created in the order of the sorted faces
+	FDynamicMesh3& dynMesh = topology->Mesh;
 	dynMesh.EnableVertexColors(FVector4f{ 0, 1, 0, 1 });
 	dynMesh.EnableAttributes();
 	dynMesh.Attributes()->EnablePrimaryColors();
@@ -335,12 +309,10 @@ void ABubble::Generate() {
 	for (auto edge : dynMesh.GetEdgesBuffer()) {
 		FVector3d v0 = dynMesh.GetVertex(edge.Vert.A);
 		FVector3d v1 = dynMesh.GetVertex(edge.Vert.B);
-		TargetEdgeLengths.Add((v1 - v0).Size());
+		topology->UnitEdgeLengths.Add((v1 - v0).Size());
 	}
 
-	VertexVelocities.Init(FVector3d::Zero(), dynMesh.MaxVertexID());
-
-	AverageVertexArea = 0;
+	double averageVertexArea = 0;
 	for (int32 i = 0; i < dynMesh.MaxVertexID(); i++) {
 		double faceAreaSum = 0;
 		int faceCount = 0;
@@ -352,190 +324,1679 @@ void ABubble::Generate() {
 			faceCount++;
 		});
 		double vertexArea = faceAreaSum / faceCount / 3.0;
-		AverageVertexArea += vertexArea;
+		averageVertexArea += vertexArea;
 	}
-	AverageVertexArea /= dynMesh.MaxVertexID();
+	topology->UnitAverageVertexArea = averageVertexArea / dynMesh.MaxVertexID();
 
-	UDynamicMesh* dynamicMesh = NewObject<UDynamicMesh>();
-	dynamicMesh->SetMesh(MoveTemp(dynMesh));
+	return *Templates.Add(Subdivisions, MoveTemp(topology));
+}
 
-	BubbleMesh->SetDynamicMesh(dynamicMesh);
+// vertices of a fine topology template as weighted sums of the vertices of a coarser one
+struct FBubbleRefinementWeights {
+	// weights of fine vertex i are Sources and Weights [Offsets[i] .. Offsets[i + 1])
+	TArray<int32> Offsets;
 
-	UpdateNormals();
+	TArray<int32> Sources;
 
-	if (bRandomizeColor)
-		RandomizeColor();
-}
+	TArray<float> Weights;
+};
 
-void ABubble::UpdateNormals() {
-	auto ColorOverlay = BubbleMesh->GetDynamicMesh()->GetMeshRef().Attributes()->PrimaryColors();
-	BubbleMesh->GetDynamicMesh()->EditMesh(
-		[&](FDynamicMesh3& Mesh) {
-			for (int32 i = 0; i < Mesh.MaxVertexID(); i++) {
-				FVector3d faceNormalSum = FVector3d::Zero();
-				double faceAreaSum = 0.0;
-				int faceCount = 0;
-				Mesh.EnumerateVertexTriangles(i, [&](int32 faceID) {
-					FVector3d v0, v1, v2;
-					Mesh.GetTriVertices(faceID, v0, v1, v2);
-					double faceArea = FMath::Abs(FVector3d::CrossProduct(v1 - v0, v2 - v0).Size() / 2);
-					faceAreaSum += faceArea;
-					FVector3d faceNormal = -FVector3d::CrossProduct(v1 - v0, v2 - v0).GetSafeNormal();
-					faceNormalSum += faceNormal;
-					faceCount++;
-					});
-				FVector3d normal = faceNormalSum / faceCount;
-				Mesh.SetVertexNormal(i, FVector3f(normal));
-
-				double vertexArea = faceAreaSum / faceCount / 3.0;
-				Mesh.SetVertexColor(i, FVector4f(vertexArea / AverageVertexArea / 4.0, 0.0, 0.0, 1.0));
-				ColorOverlay->SetElement(i, FVector4f(vertexArea / AverageVertexArea / 4.0, 0.0, 1.0, 1.0));
+// finest level a rendered mesh is refined to
+static constexpr int32 MaxRenderSubdivisions = 6;
+
+static const FBubbleRefinementWeights& GetRefinementWeights(int32 CoarseSubdivisions, int32 FineSubdivisions) {
+	LLM_SCOPE_BYTAG(BubbleMesh);
+
+	static TMap<TPair<int32, int32>, TUniquePtr<FBubbleRefinementWeights>> Refinements;
+	const TPair<int32, int32> key{ CoarseSubdivisions, FineSubdivisions };
+	if (const TUniquePtr<FBubbleRefinementWeights>* existing = Refinements.Find(key)) {
+		return **existing;
+	}
+
+	// same construction as the templates before they are sorted: vertices keep their index across subdivisions and
+	// new ones follow in edge order; the result is renumbered to the sorted templates at the end
+	MeshRepr mesh = MeshRepr::GetIcosahedron();
+	for (int32 i = 0; i < CoarseSubdivisions; i++) {
+		mesh.Subdivide();
+	}
+	TArray<FVector3d> coarseDirections;
+	for (const FVector& position : mesh.Positions) {
+		coarseDirections.Add(position.GetSafeNormal());
+	}
+
+	// stencil of each vertex of the current level over the coarse vertices, composed one Loop subdivision at a time
+	TArray<TMap<int32, double>> stencils;
+	stencils.SetNum(coarseDirections.Num());
+	for (int32 i = 0; i < stencils.Num(); i++) {
+		stencils[i].Add(i, 1.0);
+	}
+	auto accumulate = [](TMap<int32, double>& target, const TMap<int32, double>& source, double weight) {
+		for (const auto& [vertex, sourceWeight] : source) {
+			target.FindOrAdd(vertex) += sourceWeight * weight;
+		}
+	};
+
+	for (int32 level = CoarseSubdivisions; level < FineSubdivisions; level++) {
+		TArray<TArray<int32>> neighbours;
+		neighbours.SetNum(mesh.Positions.Num());
+		for (const auto& edge : mesh.Edges) {
+			neighbours[edge.Get<0>()].Add(edge.Get<1>());
+			neighbours[edge.Get<1>()].Add(edge.Get<0>());
+		}
+		TMap<TPair<int32, int32>, TArray<int32, TInlineAllocator<2>>> opposite;
+		for (const auto& face : mesh.Faces) {
+			auto [v0, v1, v2] = face;
+			opposite.FindOrAdd({ FMath::Min(v0, v1), FMath::Max(v0, v1) }).Add(v2);
+			opposite.FindOrAdd({ FMath::Min(v1, v2), FMath::Max(v1, v2) }).Add(v0);
+			opposite.FindOrAdd({ FMath::Min(v2, v0), FMath::Max(v2, v0) }).Add(v1);
+		}
+
+		TArray<TMap<int32, double>> next;
+		next.SetNum(mesh.Positions.Num() + mesh.Edges.Num());
+
+		// old vertices move toward their neighbours with Loop's weight for their valence
+		for (int32 v = 0; v < mesh.Positions.Num(); v++) {
+			int32 valence = neighbours[v].Num();
+			double beta = (5.0 / 8.0 - FMath::Square(3.0 / 8.0 + FMath::Cos(UE_DOUBLE_TWO_PI / valence) / 4.0)) / valence;
+			accumulate(next[v], stencils[v], 1.0 - valence * beta);
+			for (int32 neighbour : neighbours[v]) {
+				accumulate(next[v], stencils[neighbour], beta);
 			}
 		}
-	);
-	BubbleMesh->NotifyMeshUpdated();
-}
 
-void ABubble::UpdateCenterOfMass() {
-	BubbleMesh->GetDynamicMesh()->ProcessMesh(
-		[&](const FDynamicMesh3& Mesh) {
-			FVector3d centerOfMass = FVector3d::Zero();
-			double totalArea = 0;
-			for (auto triangleIndex : Mesh.GetTrianglesBuffer()) {
-				FVector3d v0 = Mesh.GetVertex(triangleIndex.A);
-				FVector3d v1 = Mesh.GetVertex(triangleIndex.B);
-				FVector3d v2 = Mesh.GetVertex(triangleIndex.C);
-				FVector3d faceCenter = (v0 + v1 + v2) / 3;
-				double faceArea = FMath::Abs(FVector3d::CrossProduct(v1 - v0, v2 - v0).Size() / 2);
-				centerOfMass += faceCenter * faceArea;
-				totalArea += faceArea;
+		// edge vertices are 3/8 of each end and 1/8 of each opposite vertex
+		for (int32 e = 0; e < mesh.Edges.Num(); e++) {
+			auto [v0, v1] = mesh.Edges[e];
+			TMap<int32, double>& target = next[mesh.Positions.Num() + e];
+			accumulate(target, stencils[v0], 3.0 / 8.0);
+			accumulate(target, stencils[v1], 3.0 / 8.0);
+			for (int32 v : opposite[{ FMath::Min(v0, v1), FMath::Max(v0, v1) }]) {
+				accumulate(target, stencils[v], 1.0 / 8.0);
 			}
-			CenterOfMass = centerOfMass / totalArea;
 		}
-	);
-}
 
-void ABubble::OnHit(UPrimitiveComponent* HitComp, AActor* OtherActor, UPrimitiveComponent* OtherComp, FVector NormalImpulse, const FHitResult& Hit) {
-	if (!IsValid(OtherActor) || OtherActor == this || !IsValid(OtherComp))
-		return;
+		mesh.Subdivide();
+		stencils = MoveTemp(next);
+	}
 
-	FDynamicMesh3* mesh = BubbleMesh->GetDynamicMesh()->GetMeshPtr();
-	int hitFaceIndex = Hit.FaceIndex;
-	if (hitFaceIndex == INDEX_NONE)
-	{
-		FVector TraceStart = Hit.ImpactPoint + Hit.ImpactNormal * 10.0f;
-		FVector TraceEnd = Hit.ImpactPoint - Hit.ImpactNormal * 10.0f;
-
-		FCollisionQueryParams QueryParams;
-		QueryParams.bReturnFaceIndex = true;
-		QueryParams.bTraceComplex = true;
-		QueryParams.AddIgnoredActor(OtherActor);
-
-		FHitResult TraceHit;
-		bool bHit = GetWorld()->LineTraceSingleByChannel(TraceHit, TraceEnd, TraceStart, ECC_WorldDynamic, QueryParams);
-
-		if (bHit && TraceHit.GetActor() == this)
-		{
-			int32 HitFaceIndex = TraceHit.FaceIndex;
-			if (HitFaceIndex != INDEX_NONE)
-			{
-				hitFaceIndex = HitFaceIndex;
-			}
+	// Loop subdivision shrinks a sphere, the weights are applied to offsets from the center and rescaled so a
+	// sphere of coarse vertices refines to the same sphere
+	const TArray<int32>& coarseOrder = GetMeshOrder(CoarseSubdivisions).Vertices;
+	TArray<int32> coarseIndex;
+	coarseIndex.SetNumUninitialized(coarseOrder.Num());
+	for (int32 i = 0; i < coarseOrder.Num(); i++) {
+		coarseIndex[coarseOrder[i]] = i;
+	}
+
+	TUniquePtr<FBubbleRefinementWeights> refinement = MakeUnique<FBubbleRefinementWeights>();
+	refinement->Offsets.Reserve(stencils.Num() + 1);
+	for (int32 fineVertex : GetMeshOrder(FineSubdivisions).Vertices) {
+		const TMap<int32, double>& stencil = stencils[fineVertex];
+		FVector3d position = FVector3d::Zero();
+		for (const auto& [vertex, weight] : stencil) {
+			position += coarseDirections[vertex] * weight;
+		}
+		double scale = 1.0 / FMath::Max(position.Size(), UE_DOUBLE_KINDA_SMALL_NUMBER);
+
+		refinement->Offsets.Add(refinement->Sources.Num());
+		for (const auto& [vertex, weight] : stencil) {
+			refinement->Sources.Add(coarseIndex[vertex]);
+			refinement->Weights.Add(float(weight * scale));
 		}
 	}
-	if (hitFaceIndex == INDEX_NONE)
-	{
-		UE_LOG(LogTemp, Warning, TEXT("No hit face found"));
-		return;
+	refinement->Offsets.Add(refinement->Sources.Num());
+
+	return *Refinements.Add(key, MoveTemp(refinement));
+}
+
+// positions of the rendered mesh from the simulated one, a single pass over flat weight arrays
+static void RefineSurface(const FDynamicMesh3& Coarse, const FVector3d& Center, const FBubbleRefinementWeights& Refinement, FDynamicMesh3& Fine) {
+	TArray<FVector3f> offsets;
+	offsets.SetNumUninitialized(Coarse.MaxVertexID());
+	for (int32 i = 0; i < Coarse.MaxVertexID(); i++) {
+		offsets[i] = FVector3f(Coarse.GetVertex(i) - Center);
 	}
 
-	auto hitFace = mesh->GetTriangle(hitFaceIndex);
-	int v0i = hitFace.A;
-	int v1i = hitFace.B;
-	int v2i = hitFace.C;
+	const int32* sources = Refinement.Sources.GetData();
+	const float* weights = Refinement.Weights.GetData();
+	for (int32 i = 0; i < Fine.MaxVertexID(); i++) {
+		FVector3f offset = FVector3f::ZeroVector;
+		for (int32 k = Refinement.Offsets[i]; k < Refinement.Offsets[i + 1]; k++) {
+			offset += offsets[sources[k]] * weights[k];
+		}
+		Fine.SetVertex(i, Center + FVector3d(offset));
+	}
+}
+
+static TAutoConsoleVariable<bool> CVarBubbleAsyncSolve(
+	TEXT("bubble.AsyncSolve"),
+	true,
+	TEXT("Solve bubbles on worker tasks, one frame behind the game thread. Off solves them inline when they are stepped."),
+	ECVF_Default);
+
+static TAutoConsoleVariable<bool> CVarBubbleRemesh(
+	TEXT("bubble.Remesh"),
+	true,
+	TEXT("Move bubbles between subdivision levels as their size and distance to the viewer change. Off keeps the level they were spawned with."),
+	ECVF_Default);
+
+static TAutoConsoleVariable<float> CVarBubbleRemeshEdgeLength(
+	TEXT("bubble.RemeshEdgeLength"),
+	15.0f,
+	TEXT("Target world-space edge length of bubble meshes within bubble.RemeshReferenceDistance of a viewer, it grows linearly with the distance beyond."),
+	ECVF_Default);
+
+static TAutoConsoleVariable<float> CVarBubbleRemeshReferenceDistance(
+	TEXT("bubble.RemeshReferenceDistance"),
+	1000.0f,
+	TEXT("Distance from the nearest viewer up to which bubbles keep bubble.RemeshEdgeLength."),
+	ECVF_Default);
+
+static TAutoConsoleVariable<int32> CVarBubbleRemeshMinSubdivisions(
+	TEXT("bubble.RemeshMinSubdivisions"),
+	1,
+	TEXT("Fewest subdivisions adaptive remeshing goes down to."),
+	ECVF_Default);
+
+static TAutoConsoleVariable<float> CVarBubbleRewindHistoryMs(
+	TEXT("bubble.RewindHistoryMs"),
+	500.0f,
+	TEXT("Milliseconds of bubble shapes servers keep for lag-compensated hit and pop checks. 0 records none."),
+	ECVF_Default);
+
+// edge of an icosahedron inscribed in the unit sphere, each subdivision halves it
+static constexpr double IcosahedronUnitEdge = 1.0515;
+
+// everything a solve needs from the game thread, gathered before it is launched
+struct FBubbleSolveInputs {
+	double StepTime = 0;
+
+	int32 Substeps = 0;
 
-	FVector3d velocityDelta = FVector3d(Hit.ImpactNormal);
+	// time caught up by relaxing the surface after the substeps
+	double RelaxTime = 0;
 
-	UE_LOG(LogTemp, Warning, TEXT("Hit face %d %d %d with velocity delta %s, current velocity is %s"), v0i, v1i, v2i, *velocityDelta.ToString(), *VertexVelocities[v0i].ToString());
+	FVector3d ActorLocation = FVector3d::Zero();
 
-	FVector3d vertexVelocityDelta = velocityDelta / 3 * ImpactVertexPushStrength * HitSingleVertexFactor(OtherActor);
-	VertexVelocities[v0i] += vertexVelocityDelta;
-	VertexVelocities[v1i] += vertexVelocityDelta;
-	VertexVelocities[v2i] += vertexVelocityDelta;
+	// solver contacts of each substep
+	TArray<TArray<FBubbleSolverContact>> Contacts;
 
-	GlobalForce += velocityDelta * ImpactGlobalPushStrength * HitGlobalFactor(OtherActor);
+	// copies of the force fields overlapping the bubble
+	TArray<FBubbleForceField> ForceFields;
 
-	CurrentPushes.Add(OtherActor, TTuple<int32, FVector, double>{hitFaceIndex, velocityDelta, (OtherActor->GetActorLocation() - (GetActorLocation() + CenterOfMass)).Size()});
+	EBubbleCollisionMode CollisionMode = EBubbleCollisionMode::Full;
+
+	const UBubbleSDFSubsystem* SDF = nullptr;
+
+	bool bTraceDynamic = false;
+
+	// blocking surface ahead of each vertex, traced before the solve; a vertex whose step ends behind its plane is bounced
+	TArray<FBubbleCollisionPlane> CollisionPlanes;
+
+	// fit the compact shape of the result for the rewind history
+	bool bRecordRewind = false;
+
+	// one stream per solve, seeded from the bubble's SimulationRandom, so solves running in parallel share no state
+	FRandomStream Random;
+
+	// Blueprint-writable tuning of the bubble as it was at launch, the solve never reads the actor's properties
+	double Radius = 0;
+	double InitialRadius = 0;
+	double AirPressureForce = 0;
+	double SpringCoefficient = 0;
+	double VelocityDamping = 0;
+	double ForceNoiseMagnitude = 0;
+	double ForceBigNoiseMagnitude = 0;
+	double BigNoiseChangeInterval = 0;
+	double GlobalBounceMultiplier = 0;
+};
+
+// object types a bubble vertex collides with that the static distance field does not cover
+static FCollisionObjectQueryParams GetDynamicObjectTypes() {
+	FCollisionObjectQueryParams dynamicObjects;
+	dynamicObjects.AddObjectTypesToQuery(ECC_WorldDynamic);
+	dynamicObjects.AddObjectTypesToQuery(ECC_PhysicsBody);
+	dynamicObjects.AddObjectTypesToQuery(ECC_Pawn);
+	dynamicObjects.AddObjectTypesToQuery(ECC_Vehicle);
+	dynamicObjects.AddObjectTypesToQuery(ECC_Destructible);
+	return dynamicObjects;
 }
 
-void ABubble::RandomizeColor() {
-	auto Material = BubbleMaterial->GetMaterial();
-	// Create a dynamic material instance
-	UMaterialInstanceDynamic* DynamicMaterial = UMaterialInstanceDynamic::Create(Material, this);
+static FVector3d ComputeCenterOfMass(const FDynamicMesh3& Mesh) {
+	FVector3d centerOfMass = FVector3d::Zero();
+	double totalArea = 0;
+	for (auto triangleIndex : Mesh.GetTrianglesBuffer()) {
+		FVector3d v0 = Mesh.GetVertex(triangleIndex.A);
+		FVector3d v1 = Mesh.GetVertex(triangleIndex.B);
+		FVector3d v2 = Mesh.GetVertex(triangleIndex.C);
+		FVector3d faceCenter = (v0 + v1 + v2) / 3;
+		double faceArea = FMath::Abs(FVector3d::CrossProduct(v1 - v0, v2 - v0).Size() / 2);
+		centerOfMass += faceCenter * faceArea;
+		totalArea += faceArea;
+	}
+	return centerOfMass / totalArea;
+}
 
-	if (DynamicMaterial)
-	{
-		FVector NewColor = FVector(BubbleRandomStream.GetFraction(), BubbleRandomStream.GetFraction(), BubbleRandomStream.GetFraction());
-		NewColor /= 2.0;
-		//NewColor *= 1.0 / NewColor.Size() * (1.0 - 0.5 * (1.0 - NewColor.Size()));
-		DynamicMaterial->SetVectorParameterValue(TEXT("BaseColor"), NewColor);
-		BubbleMesh->SetMaterial(0, DynamicMaterial);
+// radii of the ellipsoid approximating the surface along the actor axes
+static FVector3d ComputeExtents(const FDynamicMesh3& Mesh, const FVector3d& CenterOfMass, double FallbackRadius) {
+	// for a sphere of radius r the mean squared offset along any axis is r^2 / 3
+	FVector3d sumSquared = FVector3d::Zero();
+	int32 vertexCount = 0;
+	for (int32 i : Mesh.VertexIndicesItr()) {
+		FVector3d offset = Mesh.GetVertex(i) - CenterOfMass;
+		sumSquared += offset * offset;
+		vertexCount++;
 	}
+	if (vertexCount == 0)
+		return FVector3d(FallbackRadius);
+
+	FVector3d meanSquared = sumSquared / vertexCount * 3.0;
+	return FVector3d(FMath::Sqrt(meanSquared.X), FMath::Sqrt(meanSquared.Y), FMath::Sqrt(meanSquared.Z));
 }
 
-void ABubble::OnOverlapBegin(UPrimitiveComponent* OverlappedComp, AActor* OtherActor, UPrimitiveComponent* OtherComp, int32 OtherBodyIndex, bool bFromSweep, const FHitResult& SweepResult) {
-	if (!IsValid(OtherActor) || OtherActor == this || !IsValid(OtherComp))
-		return;
-	UE_LOG(LogTemp, Warning, TEXT("Overlap begin with %s"), *OtherActor->GetName());
+// layout of the custom primitive data read by the bubble material, the same as the far-field instance data
+static constexpr int32 TintDataIndex = 0;
+static constexpr int32 StretchDataIndex = 3;
+
+// vertex normals, and the relative vertex area in the colors for the material
+static void ComputeNormals(FDynamicMesh3& Mesh, double AverageVertexArea) {
+	auto ColorOverlay = Mesh.Attributes()->PrimaryColors();
+	for (int32 i = 0; i < Mesh.MaxVertexID(); i++) {
+		FVector3d faceNormalSum = FVector3d::Zero();
+		double faceAreaSum = 0.0;
+		int faceCount = 0;
+		Mesh.EnumerateVertexTriangles(i, [&](int32 faceID) {
+			FVector3d v0, v1, v2;
+			Mesh.GetTriVertices(faceID, v0, v1, v2);
+			double faceArea = FMath::Abs(FVector3d::CrossProduct(v1 - v0, v2 - v0).Size() / 2);
+			faceAreaSum += faceArea;
+			FVector3d faceNormal = -FVector3d::CrossProduct(v1 - v0, v2 - v0).GetSafeNormal();
+			faceNormalSum += faceNormal;
+			faceCount++;
+			});
+		FVector3d normal = faceNormalSum / faceCount;
+		Mesh.SetVertexNormal(i, FVector3f(normal));
+
+		double vertexArea = faceAreaSum / faceCount / 3.0;
+		Mesh.SetVertexColor(i, FVector4f(vertexArea / AverageVertexArea / 4.0, 0.0, 0.0, 1.0));
+		ColorOverlay->SetElement(i, FVector4f(vertexArea / AverageVertexArea / 4.0, 0.0, 1.0, 1.0));
+	}
 }
 
-void ABubble::OnOverlapEnd(UPrimitiveComponent* OverlappedComp, AActor* OtherActor, UPrimitiveComponent* OtherComp, int32 OtherBodyIndex) {
-	if (!IsValid(OtherActor) || OtherActor == this || !IsValid(OtherComp))
+// Sets default values
+ABubble::ABubble()
+{
+ 	// The simulation is stepped by UBubbleSimulationSubsystem within its frame budget, the actor tick only runs the
+	// Blueprint's Event Tick (growth in A_Bubble)
+	PrimaryActorTick.bCanEverTick = true;
+
+	BubbleMesh = CreateDefaultSubobject<UDynamicMeshComponent>(TEXT("BubbleMesh"));
+	RootComponent = BubbleMesh;
+	//BubbleMesh->SetMobility(EComponentMobility::Movable);
+	//BubbleMesh->SetSimulatePhysics(true);
+	BubbleMesh->SetCollisionEnabled(ECollisionEnabled::QueryAndPhysics);
+	BubbleMesh->EnableComplexAsSimpleCollision();
+	BubbleMesh->bEnableComplexCollision = true;
+	// the surface changes every solve, its collision is cooked off the game thread and swapped in when ready
+	BubbleMesh->bUseAsyncCooking = true;
+	BubbleMesh->ColorMode = EDynamicMeshComponentColorOverrideMode::None;
+
+	BubbleMesh->GetBodyInstance()->bUseCCD = true;
+
+	static ConstructorHelpers::FObjectFinder<UStaticMesh> FarFieldMeshFinder(TEXT("/Engine/BasicShapes/Sphere"));
+	FarFieldMesh = FarFieldMeshFinder.Object;
+}
+
+// Called when the game starts or when spawned
+void ABubble::BeginPlay()
+{
+	Super::BeginPlay();
+
+	BubbleMesh->OnComponentHit.AddDynamic(this, &ABubble::OnHit);
+	BubbleMesh->OnComponentBeginOverlap.AddDynamic(this, &ABubble::OnOverlapBegin);
+	BubbleMesh->OnComponentEndOverlap.AddDynamic(this, &ABubble::OnOverlapEnd);
+
+	// nobody sees the surface on a dedicated server or without a renderer, only its center, size and faces matter
+	bHeadless = !FApp::CanEverRender() || GetNetMode() == NM_DedicatedServer;
+	if (bHeadless) {
+		CollisionProxy = NewObject<USphereComponent>(this, TEXT("CollisionProxy"));
+		CollisionProxy->BodyInstance.CopyBodyInstancePropertiesFrom(BubbleMesh->GetBodyInstance());
+		CollisionProxy->SetupAttachment(BubbleMesh);
+		CollisionProxy->RegisterComponent();
+		CollisionProxy->OnComponentHit.AddDynamic(this, &ABubble::OnHit);
+		CollisionProxy->OnComponentBeginOverlap.AddDynamic(this, &ABubble::OnOverlapBegin);
+		CollisionProxy->OnComponentEndOverlap.AddDynamic(this, &ABubble::OnOverlapEnd);
+		BubbleMesh->SetCollisionEnabled(ECollisionEnabled::NoCollision);
+	}
+
+	if (BubbleMaterial) {
+		BubbleMaterial->GetVectorParameterValue(TEXT("BaseColor"), Tint);
+	}
+	ApplyTint();
+
+	// level-placed bubbles coming back from a streamed-out level continue where they left off
+	UBubbleStateSubsystem* StateSubsystem = GetWorld()->GetSubsystem<UBubbleStateSubsystem>();
+	if (StateSubsystem && StateSubsystem->WasPopped(this)) {
+		Destroy();
 		return;
-	UE_LOG(LogTemp, Warning, TEXT("Overlap end with %s"), *OtherActor->GetName());
+	}
+
+	TArray<uint8> StoredState;
+	if (StateSubsystem && PendingSnapshot.Num() == 0 && StateSubsystem->TakeStoredState(this, StoredState)) {
+		PendingSnapshot = MoveTemp(StoredState);
+	}
+
+	SimulationRandom.Initialize(SimulationSeed != 0 ? SimulationSeed : int32(GetTypeHash(GetName())));
+
+	if (PendingSnapshot.Num() == 0 || !RestoreSnapshot(PendingSnapshot)) {
+		Generate();
+	}
+	PendingSnapshot.Empty();
+
+	UBubbleSimulationSubsystem* SimulationSubsystem = GetWorld()->GetSubsystem<UBubbleSimulationSubsystem>();
+	if (SimulationSubsystem && !bReplayDriven) {
+		SimulationSubsystem->RegisterBubble(this);
+	}
+	UBubbleReplaySubsystem* ReplaySubsystem = GetWorld()->GetSubsystem<UBubbleReplaySubsystem>();
+	if (ReplaySubsystem && ReplaySubsystem->IsRecording()) {
+		ReplaySubsystem->CaptureBubble(this);
+	}
+	UBubbleFarFieldSubsystem* FarFieldSubsystem = GetWorld()->GetSubsystem<UBubbleFarFieldSubsystem>();
+	if (FarFieldSubsystem && !bHeadless) {
+		FarFieldSubsystem->RegisterBubble(this);
+	}
 }
 
-void ABubble::GrowBubble(double Amount) {
-	double NewRadius = Radius + Amount;
-	AirPressureForce = AirPressureForce * FMath::Pow(NewRadius / Radius, 4);
-	Radius = NewRadius;
+void ABubble::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	CompleteSimulation();
+
+	if (UBubbleSimulationSubsystem* SimulationSubsystem = GetWorld()->GetSubsystem<UBubbleSimulationSubsystem>()) {
+		SimulationSubsystem->UnregisterBubble(this);
+	}
+	if (UBubbleFarFieldSubsystem* FarFieldSubsystem = GetWorld()->GetSubsystem<UBubbleFarFieldSubsystem>()) {
+		FarFieldSubsystem->UnregisterBubble(this);
+	}
+
+	if (UBubbleStateSubsystem* StateSubsystem = GetWorld()->GetSubsystem<UBubbleStateSubsystem>()) {
+		if (EndPlayReason == EEndPlayReason::RemovedFromWorld) {
+			StateSubsystem->StoreStreamedOut(this);
+		}
+		else if (EndPlayReason == EEndPlayReason::Destroyed && bPopped) {
+			StateSubsystem->MarkPopped(this);
+		}
+	}
+
+	Super::EndPlay(EndPlayReason);
 }
 
-void ABubble::Pop() {
-	if (PopSound) {
-		UGameplayStatics::PlaySoundAtLocation(this, PopSound, GetActorLocation() + CenterOfMass);
+void ABubble::StepSimulation(double DeltaTime, int32 MaxSubsteps) {
+	LLM_SCOPE_BYTAG(BubbleSimulation);
+
+	// the solver is only stable up to 1/15 s per step, longer gaps are split and what does not fit is caught up cheaply
+	constexpr double maxStep = 1 / 15.0;
+	int32 substeps = FMath::Clamp(FMath::CeilToInt32(DeltaTime / maxStep), 1, FMath::Max(MaxSubsteps, 1));
+	double simulatedTime = FMath::Min(DeltaTime, substeps * maxStep);
+
+	RunSolve(simulatedTime / substeps, substeps, DeltaTime - simulatedTime);
+}
+
+void ABubble::CatchUpSimulation(double DeltaTime) {
+	LLM_SCOPE_BYTAG(BubbleSimulation);
+
+	RunSolve(0.0, 0, DeltaTime);
+}
+
+void ABubble::RunSolve(double StepTime, int32 Substeps, double RelaxTime, const TArray<TArray<FBubbleSolverContact>>* ReplayContacts) {
+	// normally published by the subsystem at the start of the frame already
+	CompleteSimulation();
+
+	// the one point where interactions reach the simulation
+	ProcessCommands();
+
+	if (bSolveMeshStale) {
+		LLM_SCOPE_BYTAG(BubbleMesh);
+		if (!bHeadless) {
+			SolveMesh = GetSurface();
+		}
+		SolveCenterOfMass = CenterOfMass;
+		SolveActualRadius = ActualRadius;
+		bSolveMeshStale = false;
 	}
 
-	double PopForce = ActualRadius;
+	FBubbleSolveInputs inputs;
+	inputs.StepTime = StepTime;
+	inputs.Substeps = Substeps;
+	inputs.RelaxTime = RelaxTime;
+	inputs.ActorLocation = GetActorLocation();
+	SolveDuration = StepTime * Substeps + RelaxTime;
+	inputs.Random.Initialize(int32(SimulationRandom.GetUnsignedInt()));
+	inputs.Radius = Radius;
+	inputs.InitialRadius = InitialRadius;
+	inputs.AirPressureForce = AirPressureForce;
+	inputs.SpringCoefficient = SpringCoefficient;
+	inputs.VelocityDamping = VelocityDamping;
+	inputs.ForceNoiseMagnitude = ForceNoiseMagnitude;
+	inputs.ForceBigNoiseMagnitude = ForceBigNoiseMagnitude;
+	inputs.BigNoiseChangeInterval = BigNoiseChangeInterval;
+	inputs.GlobalBounceMultiplier = GlobalBounceMultiplier;
+
+	// the solver's own state goes to its back buffer, Blueprint edits since the last publish carry into the solve
+	SolveGlobalForce = GlobalForce;
+	SolveBigNoiseVector = BigNoiseVector;
+	SolveBigNoiseChangeTimer = BigNoiseChangeTimer;
+
+	// only servers judge hits from the past, clients and standalone games have nothing to compensate
+	double rewindHistory = CVarBubbleRewindHistoryMs.GetValueOnGameThread() / 1000.0;
+	ENetMode netMode = GetNetMode();
+	inputs.bRecordRewind = rewindHistory > 0 && (netMode == NM_DedicatedServer || netMode == NM_ListenServer)
+		&& RewindHistory.WantsRecord(GetWorld()->GetTimeSeconds(), rewindHistory);
+
+	if (ReplayContacts) {
+		inputs.Contacts = *ReplayContacts;
+	}
+	else {
+		// actors are only read here, each substep gets what Contacts.Update would have produced for it
+		const FDynamicMesh3& frontMesh = GetSurface();
+		inputs.Contacts.SetNum(Substeps);
+		for (TArray<FBubbleSolverContact>& solverContacts : inputs.Contacts) {
+			Contacts.Update(frontMesh, inputs.ActorLocation + CenterOfMass, StepTime, ImpactVertexPushStrength, ImpactGlobalPushStrength, solverContacts);
+		}
+		// a catch-up has no substep to apply impulses in, they wait for the next full step
+		if (Substeps > 0) {
+			inputs.Contacts[0].Append(PendingImpulses);
+			PendingImpulses.Reset();
+		}
+	}
 
-	// explosive force
-	FCollisionQueryParams QueryParams;
-	QueryParams.AddIgnoredActor(this);
-	TArray<FHitResult> HitResults;
-	GetWorld()->SweepMultiByChannel(HitResults, GetActorLocation() + CenterOfMass, GetActorLocation() + CenterOfMass, FQuat::Identity, ECC_WorldDynamic, FCollisionShape::MakeSphere(PopForce * PopForceBase), QueryParams);
-	for (auto& Hit : HitResults) {
-		if (!IsValid(Hit.GetActor()) || Hit.GetActor() == this)
-			continue;
-		if (Cast<ABubble>(Hit.GetActor()))
-			continue;
+	UBubbleReplaySubsystem* replaySubsystem = GetWorld()->GetSubsystem<UBubbleReplaySubsystem>();
+	if (replaySubsystem && replaySubsystem->IsRecording()) {
+		replaySubsystem->RecordStep(this, StepTime, Substeps, RelaxTime, inputs.Contacts);
+	}
 
-		FVector Direction = (Hit.ImpactPoint - (GetActorLocation() + CenterOfMass)).GetSafeNormal();
-		double Distance = (Hit.ImpactPoint - (GetActorLocation() + CenterOfMass)).Size();
+	if (Substeps > 0) {
+		// headless bubbles never update the component, so its bounds are stale; the sphere of the current size is not
+		double boundsRadius = FMath::Max(ActualRadius, double(Radius));
+		FBox bounds = FBox::BuildAABB(inputs.ActorLocation + CenterOfMass, FVector(boundsRadius));
+		inputs.CollisionMode = UBubbleScalabilitySettings::GetActiveLevel().CollisionMode;
 
-		double PopForce2 = FMath::Max(0, FMath::Pow(PopForce - 30, 2.5));
-		auto Character = Cast<ACharacter>(Hit.GetActor());
-		if (Character) {
-			Character->GetCharacterMovement()->AddImpulse(Direction * PopForce2 * PopForceBase / Distance, true);
-			UE_LOG(LogTemp, Warning, TEXT("Character hit"));
+		if (const UBubbleForceFieldSubsystem* forceFields = GetWorld()->GetSubsystem<UBubbleForceFieldSubsystem>()) {
+			forceFields->GetBubbleFields(bounds, inputs.ForceFields);
 		}
-		else {
-			auto Primitive = Cast<UPrimitiveComponent>(Hit.GetActor()->GetRootComponent());
-			if (Primitive && Primitive->IsSimulatingPhysics()) {
-				Primitive->AddImpulseAtLocation(Direction * PopForce2 * PopForceBase / Distance, Hit.ImpactPoint);
-				UE_LOG(LogTemp, Warning, TEXT("Primitive %s hit"), *Hit.GetActor()->GetName());
-			}
+
+		// static geometry comes from the distance field cache, one overlap decides whether dynamic objects need vertex traces
+		inputs.SDF = inputs.CollisionMode == EBubbleCollisionMode::StaticSDF ? GetWorld()->GetSubsystem<UBubbleSDFSubsystem>() : nullptr;
+		if (inputs.SDF) {
+			FBox region = bounds.ExpandBy(Radius * 0.5);
+			inputs.SDF->RequestRegion(region);
+			auto params = FCollisionQueryParams::DefaultQueryParam;
+			params.AddIgnoredActor(this);
+			inputs.bTraceDynamic = GetWorld()->OverlapAnyTestByObjectType(region.GetCenter(), FQuat::Identity, GetDynamicObjectTypes(), FCollisionShape::MakeBox(region.GetExtent()), params);
 		}
+
+		// recorded and replayed steps must see the same planes, which async traces coming back a frame later can't promise
+		GatherCollisionPlanes(inputs, ReplayContacts || (replaySubsystem && replaySubsystem->IsRecording()));
 	}
 
-	Destroy();
-}
\ No newline at end of file
+	// headless bubbles have no front buffer, the game thread reads SolveMesh and must not race a solve
+	bSolvePending = true;
+	if (!bHeadless && CVarBubbleAsyncSolve.GetValueOnGameThread()) {
+		SolveTask = UE::Tasks::Launch(UE_SOURCE_LOCATION, [this, inputs = MoveTemp(inputs)]() mutable {
+			Solve(inputs);
+		});
+	}
+	else {
+		Solve(inputs);
+		CompleteSimulation();
+	}
+}
+
+void ABubble::QueueCommand(const FBubbleCommand& Command) {
+	Commands.Enqueue(Command);
+}
+
+void ABubble::ProcessCommands() {
+	if (bSolvePending)
+		return;
+
+	LLM_SCOPE_BYTAG(BubbleSimulation);
+
+	FBubbleCommand command;
+	while (Commands.Dequeue(command)) {
+		switch (command.Type) {
+		case EBubbleCommandType::Impulse: {
+			// faces of a mesh that was rebuilt since the impulse was queued are gone
+			if (command.FaceIndex != INDEX_NONE && !GetSurface().IsTriangle(command.FaceIndex))
+				break;
+			FBubbleSolverContact& impulse = PendingImpulses.AddDefaulted_GetRef();
+			impulse.FaceIndex = command.FaceIndex;
+			if (command.FaceIndex != INDEX_NONE) {
+				impulse.VertexVelocityDelta = command.Vector;
+			} else {
+				impulse.GlobalForce = command.Vector;
+			}
+			LastInteractionTime = GetWorld()->GetTimeSeconds();
+			break;
+		}
+		case EBubbleCommandType::Grow: {
+			UBubbleReplaySubsystem* replaySubsystem = GetWorld()->GetSubsystem<UBubbleReplaySubsystem>();
+			if (replaySubsystem && replaySubsystem->IsRecording()) {
+				replaySubsystem->RecordGrow(this, command.Scalar);
+			}
+
+			double newRadius = Radius + command.Scalar;
+			AirPressureForce = AirPressureForce * FMath::Pow(newRadius / Radius, 4);
+			Radius = newRadius;
+			break;
+		}
+		case EBubbleCommandType::Pop:
+			// popping destroys the actor, the subsystem does it outside of whatever is draining the queue
+			if (UBubblePopSubsystem* popSubsystem = GetWorld()->GetSubsystem<UBubblePopSubsystem>()) {
+				popSubsystem->QueuePop(this);
+			}
+			break;
+		case EBubbleCommandType::Contact: {
+			AActor* actor = command.Actor.Get();
+			if (!IsValid(actor) || !GetSurface().IsTriangle(command.FaceIndex))
+				break;
+
+			// all hits of one actor within a frame become a single push
+			LastInteractionTime = GetWorld()->GetTimeSeconds();
+			bool bNewContact = false;
+			FBubbleContact& contact = Contacts.AddHit(actor, command.FaceIndex, command.Barycentric, command.Vector, command.Scalar, bNewContact);
+			contact.VertexFactor = HitSingleVertexFactor(actor);
+			contact.GlobalFactor = HitGlobalFactor(actor);
+			break;
+		}
+		}
+	}
+}
+
+void ABubble::CompleteSimulation(bool bWait) {
+	if (!bSolvePending)
+		return;
+	if (!bWait && !SolveTask.IsCompleted())
+		return;
+
+	SolveTask.Wait();
+	bSolvePending = false;
+	PublishSolve();
+}
+
+FVector ABubble::GetCenterOfMass() {
+	CompleteSimulation();
+	return CenterOfMass;
+}
+
+void ABubble::Solve(FBubbleSolveInputs& Inputs) {
+	LLM_SCOPE_BYTAG(BubbleSimulation);
+	const double solveStart = FPlatformTime::Seconds();
+
+	// normals are refreshed once at the end, substeps after the first see the previous substep's surface only through positions
+	for (int32 i = 0; i < Inputs.Substeps; i++) {
+		SimulateStep(Inputs.StepTime, Inputs.Contacts[i], Inputs);
+	}
+	if (Inputs.RelaxTime > 0) {
+		RelaxSurface(Inputs.RelaxTime, Inputs);
+	}
+
+	SolveCenterOfMass = ComputeCenterOfMass(SolveMesh);
+	if (!bHeadless) {
+		if (Refinement) {
+			RefineSurface(SolveMesh, SolveCenterOfMass, *Refinement, SolveRenderMesh);
+			ComputeNormals(SolveRenderMesh, RenderAverageVertexArea);
+		}
+		else {
+			ComputeNormals(SolveMesh, AverageVertexArea);
+		}
+
+		FVector3d extents = ComputeExtents(SolveMesh, SolveCenterOfMass, SolveActualRadius);
+		SolveStretch = float(extents.GetMax() / FMath::Max(extents.GetMin(), UE_DOUBLE_KINDA_SMALL_NUMBER));
+	}
+
+	bSolveRewindValid = Inputs.bRecordRewind;
+	if (bSolveRewindValid) {
+		SolveRewindState.Fit(SolveMesh, Inputs.ActorLocation, SolveCenterOfMass);
+	}
+
+	SolveSeconds = FPlatformTime::Seconds() - solveStart;
+}
+
+void ABubble::PublishSolve() {
+	LLM_SCOPE_BYTAG(BubbleMesh);
+
+	CenterOfMassVelocity = SolveDuration > 0 ? (SolveCenterOfMass - CenterOfMass) / SolveDuration : FVector3d::Zero();
+	CenterOfMass = SolveCenterOfMass;
+	ActualRadius = SolveActualRadius;
+	GlobalForce = SolveGlobalForce;
+	BigNoiseVector = SolveBigNoiseVector;
+	BigNoiseChangeTimer = SolveBigNoiseChangeTimer;
+	LastSolveSeconds = SolveSeconds;
+	if (SphericalIndex.NeedsRebuild(SolveMesh, CenterOfMass)) {
+		SphericalIndex.Invalidate();
+	}
+
+	if (bSolveRewindValid) {
+		SolveRewindState.Time = GetWorld()->GetTimeSeconds();
+		RewindHistory.Record(SolveRewindState);
+		bSolveRewindValid = false;
+	}
+
+	if (bHeadless) {
+		UpdateCollisionProxy();
+		return;
+	}
+
+	// the coarse surface of a refined bubble cooks the collision, see SetCollisionMesh
+	if (Refinement) {
+		CollisionMesh->GetDynamicMesh()->EditMesh(
+			[&](FDynamicMesh3& Mesh) {
+				for (int32 i = 0; i < Mesh.MaxVertexID(); i++) {
+					Mesh.SetVertex(i, SolveMesh.GetVertex(i));
+				}
+			}
+		);
+	}
+
+	const FDynamicMesh3& renderMesh = Refinement ? SolveRenderMesh : SolveMesh;
+	BubbleMesh->GetDynamicMesh()->EditMesh(
+		[&](FDynamicMesh3& Mesh) {
+			auto ColorOverlay = Mesh.Attributes()->PrimaryColors();
+			const auto SolveColorOverlay = renderMesh.Attributes()->PrimaryColors();
+			for (int32 i = 0; i < Mesh.MaxVertexID(); i++) {
+				Mesh.SetVertex(i, renderMesh.GetVertex(i));
+				Mesh.SetVertexNormal(i, renderMesh.GetVertexNormal(i));
+				Mesh.SetVertexColor(i, renderMesh.GetVertexColor(i));
+				ColorOverlay->SetElement(i, SolveColorOverlay->GetElement(i));
+			}
+		}
+	);
+
+	BubbleMesh->SetCustomPrimitiveDataFloat(StretchDataIndex, SolveStretch);
+
+	// rebuilds the render proxy and starts cooking the complex collision, see bUseAsyncCooking
+	LLM_SCOPE_BYTAG(BubbleCollision);
+	BubbleMesh->NotifyMeshUpdated();
+}
+
+void ABubble::GatherCollisionPlanes(FBubbleSolveInputs& Inputs, bool bDeterministic) {
+	const double solveTime = Inputs.StepTime * Inputs.Substeps;
+	const FVector3d worldCenter = Inputs.ActorLocation + CenterOfMass;
+	auto params = FCollisionQueryParams::DefaultQueryParam;
+	params.AddIgnoredActor(this);
+
+	// nothing near the bubble, none of the vertices can hit anything this solve and the traces in flight are stale
+	const bool bFull = Inputs.CollisionMode == EBubbleCollisionMode::Full;
+	const FBox region = FBox::BuildAABB(worldCenter, FVector(FMath::Max(ActualRadius, double(Radius)) * 1.5));
+	if ((bFull && !GetWorld()->OverlapAnyTestByChannel(region.GetCenter(), FQuat::Identity, ECC_WorldDynamic, FCollisionShape::MakeBox(region.GetExtent()), params))
+		|| (!bFull && !Inputs.SDF)) {
+		ResetCollisionTraces();
+		return;
+	}
+
+	// the planes normally come from async traces issued by an earlier solve; nothing traced for this mesh yet (spawn,
+	// remesh, just got near something) is traced here once rather than letting the first steps pass through
+	const bool bSynchronous = bDeterministic || CollisionPlanes.Num() != SolveMesh.MaxVertexID();
+	if (!bSynchronous) {
+		Inputs.CollisionPlanes = CollisionPlanes;
+	}
+	else {
+		Inputs.CollisionPlanes.Reset();
+		Inputs.CollisionPlanes.SetNum(SolveMesh.MaxVertexID());
+	}
+
+	// a new round starts once the last one is back, its planes serve the next solve
+	const bool bIssueRound = !bDeterministic && CollisionTracesInFlight == 0;
+	if (bIssueRound) {
+		TracedCollisionPlanes.Reset();
+		TracedCollisionPlanes.SetNum(SolveMesh.MaxVertexID());
+	}
+	if (!bSynchronous && !bIssueRound)
+		return;
+
+	// vertices move along their velocity plus what the forces add, the margin covers the latter; async planes are
+	// used a solve later, so they look ahead over two
+	const double margin = FMath::Max(Radius * 0.1, 5.0);
+	const double lookahead = solveTime * (bIssueRound ? 2.5 : 1.5);
+	const FCollisionObjectQueryParams dynamicObjects = GetDynamicObjectTypes();
+	const FTraceDelegate onTrace = FTraceDelegate::CreateUObject(this, &ABubble::OnCollisionTrace, CollisionTraceRound);
+	for (int32 i = 0; i < SolveMesh.MaxVertexID(); i++) {
+		FVector3d start = SolveMesh.GetVertex(i) + Inputs.ActorLocation;
+		FVector3d direction = VertexVelocities[i].GetSafeNormal();
+		if (direction.IsZero()) {
+			direction = (start - worldCenter).GetSafeNormal();
+		}
+		FVector3d end = start + direction * (VertexVelocities[i].Size() * lookahead + margin);
+
+		// the distance field covers static geometry where its bricks are baked, the rest is traced
+		float distance = 0;
+		FVector gradient;
+		const bool bTraceStatic = bFull || !Inputs.SDF->Sample(start, distance, gradient);
+		const bool bTraceDynamic = !bFull && Inputs.bTraceDynamic;
+
+		if (bIssueRound) {
+			if (bTraceStatic) {
+				GetWorld()->AsyncLineTraceByChannel(EAsyncTraceType::Single, start, end, ECC_WorldDynamic, params, FCollisionResponseParams::DefaultResponseParam, &onTrace, i);
+				CollisionTracesInFlight++;
+			}
+			if (bTraceDynamic) {
+				GetWorld()->AsyncLineTraceByObjectType(EAsyncTraceType::Single, start, end, dynamicObjects, params, &onTrace, i);
+				CollisionTracesInFlight++;
+			}
+		}
+
+		if (bSynchronous) {
+			FHitResult hit;
+			if (bTraceStatic && GetWorld()->LineTraceSingleByChannel(hit, start, end, ECC_WorldDynamic, params)) {
+				Inputs.CollisionPlanes[i].AddHit(hit, start);
+			}
+			if (bTraceDynamic && GetWorld()->LineTraceSingleByObjectType(hit, start, end, dynamicObjects, params)) {
+				Inputs.CollisionPlanes[i].AddHit(hit, start);
+			}
+		}
+	}
+
+	if (bSynchronous && !bDeterministic) {
+		CollisionPlanes = Inputs.CollisionPlanes;
+	}
+	// every vertex was in baked distance field bricks, the round is done without a trace
+	if (bIssueRound && CollisionTracesInFlight == 0) {
+		CollisionPlanes = MoveTemp(TracedCollisionPlanes);
+	}
+}
+
+void ABubble::OnCollisionTrace(const FTraceHandle& Handle, FTraceDatum& Datum, uint32 Round) {
+	// a remesh or a bubble with nothing near dropped the round since
+	if (Round != CollisionTraceRound)
+		return;
+
+	const int32 vertex = int32(Datum.UserData);
+	for (const FHitResult& hit : Datum.OutHits) {
+		if (hit.bBlockingHit && TracedCollisionPlanes.IsValidIndex(vertex)) {
+			TracedCollisionPlanes[vertex].AddHit(hit, Datum.Start);
+		}
+	}
+
+	if (--CollisionTracesInFlight == 0) {
+		CollisionPlanes = MoveTemp(TracedCollisionPlanes);
+	}
+}
+
+void ABubble::ResetCollisionTraces() {
+	CollisionTraceRound++;
+	CollisionTracesInFlight = 0;
+	CollisionPlanes.Reset();
+	TracedCollisionPlanes.Reset();
+}
+
+void ABubble::SimulateStep(double DeltaTime, const TArray<FBubbleSolverContact>& SolverContacts, FBubbleSolveInputs& Inputs) {
+	FDynamicMesh3& Mesh = SolveMesh;
+	const FVector3d centerOfMass = ComputeCenterOfMass(Mesh);
+	FRandomStream& random = Inputs.Random;
+
+	if (SolveBigNoiseChangeTimer <= 0 || random.GetFraction() < DeltaTime * (1.0 - SolveBigNoiseChangeTimer / Inputs.BigNoiseChangeInterval)) {
+		SolveBigNoiseVector = random.GetUnitVector();
+		SolveBigNoiseChangeTimer = Inputs.BigNoiseChangeInterval;
+	}
+	SolveBigNoiseChangeTimer -= DeltaTime;
+
+	double deltaTime = DeltaTime;
+	// VelocityDamping is tuned per step at 60 Hz, scale it so longer substeps lose the same energy per second
+	double damping = FMath::Pow(Inputs.VelocityDamping, deltaTime * 60.0);
+
+	for (const auto& contact : SolverContacts) {
+		if (contact.FaceIndex != INDEX_NONE) {
+			auto hitFace = Mesh.GetTriangle(contact.FaceIndex);
+			VertexVelocities[hitFace.A] += contact.VertexVelocityDelta;
+			VertexVelocities[hitFace.B] += contact.VertexVelocityDelta;
+			VertexVelocities[hitFace.C] += contact.VertexVelocityDelta;
+		}
+		SolveGlobalForce += contact.GlobalForce;
+	}
+
+	double VertexDisplacementSum = 0;
+	int VertexCount = 0;
+
+	TArray<FVector3d> forces;
+	forces.Init(FVector3d::Zero(), Mesh.MaxVertexID());
+	for (int32 i = 0; i < Mesh.MaxVertexID(); i++) {
+		FVector3d force{ 0, 0, 0 };
+
+		FVector3d pos = Mesh.GetVertex(i);
+		FVector3d airPressureForce = (pos - centerOfMass).GetSafeNormal();
+		// headless and refined simulated meshes carry no normals, the radial direction alone is close enough for a roughly round bubble
+		if (Mesh.HasVertexNormals()) {
+			airPressureForce = (airPressureForce + FVector(Mesh.GetVertexNormal(i))).GetSafeNormal();
+		}
+		double comDistance = (pos - centerOfMass).Size();
+		airPressureForce *= 1 / (comDistance * comDistance) * Inputs.AirPressureForce;
+		force += airPressureForce;
+
+		Mesh.EnumerateVertexEdges(i, [&](int32 edgeId) {
+			auto edge = Mesh.GetEdge(edgeId);
+			int32 neigh = edge.Vert.A == i ? edge.Vert.B : edge.Vert.A;
+			FVector3d neighPos = Mesh.GetVertex(neigh);
+			FVector3d springForce = (neighPos - pos).GetSafeNormal();
+			double edgeLength = (neighPos - pos).Size();
+			double targetLength = TargetEdgeLengths[edgeId] * Inputs.Radius / Inputs.InitialRadius;
+			springForce *= (edgeLength - targetLength) * Inputs.SpringCoefficient;
+			force += springForce;
+		});
+
+		force += random.GetUnitVector() * Inputs.ForceNoiseMagnitude;
+		force += (2.0 * FMath::Abs(FVector3d::DotProduct(pos - centerOfMass, SolveBigNoiseVector)) - 1) * (centerOfMass - pos).GetSafeNormal() * Inputs.ForceBigNoiseMagnitude;
+		force += SolveGlobalForce / deltaTime;
+
+		forces[i] = force;
+
+		VertexDisplacementSum += (pos - centerOfMass).Size();
+		VertexCount++;
+	}
+	SolveActualRadius = VertexDisplacementSum / VertexCount;
+
+	// force field volumes see every vertex of the bubble in one batch
+	if (Inputs.ForceFields.Num() > 0) {
+		TArray<FVector3d> positions;
+		positions.SetNumUninitialized(forces.Num());
+		for (int32 i = 0; i < Mesh.MaxVertexID(); i++) {
+			positions[i] = Mesh.GetVertex(i);
+		}
+		FBubbleForceField::AddForces(Inputs.ForceFields, Inputs.ActorLocation, positions, forces);
+	}
+	
+	SolveGlobalForce = FVector3d::Zero();
+
+	FVector3d totalBounce = FVector3d::Zero();
+	const EBubbleCollisionMode collisionMode = Inputs.CollisionMode;
+	const FVector3d ActorPos = Inputs.ActorLocation;
+	const UBubbleSDFSubsystem* sdf = Inputs.SDF;
+	const FBubbleCollisionPlane noPlane;
+	for (int32 i = 0; i < Mesh.MaxVertexID(); i++) {
+		double mass = 0;
+		Mesh.EnumerateVertexTriangles(i, [&](int32 face) {
+			FVector3d v0, v1, v2;
+			Mesh.GetTriVertices(face, v0, v1, v2);
+			double faceArea = FMath::Abs(FVector3d::CrossProduct(v1 - v0, v2 - v0).Size() / 2);
+			mass += faceArea;
+		});
+		mass /= 3;
+		FVector3d vel = VertexVelocities[i];
+		FVector3d force = forces[i];
+		vel += force * deltaTime;
+		VertexVelocities[i] = vel * damping;
+		FVector3d newPos = Mesh.GetVertex(i) + vel * deltaTime;
+		FVector3d start = Mesh.GetVertex(i) + ActorPos;
+		FVector3d end = newPos + ActorPos;
+		bool bHit = false;
+		FVector3d hitNormal = FVector3d::Zero();
+		// the world is not queried here, traces were gathered on the game thread into the planes
+		const FBubbleCollisionPlane& plane = Inputs.CollisionPlanes.IsValidIndex(i) ? Inputs.CollisionPlanes[i] : noPlane;
+		if (collisionMode == EBubbleCollisionMode::Full) {
+			bHit = plane.IsBehind(end);
+			hitNormal = plane.Normal;
+		}
+		else if (sdf) {
+			float distance = 0;
+			FVector gradient;
+			if (sdf->Sample(end, distance, gradient)) {
+				bHit = distance <= 0 && !gradient.IsZero();
+				hitNormal = gradient;
+			}
+			// bricks not baked yet or not supported by the shapes in them, and dynamic objects
+			if (!bHit && plane.IsBehind(end)) {
+				bHit = true;
+				hitNormal = plane.Normal;
+			}
+		}
+		if (bHit) {
+			//Mesh.SetVertex(i, Mesh.GetVertex(i) - vel * deltaTime);
+			// proper reflection taking the hit normal into account
+			FVector3d bounce = -FVector3d::DotProduct(VertexVelocities[i], hitNormal) * hitNormal;
+			VertexVelocities[i] = (VertexVelocities[i] + 1.9 * bounce);
+			totalBounce += bounce;
+		}
+		else {
+			Mesh.SetVertex(i, newPos);
+		}
+	}
+	SolveGlobalForce += totalBounce * Inputs.GlobalBounceMultiplier;
+}
+
+void ABubble::RelaxSurface(double DeltaTime, const FBubbleSolveInputs& Inputs) {
+	const FVector3d centerOfMass = ComputeCenterOfMass(SolveMesh);
+
+	SolveBigNoiseChangeTimer -= DeltaTime;
+
+	// the springs settle the surface within about half a second, move the same way toward a sphere of the current
+	// size without forces or traces; impulses received in the meantime are spent on the settling
+	double relax = 1.0 - FMath::Exp(-DeltaTime / 0.5);
+	double damping = FMath::Pow(Inputs.VelocityDamping, DeltaTime * 60.0) * (1.0 - relax);
+	SolveGlobalForce = FVector3d::Zero();
+
+	for (int32 i = 0; i < SolveMesh.MaxVertexID(); i++) {
+		FVector3d pos = SolveMesh.GetVertex(i);
+		FVector3d restPos = centerOfMass + (pos - centerOfMass).GetSafeNormal() * SolveActualRadius;
+		SolveMesh.SetVertex(i, FMath::Lerp(pos, restPos, relax));
+		VertexVelocities[i] *= damping;
+	}
+}
+
+void ABubble::Generate() {
+	CompleteSimulation();
+
+	// BubbleMesh->SetOverrideRenderMaterial(BubbleMaterial);
+	BubbleMesh->SetMaterial(0, BubbleMaterial);
+
+	Radius = InitialRadius;
+	MeshSubdivisions = FMath::Min(Subdivisions, UBubbleScalabilitySettings::GetActiveLevel().MaxSubdivisions);
+	InitializeMesh();
+	RewindHistory.Reset();
+
+	UpdateCenterOfMass();
+	SphericalIndex.Invalidate();
+
+	UpdateNormals();
+
+	if (bRandomizeColor && !bHeadless)
+		RandomizeColor();
+}
+
+void ABubble::InitializeMesh() {
+	LLM_SCOPE_BYTAG(BubbleMesh);
+
+	const FBubbleTopologyTemplate& topology = GetTopologyTemplate(MeshSubdivisions);
+
+	// rest state is a sphere of InitialRadius, the springs scale it to the current Radius
+	FDynamicMesh3 dynMesh = topology.Mesh;
+	for (int32 i = 0; i < dynMesh.MaxVertexID(); i++) {
+		dynMesh.SetVertex(i, dynMesh.GetVertex(i) * InitialRadius);
+	}
+
+	TargetEdgeLengths.SetNumUninitialized(topology.UnitEdgeLengths.Num());
+	for (int32 i = 0; i < topology.UnitEdgeLengths.Num(); i++) {
+		TargetEdgeLengths[i] = topology.UnitEdgeLengths[i] * InitialRadius;
+	}
+	AverageVertexArea = topology.UnitAverageVertexArea * InitialRadius * InitialRadius;
+
+	VertexVelocities.Init(FVector3d::Zero(), dynMesh.MaxVertexID());
+
+	// planes are per vertex of the old mesh
+	ResetCollisionTraces();
+
+	Refinement = nullptr;
+	SolveRenderMesh.Clear();
+
+	if (bHeadless) {
+		// normals and colors are never computed, drop them along with the component mesh
+		dynMesh.DiscardAttributes();
+		dynMesh.DiscardVertexNormals();
+		dynMesh.DiscardVertexColors();
+		SolveMesh = MoveTemp(dynMesh);
+		bSolveMeshStale = true;
+		return;
+	}
+
+	// the simulated mesh moves out of the component, which gets the finer rendered one
+	int32 renderSubdivisions = FMath::Min(MeshSubdivisions + FMath::Max(RenderRefinement, 0), MaxRenderSubdivisions);
+	if (renderSubdivisions > MeshSubdivisions) {
+		const FBubbleTopologyTemplate& renderTopology = GetTopologyTemplate(renderSubdivisions);
+		Refinement = &GetRefinementWeights(MeshSubdivisions, renderSubdivisions);
+		RenderAverageVertexArea = renderTopology.UnitAverageVertexArea * InitialRadius * InitialRadius;
+
+		SolveRenderMesh = renderTopology.Mesh;
+		RefineSurface(dynMesh, FVector3d::Zero(), *Refinement, SolveRenderMesh);
+
+		dynMesh.DiscardAttributes();
+		dynMesh.DiscardVertexNormals();
+		dynMesh.DiscardVertexColors();
+		UDynamicMesh* surfaceMesh = NewObject<UDynamicMesh>();
+		surfaceMesh->SetMesh(MoveTemp(dynMesh));
+		SetCollisionMesh(surfaceMesh);
+		dynMesh = SolveRenderMesh;
+	}
+	else {
+		SetCollisionMesh(nullptr);
+	}
+
+	UDynamicMesh* dynamicMesh = NewObject<UDynamicMesh>();
+	dynamicMesh->SetMesh(MoveTemp(dynMesh));
+
+	BubbleMesh->SetDynamicMesh(dynamicMesh);
+	bSolveMeshStale = true;
+}
+
+void ABubble::SetCollisionMesh(UDynamicMesh* SurfaceMesh) {
+	// collision stays with whichever component had it, Blueprints may have changed it since the constructor
+	ECollisionEnabled::Type collision = CollisionMesh && CollisionMesh->IsCollisionEnabled() ? CollisionMesh->GetCollisionEnabled() : BubbleMesh->GetCollisionEnabled();
+
+	if (!SurfaceMesh) {
+		if (CollisionMesh && CollisionMesh->IsCollisionEnabled()) {
+			CollisionMesh->SetCollisionEnabled(ECollisionEnabled::NoCollision);
+			CollisionMesh->SetDynamicMesh(NewObject<UDynamicMesh>());
+			BubbleMesh->SetCollisionEnabled(collision);
+		}
+		BubbleMesh->SetDeferredCollisionUpdatesEnabled(false, true);
+		return;
+	}
+
+	if (!CollisionMesh) {
+		CollisionMesh = NewObject<UDynamicMeshComponent>(this, TEXT("CollisionMesh"));
+		CollisionMesh->BodyInstance.CopyBodyInstancePropertiesFrom(BubbleMesh->GetBodyInstance());
+		CollisionMesh->EnableComplexAsSimpleCollision();
+		CollisionMesh->bEnableComplexCollision = true;
+		CollisionMesh->bUseAsyncCooking = true;
+		CollisionMesh->SetVisibility(false);
+		CollisionMesh->SetupAttachment(BubbleMesh);
+		CollisionMesh->RegisterComponent();
+		CollisionMesh->OnComponentHit.AddDynamic(this, &ABubble::OnHit);
+		CollisionMesh->OnComponentBeginOverlap.AddDynamic(this, &ABubble::OnOverlapBegin);
+		CollisionMesh->OnComponentEndOverlap.AddDynamic(this, &ABubble::OnOverlapEnd);
+	}
+	CollisionMesh->SetDynamicMesh(SurfaceMesh);
+	CollisionMesh->SetCollisionEnabled(collision);
+
+	// the rendered mesh never cooks its refined triangles
+	BubbleMesh->SetCollisionEnabled(ECollisionEnabled::NoCollision);
+	BubbleMesh->SetDeferredCollisionUpdatesEnabled(true, false);
+}
+
+void ABubble::SetSubdivisionCap(int32 MaxSubdivisions) {
+	SubdivisionCap = MaxSubdivisions;
+
+	// adaptive remeshing picks the level itself, the cap only lowers it
+	bool bAdaptive = CVarBubbleRemesh.GetValueOnGameThread() && !bHeadless;
+	Remesh(FMath::Min(bAdaptive ? MeshSubdivisions : Subdivisions, MaxSubdivisions));
+}
+
+int32 ABubble::GetAdaptiveSubdivisions(double ViewDistance) const {
+	if (!CVarBubbleRemesh.GetValueOnGameThread() || bHeadless)
+		return MeshSubdivisions;
+
+	double targetLength = CVarBubbleRemeshEdgeLength.GetValueOnGameThread()
+		* FMath::Max(1.0, ViewDistance / FMath::Max(CVarBubbleRemeshReferenceDistance.GetValueOnGameThread(), 1.0f));
+	int32 minLevel = FMath::Clamp(CVarBubbleRemeshMinSubdivisions.GetValueOnGameThread(), 0, SubdivisionCap);
+	int32 level = FMath::Clamp(MeshSubdivisions, minLevel, SubdivisionCap);
+
+	// a level halves the edges, the band is wider than that so some level always fits and a bubble near its
+	// edge does not switch back and forth; the edges on screen are those of the rendered mesh
+	int32 refinement = FMath::Max(RenderRefinement, 0);
+	auto edgeLength = [this, refinement](int32 l) { return IcosahedronUnitEdge * Radius / double(1 << (l + refinement)); };
+	while (level < SubdivisionCap && edgeLength(level) > targetLength * 1.5)
+		level++;
+	while (level > minLevel && edgeLength(level) < targetLength * 0.5)
+		level--;
+	return level;
+}
+
+void ABubble::Remesh(int32 Level) {
+	int32 level = FMath::Clamp(Level, 0, SubdivisionCap);
+	if (level == MeshSubdivisions)
+		return;
+
+	CompleteSimulation();
+	ProcessCommands();
+
+	UBubbleReplaySubsystem* replaySubsystem = GetWorld()->GetSubsystem<UBubbleReplaySubsystem>();
+	if (replaySubsystem && replaySubsystem->IsRecording()) {
+		replaySubsystem->RecordRemesh(this, level);
+	}
+
+	// sample the old surface along the new vertex directions
+	UpdateCenterOfMass();
+	const FBubbleSphericalIndex oldIndex = GetSphericalIndex();
+	const FDynamicMesh3 oldMesh = GetSurface();
+	const TArray<FVector3d> oldVelocities = MoveTemp(VertexVelocities);
+
+	MeshSubdivisions = level;
+	InitializeMesh();
+
+	EditSurface(
+		[&](FDynamicMesh3& Mesh) {
+			for (int32 i = 0; i < Mesh.MaxVertexID(); i++) {
+				FVector3d direction = Mesh.GetVertex(i).GetSafeNormal();
+				double distance = 0;
+				int32 face = INDEX_NONE;
+				if (!oldIndex.Raycast(oldMesh, CenterOfMass, direction, UE_BIG_NUMBER, distance, face)) {
+					Mesh.SetVertex(i, CenterOfMass + direction * ActualRadius);
+					continue;
+				}
+
+				FVector3d position = CenterOfMass + direction * distance;
+				Mesh.SetVertex(i, position);
+
+				// new vertices move like the point of the old surface they land on
+				FVector3d v0, v1, v2;
+				oldMesh.GetTriVertices(face, v0, v1, v2);
+				FVector3d barycentric = FBubbleContactManifold::ComputeBarycentric(position, v0, v1, v2);
+				UE::Geometry::FIndex3i oldFace = oldMesh.GetTriangle(face);
+				VertexVelocities[i] = oldVelocities[oldFace.A] * barycentric.X + oldVelocities[oldFace.B] * barycentric.Y + oldVelocities[oldFace.C] * barycentric.Z;
+			}
+		}
+	);
+
+	// contacts and impulses refer to faces of the old mesh
+	Contacts.Reset();
+	PendingImpulses.Reset();
+	SphericalIndex.Invalidate();
+
+	UpdateNormals();
+}
+
+void ABubble::UpdateNormals() {
+	LLM_SCOPE_BYTAG(BubbleMesh);
+
+	if (bHeadless) {
+		UpdateCollisionProxy();
+		return;
+	}
+
+	BubbleMesh->GetDynamicMesh()->EditMesh(
+		[&](FDynamicMesh3& Mesh) {
+			if (Refinement) {
+				RefineSurface(GetSurface(), CenterOfMass, *Refinement, Mesh);
+				ComputeNormals(Mesh, RenderAverageVertexArea);
+			}
+			else {
+				ComputeNormals(Mesh, AverageVertexArea);
+			}
+		}
+	);
+
+	// rebuilds the render proxy and starts cooking the complex collision, see bUseAsyncCooking
+	LLM_SCOPE_BYTAG(BubbleCollision);
+	BubbleMesh->NotifyMeshUpdated();
+}
+
+void ABubble::UpdateCenterOfMass() {
+	CenterOfMass = ComputeCenterOfMass(GetSurface());
+}
+
+const FDynamicMesh3& ABubble::GetSurface() const {
+	if (bHeadless)
+		return SolveMesh;
+	return (Refinement ? CollisionMesh : BubbleMesh)->GetDynamicMesh()->GetMeshRef();
+}
+
+void ABubble::EditSurface(TFunctionRef<void(FDynamicMesh3&)> Edit) {
+	if (bHeadless) {
+		Edit(SolveMesh);
+	}
+	else {
+		(Refinement ? CollisionMesh : BubbleMesh)->GetDynamicMesh()->EditMesh(
+			[&](FDynamicMesh3& Mesh) {
+				Edit(Mesh);
+			}
+		);
+	}
+	bSolveMeshStale = true;
+}
+
+void ABubble::UpdateCollisionProxy() {
+	if (!CollisionProxy)
+		return;
+
+	// moving and resizing a sphere is cheap, unlike cooking the triangles of the surface
+	CollisionProxy->SetRelativeLocation(CenterOfMass);
+	CollisionProxy->SetSphereRadius(FMath::Max(ActualRadius, 1.0));
+}
+
+void ABubble::OnHit(UPrimitiveComponent* HitComp, AActor* OtherActor, UPrimitiveComponent* OtherComp, FVector NormalImpulse, const FHitResult& Hit) {
+	// replayed bubbles only take the recorded contacts
+	if (!IsValid(OtherActor) || OtherActor == this || !IsValid(OtherComp) || bReplayDriven)
+		return;
+
+	// the collision is the simulated mesh, also for refined bubbles, so its faces are the simulated ones
+	const FDynamicMesh3* mesh = &GetSurface();
+	int hitFaceIndex = mesh->IsTriangle(Hit.FaceIndex) ? Hit.FaceIndex : INDEX_NONE;
+	if (hitFaceIndex == INDEX_NONE)
+	{
+		hitFaceIndex = FindFaceAtPoint(Hit.ImpactPoint);
+	}
+	if (hitFaceIndex == INDEX_NONE)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("No hit face found"));
+		return;
+	}
+
+	FVector3d v0, v1, v2;
+	mesh->GetTriVertices(hitFaceIndex, v0, v1, v2);
+	FVector3d barycentric = FBubbleContactManifold::ComputeBarycentric(Hit.ImpactPoint - GetActorLocation(), v0, v1, v2);
+	double distance = (OtherActor->GetActorLocation() - (GetActorLocation() + CenterOfMass)).Size();
+
+	// velocities are applied by the solver in the next step
+	QueueCommand(FBubbleCommand::MakeContact(OtherActor, hitFaceIndex, barycentric, FVector3d(Hit.ImpactNormal), distance));
+}
+
+void ABubble::RandomizeColor() {
+	if (ColorSeed == 0) {
+		ColorSeed = IsNameStableForNetworking() ? int32(GetTypeHash(GetName())) : FMath::Rand();
+		ColorSeed = ColorSeed != 0 ? ColorSeed : 1;
+	}
+
+	FRandomStream colorStream(ColorSeed);
+	FVector NewColor = FVector(colorStream.GetFraction(), colorStream.GetFraction(), colorStream.GetFraction());
+	NewColor /= 2.0;
+	Tint = FLinearColor(NewColor);
+	ApplyTint();
+}
+
+void ABubble::ApplyTint() {
+	// M_Bubble reads BaseColor from the custom primitive data, so every bubble shares BubbleMaterial whatever its color
+	BubbleMesh->SetCustomPrimitiveDataVector4(TintDataIndex, FVector4(Tint.R, Tint.G, Tint.B, SolveStretch));
+}
+
+void ABubble::OnOverlapBegin(UPrimitiveComponent* OverlappedComp, AActor* OtherActor, UPrimitiveComponent* OtherComp, int32 OtherBodyIndex, bool bFromSweep, const FHitResult& SweepResult) {
+	if (!IsValid(OtherActor) || OtherActor == this || !IsValid(OtherComp))
+		return;
+	UE_LOG(LogTemp, Warning, TEXT("Overlap begin with %s"), *OtherActor->GetName());
+}
+
+void ABubble::OnOverlapEnd(UPrimitiveComponent* OverlappedComp, AActor* OtherActor, UPrimitiveComponent* OtherComp, int32 OtherBodyIndex) {
+	if (!IsValid(OtherActor) || OtherActor == this || !IsValid(OtherComp))
+		return;
+	UE_LOG(LogTemp, Warning, TEXT("Overlap end with %s"), *OtherActor->GetName());
+}
+
+void ABubble::GrowBubble(double Amount) {
+	QueueCommand(FBubbleCommand::MakeGrow(Amount));
+}
+
+void ABubble::AddImpulse(const FVector& VelocityChange, int32 FaceIndex) {
+	QueueCommand(FBubbleCommand::MakeImpulse(VelocityChange, FaceIndex));
+}
+
+void ABubble::RequestPop() {
+	QueueCommand(FBubbleCommand::MakePop());
+}
+
+void ABubble::Pop() {
+	if (bPopped)
+		return;
+	bPopped = true;
+
+	UBubbleReplaySubsystem* replaySubsystem = GetWorld()->GetSubsystem<UBubbleReplaySubsystem>();
+	if (replaySubsystem && replaySubsystem->IsRecording()) {
+		replaySubsystem->RecordPop(this);
+	}
+
+	// the shockwave reads the newest center and size
+	CompleteSimulation();
+
+	// sound and explosive force are both batched by the subsystem together with any chain reaction
+	if (UBubblePopSubsystem* PopSubsystem = GetWorld()->GetSubsystem<UBubblePopSubsystem>()) {
+		PopSubsystem->AddPopSound(PopSound, GetActorLocation() + CenterOfMass, ActualRadius);
+		PopSubsystem->EmitShockwave(this);
+	}
+
+	Destroy();
+}
+
+void ABubble::SetFarField(bool bInFarField) {
+	if (bFarField == bInFarField)
+		return;
+	bFarField = bInFarField;
+
+	// a hidden component has no render proxy, so mesh updates of far bubbles cost nothing on the render thread
+	BubbleMesh->SetVisibility(!bFarField);
+}
+
+FVector3d ABubble::GetFarFieldExtents() const {
+	return ComputeExtents(GetSurface(), CenterOfMass, ActualRadius);
+}
+
+uint32 ABubble::GetStateHash() const {
+	// everything the next solve reads from the bubble itself, bit for bit
+	const FDynamicMesh3& mesh = GetSurface();
+	uint32 hash = 0;
+	for (int32 i = 0; i < mesh.MaxVertexID(); i++) {
+		FVector3d position = mesh.GetVertex(i);
+		hash = FCrc::MemCrc32(&position, sizeof(position), hash);
+	}
+	hash = FCrc::MemCrc32(VertexVelocities.GetData(), VertexVelocities.Num() * sizeof(FVector3d), hash);
+
+	const double scalars[] = { Radius, AirPressureForce, ActualRadius, BigNoiseChangeTimer };
+	const FVector3d vectors[] = { CenterOfMass, GlobalForce, BigNoiseVector };
+	hash = FCrc::MemCrc32(scalars, sizeof(scalars), hash);
+	return FCrc::MemCrc32(vectors, sizeof(vectors), hash);
+}
+
+int32 ABubble::ReseedSimulation() {
+	// 0 would mean "derive from the name" when the seed is handed to a replayed bubble
+	int32 seed = int32(SimulationRandom.GetUnsignedInt());
+	if (seed == 0)
+		seed = 1;
+	SimulationRandom.Initialize(seed);
+	return seed;
+}
+
+bool ABubble::ReplayStep(double StepTime, int32 Substeps, double RelaxTime, const TArray<TArray<FBubbleSolverContact>>& StepContacts) {
+	if (StepContacts.Num() != Substeps)
+		return false;
+
+	// the solve indexes the faces without checking, the mesh topology is the same in the solve in flight
+	const FDynamicMesh3& mesh = GetSurface();
+	for (const TArray<FBubbleSolverContact>& substepContacts : StepContacts) {
+		for (const FBubbleSolverContact& contact : substepContacts) {
+			if (contact.FaceIndex != INDEX_NONE && !mesh.IsTriangle(contact.FaceIndex))
+				return false;
+		}
+	}
+
+	RunSolve(StepTime, Substeps, RelaxTime, &StepContacts);
+	CompleteSimulation();
+	return true;
+}
+
+FBubbleMemoryUsage ABubble::GetMemoryUsage() const {
+	FBubbleMemoryUsage usage;
+	usage.Simulation = sizeof(ABubble) + VertexVelocities.GetAllocatedSize() + TargetEdgeLengths.GetAllocatedSize()
+		+ Contacts.GetAllocatedSize() + SphericalIndex.GetAllocatedSize() + PendingSnapshot.GetAllocatedSize()
+		+ RewindHistory.GetAllocatedSize();
+
+	// FDynamicMesh3 does not report its allocations, estimate them from the buffer sizes: position, normal, color,
+	// refcount and an edge list of about six per vertex; vertices, edges and refcount per triangle; color overlay
+	auto estimateMeshSize = [](const FDynamicMesh3& mesh) {
+		const SIZE_T vertexBytes = sizeof(FVector3d) + 2 * sizeof(FVector3f) + sizeof(int16) + 8 * sizeof(int32);
+		const SIZE_T triangleBytes = 2 * sizeof(UE::Geometry::FIndex3i) + sizeof(int16);
+		const SIZE_T edgeBytes = sizeof(FDynamicMesh3::FEdge) + sizeof(int16);
+		SIZE_T size = mesh.MaxVertexID() * vertexBytes + mesh.MaxTriangleID() * triangleBytes + mesh.MaxEdgeID() * edgeBytes;
+		if (mesh.HasAttributes() && mesh.Attributes()->PrimaryColors()) {
+			const auto* colorOverlay = mesh.Attributes()->PrimaryColors();
+			size += colorOverlay->MaxElementID() * (sizeof(FVector4f) + 2 * sizeof(int32)) + mesh.MaxTriangleID() * sizeof(UE::Geometry::FIndex3i);
+		}
+		return size;
+	};
+	// SolveMesh is the back buffer of the same mesh, its topology is not touched by a solve in flight
+	usage.Mesh = sizeof(UDynamicMeshComponent) + sizeof(UDynamicMesh) + sizeof(FDynamicMesh3)
+		+ (bHeadless ? 0 : estimateMeshSize(BubbleMesh->GetDynamicMesh()->GetMeshRef())) + estimateMeshSize(SolveMesh)
+		+ (Refinement ? estimateMeshSize(GetSurface()) : 0) + estimateMeshSize(SolveRenderMesh);
+
+	if (UBodySetup* bodySetup = (Refinement ? CollisionMesh : BubbleMesh)->GetBodySetup()) {
+		usage.Collision = bodySetup->GetResourceSizeBytes(EResourceSizeMode::EstimatedTotal);
+	}
+
+	if (UMaterialInstanceDynamic* dynamicMaterial = Cast<UMaterialInstanceDynamic>(BubbleMesh->GetMaterial(0))) {
+		usage.Material = dynamicMaterial->GetResourceSizeBytes(EResourceSizeMode::EstimatedTotal);
+	}
+
+	return usage;
+}
+
+const FBubbleSphericalIndex& ABubble::GetSphericalIndex() {
+	if (!SphericalIndex.IsValid()) {
+		LLM_SCOPE_BYTAG(BubbleSimulation);
+		SphericalIndex.Build(GetSurface(), CenterOfMass);
+	}
+	return SphericalIndex;
+}
+
+int32 ABubble::FindFaceInDirection(const FVector& Direction) {
+	return GetSphericalIndex().FindFace(GetSurface(), Direction);
+}
+
+int32 ABubble::FindFaceAtPoint(const FVector& WorldPoint) {
+	return FindFaceInDirection(WorldPoint - (GetActorLocation() + CenterOfMass));
+}
+
+bool ABubble::RaycastBubble(const FVector& Start, const FVector& End, FVector& OutHitLocation, int32& OutFaceIndex) {
+	FVector3d direction = End - Start;
+	double length = direction.Size();
+	OutFaceIndex = INDEX_NONE;
+	if (length <= UE_DOUBLE_SMALL_NUMBER)
+		return false;
+	direction /= length;
+
+	double distance = 0;
+	FVector3d localStart = Start - GetActorLocation();
+	if (!GetSphericalIndex().Raycast(GetSurface(), localStart, direction, length, distance, OutFaceIndex))
+		return false;
+
+	OutHitLocation = Start + direction * distance;
+	return true;
+}
+
+bool ABubble::ComputeFloor(const FVector& SphereCenter, double SphereRadius, double& OutDistance, FVector& OutImpactPoint, FVector& OutNormal) {
+	FVector3d center = GetActorLocation() + CenterOfMass;
+	FVector3d offset = SphereCenter - center;
+	if (offset.Z <= 0)
+		return false;
+
+	// the surface radius depends on the direction of the contact, which depends on the distance: the second pass
+	// measures it where the first one landed
+	const FBubbleSphericalIndex& index = GetSphericalIndex();
+	FVector3d direction = offset.GetSafeNormal();
+	for (int32 pass = 0; pass < 2; pass++) {
+		double surfaceRadius = 0;
+		int32 face = INDEX_NONE;
+		if (!index.Raycast(GetSurface(), CenterOfMass, direction, UE_BIG_NUMBER, surfaceRadius, face))
+			return false;
+
+		// moving down by distance d touches the sphere of the surface radius grown by SphereRadius
+		double reach = surfaceRadius + SphereRadius;
+		double discriminant = offset.Z * offset.Z - offset.SizeSquared() + reach * reach;
+		if (discriminant < 0)
+			return false;
+		OutDistance = offset.Z - FMath::Sqrt(discriminant);
+
+		FVector3d contactDirection = (offset - FVector3d::UnitZ() * OutDistance).GetSafeNormal();
+		OutImpactPoint = center + contactDirection * surfaceRadius;
+		OutNormal = contactDirection;
+		direction = contactDirection;
+	}
+	return true;
+}
+
+bool ABubble::RaycastRewound(double ServerTime, const FVector& Start, const FVector& End, FVector& OutHitLocation) {
+	FBubbleRewindState state;
+	if (!RewindHistory.GetState(ServerTime, state)) {
+		int32 faceIndex;
+		return RaycastBubble(Start, End, OutHitLocation, faceIndex);
+	}
+
+	double distance = 0;
+	if (!state.Raycast(Start, End, distance))
+		return false;
+
+	OutHitLocation = Start + (End - Start).GetSafeNormal() * distance;
+	return true;
+}
+
+bool ABubble::OverlapsRewound(double ServerTime, const FVector& SphereCenter, double SphereRadius) const {
+	FBubbleRewindState state;
+	if (!RewindHistory.GetState(ServerTime, state)) {
+		return FVector::Dist(SphereCenter, GetActorLocation() + CenterOfMass) <= ActualRadius + SphereRadius;
+	}
+	return state.Overlaps(SphereCenter, SphereRadius);
+}
+
+void ABubble::WriteSnapshot(TArray<uint8>& OutData, bool bHalfPrecision) {
+	CompleteSimulation();
+
+	const FDynamicMesh3& mesh = GetSurface();
+	const int32 vertexCount = mesh.MaxVertexID();
+	const TArray<FBubbleContact>& contacts = Contacts.GetContacts();
+	const uint32 vectorSize = bHalfPrecision ? sizeof(FFloat16) * 3 : sizeof(FVector3f);
+
+	TArray<uint8> actorPaths;
+	FMemoryWriter actorPathWriter(actorPaths);
+	for (const FBubbleContact& contact : contacts) {
+		FString path = contact.Actor.IsValid() ? contact.Actor->GetPathName() : FString();
+		actorPathWriter << path;
+	}
+
+	FBubbleSnapshotHeader header;
+	header.Flags = uint16(bHalfPrecision ? EBubbleSnapshotFlags::HalfPrecision : EBubbleSnapshotFlags::None);
+	header.Subdivisions = MeshSubdivisions;
+	header.VertexCount = vertexCount;
+	header.ContactCount = contacts.Num();
+	header.ColorSeed = ColorSeed;
+	header.Radius = Radius;
+	header.InitialRadius = InitialRadius;
+	header.ActualRadius = ActualRadius;
+	header.PositionScale = FMath::Max(Radius, 1.0f);
+	header.AirPressureForce = AirPressureForce;
+	header.CenterOfMass = FVector3f(CenterOfMass);
+	header.GlobalForce = FVector3f(GlobalForce);
+	header.BigNoiseVector = FVector3f(BigNoiseVector);
+	header.BigNoiseChangeTimer = BigNoiseChangeTimer;
+
+	uint32 offset = Align(sizeof(FBubbleSnapshotHeader), 16);
+	header.PositionsOffset = offset;
+	offset = Align(offset + vertexCount * vectorSize, 16);
+	header.VelocitiesOffset = offset;
+	offset = Align(offset + vertexCount * vectorSize, 16);
+	header.ContactsOffset = offset;
+	offset = Align(offset + contacts.Num() * sizeof(FBubbleSnapshotContact), 16);
+	header.ActorPathsOffset = offset;
+	header.TotalSize = offset + actorPaths.Num();
+
+	OutData.SetNumZeroed(header.TotalSize);
+	uint8* data = OutData.GetData();
+	FMemory::Memcpy(data, &header, sizeof(header));
+
+	for (int32 i = 0; i < vertexCount; i++) {
+		FVector3f position = FVector3f((mesh.GetVertex(i) - CenterOfMass) / header.PositionScale);
+		FVector3f velocity = FVector3f(VertexVelocities[i]);
+		if (bHalfPrecision) {
+			FFloat16* positions = reinterpret_cast<FFloat16*>(data + header.PositionsOffset) + i * 3;
+			FFloat16* velocities = reinterpret_cast<FFloat16*>(data + header.VelocitiesOffset) + i * 3;
+			positions[0] = position.X; positions[1] = position.Y; positions[2] = position.Z;
+			velocities[0] = velocity.X; velocities[1] = velocity.Y; velocities[2] = velocity.Z;
+		}
+		else {
+			reinterpret_cast<FVector3f*>(data + header.PositionsOffset)[i] = position;
+			reinterpret_cast<FVector3f*>(data + header.VelocitiesOffset)[i] = velocity;
+		}
+	}
+
+	FBubbleSnapshotContact* packedContacts = reinterpret_cast<FBubbleSnapshotContact*>(data + header.ContactsOffset);
+	for (int32 i = 0; i < contacts.Num(); i++) {
+		packedContacts[i].FaceIndex = contacts[i].FaceIndex;
+		packedContacts[i].Barycentric = FVector3f(contacts[i].Barycentric);
+		packedContacts[i].Normal = FVector3f(contacts[i].Normal);
+		packedContacts[i].EngageDistance = contacts[i].EngageDistance;
+		packedContacts[i].VertexFactor = contacts[i].VertexFactor;
+		packedContacts[i].GlobalFactor = contacts[i].GlobalFactor;
+	}
+
+	FMemory::Memcpy(data + header.ActorPathsOffset, actorPaths.GetData(), actorPaths.Num());
+}
+
+bool ABubble::RestoreSnapshot(const TArray<uint8>& Data) {
+	LLM_SCOPE_BYTAG(BubbleMesh);
+
+	CompleteSimulation();
+
+	FBubbleSnapshotHeader header;
+	if (Data.Num() < sizeof(header))
+		return false;
+	FMemory::Memcpy(&header, Data.GetData(), sizeof(header));
+
+	const bool bHalfPrecision = EnumHasAnyFlags(EBubbleSnapshotFlags(header.Flags), EBubbleSnapshotFlags::HalfPrecision);
+	const uint64 vectorSize = bHalfPrecision ? sizeof(FFloat16) * 3 : sizeof(FVector3f);
+	if (header.Magic != FBubbleSnapshotHeader::MagicValue || header.Version != FBubbleSnapshotHeader::CurrentVersion
+		|| header.TotalSize != uint32(Data.Num())) {
+		UE_LOG(LogTemp, Warning, TEXT("Bubble snapshot for %s is not valid"), *GetName());
+		return false;
+	}
+
+	// everything below comes from the blob: the counts are checked against the level before any template is built, and
+	// the arrays against the data in 64 bits so large counts cannot wrap around
+	if (header.Subdivisions < 0 || header.Subdivisions > MaxRenderSubdivisions) {
+		UE_LOG(LogTemp, Warning, TEXT("Bubble snapshot for %s has unsupported subdivision level %d"), *GetName(), header.Subdivisions);
+		return false;
+	}
+	const int64 levelScale = int64(1) << (2 * header.Subdivisions);
+	const int64 vertexCount = 10 * levelScale + 2;
+	const int64 triangleCount = 20 * levelScale;
+	const uint64 totalSize = header.TotalSize;
+	if (header.VertexCount != vertexCount || header.ContactCount < 0
+		|| header.PositionsOffset > totalSize || vertexCount * vectorSize > totalSize - header.PositionsOffset
+		|| header.VelocitiesOffset > totalSize || vertexCount * vectorSize > totalSize - header.VelocitiesOffset
+		|| header.ContactsOffset > totalSize || uint64(header.ContactCount) * sizeof(FBubbleSnapshotContact) > totalSize - header.ContactsOffset
+		|| header.ActorPathsOffset < sizeof(header) || header.ActorPathsOffset > totalSize) {
+		UE_LOG(LogTemp, Warning, TEXT("Bubble snapshot for %s does not match its topology"), *GetName());
+		return false;
+	}
+	const FBubbleSnapshotContact* packedContacts = reinterpret_cast<const FBubbleSnapshotContact*>(Data.GetData() + header.ContactsOffset);
+	for (int32 i = 0; i < header.ContactCount; i++) {
+		if (packedContacts[i].FaceIndex < 0 || packedContacts[i].FaceIndex >= triangleCount) {
+			UE_LOG(LogTemp, Warning, TEXT("Bubble snapshot for %s has a contact on face %d"), *GetName(), packedContacts[i].FaceIndex);
+			return false;
+		}
+	}
+	// builds and caches the template, InitializeMesh below takes it from the cache
+	const FBubbleTopologyTemplate& topology = GetTopologyTemplate(header.Subdivisions);
+	if (topology.Mesh.MaxVertexID() != vertexCount || topology.Mesh.MaxTriangleID() != triangleCount) {
+		UE_LOG(LogTemp, Warning, TEXT("Bubble snapshot for %s does not match the level %d template"), *GetName(), header.Subdivisions);
+		return false;
+	}
+
+	BubbleMesh->SetMaterial(0, BubbleMaterial);
+
+	MeshSubdivisions = header.Subdivisions;
+	ColorSeed = header.ColorSeed != 0 ? header.ColorSeed : ColorSeed;
+	InitialRadius = header.InitialRadius;
+	Radius = header.Radius;
+	ActualRadius = header.ActualRadius;
+	AirPressureForce = header.AirPressureForce;
+	CenterOfMass = FVector(header.CenterOfMass);
+	GlobalForce = FVector(header.GlobalForce);
+	BigNoiseVector = FVector3d(header.BigNoiseVector);
+	BigNoiseChangeTimer = header.BigNoiseChangeTimer;
+
+	InitializeMesh();
+
+	const uint8* data = Data.GetData();
+	EditSurface(
+		[&](FDynamicMesh3& Mesh) {
+			for (int32 i = 0; i < header.VertexCount; i++) {
+				FVector3f position, velocity;
+				if (bHalfPrecision) {
+					const FFloat16* positions = reinterpret_cast<const FFloat16*>(data + header.PositionsOffset) + i * 3;
+					const FFloat16* velocities = reinterpret_cast<const FFloat16*>(data + header.VelocitiesOffset) + i * 3;
+					position = FVector3f(positions[0], positions[1], positions[2]);
+					velocity = FVector3f(velocities[0], velocities[1], velocities[2]);
+				}
+				else {
+					position = reinterpret_cast<const FVector3f*>(data + header.PositionsOffset)[i];
+					velocity = reinterpret_cast<const FVector3f*>(data + header.VelocitiesOffset)[i];
+				}
+				Mesh.SetVertex(i, CenterOfMass + FVector3d(position) * header.PositionScale);
+				VertexVelocities[i] = FVector3d(velocity);
+			}
+		}
+	);
+
+	Contacts.Reset();
+	PendingImpulses.Reset();
+	RewindHistory.Reset();
+	TArray<uint8> actorPaths(data + header.ActorPathsOffset, header.TotalSize - header.ActorPathsOffset);
+	FMemoryReader actorPathReader(actorPaths);
+	for (int32 i = 0; i < header.ContactCount && !actorPathReader.AtEnd(); i++) {
+		FString path;
+		actorPathReader << path;
+		if (actorPathReader.IsError())
+			break;
+		AActor* actor = Cast<AActor>(FSoftObjectPath(path).ResolveObject());
+		if (!IsValid(actor))
+			continue;
+
+		FBubbleContact& contact = Contacts.AddContact(actor);
+		contact.FaceIndex = packedContacts[i].FaceIndex;
+		contact.Barycentric = FVector3d(packedContacts[i].Barycentric);
+		contact.Normal = FVector3d(packedContacts[i].Normal);
+		contact.EngageDistance = packedContacts[i].EngageDistance;
+		contact.VertexFactor = packedContacts[i].VertexFactor;
+		contact.GlobalFactor = packedContacts[i].GlobalFactor;
+	}
+
+	SphericalIndex.Invalidate();
+
+	UpdateNormals();
+
+	if (bRandomizeColor && !bHeadless)
+		RandomizeColor();
+
+	return true;
+}
@@ -5,8 +5,64 @@
 #include "CoreMinimal.h"
 #include "GameFramework/Actor.h"
 #include "Components/DynamicMeshComponent.h"
+#include "BubbleCommandQueue.h"
+#include "BubbleContactManifold.h"
+#include "BubbleRewindHistory.h"
+#include "BubbleSphericalIndex.h"
+#include "Tasks/Task.h"
 #include "Bubble.generated.h"
 
+struct FBubbleSolveInputs;
+struct FTraceDatum;
+struct FTraceHandle;
+class USphereComponent;
+struct FBubbleRefinementWeights;
+
+// bytes held by one bubble, see bubble.MemReport
+struct FBubbleMemoryUsage
+{
+	SIZE_T Simulation = 0;
+	SIZE_T Mesh = 0;
+	SIZE_T Collision = 0;
+	SIZE_T Material = 0;
+
+	SIZE_T GetTotal() const { return Simulation + Mesh + Collision + Material; }
+
+	FBubbleMemoryUsage& operator+=(const FBubbleMemoryUsage& Other)
+	{
+		Simulation += Other.Simulation;
+		Mesh += Other.Mesh;
+		Collision += Other.Collision;
+		Material += Other.Material;
+		return *this;
+	}
+};
+
+// surface a vertex would run into during a solve, Normal is zero when there is none
+struct FBubbleCollisionPlane
+{
+	FVector3d Point = FVector3d::Zero();
+
+	FVector3d Normal = FVector3d::Zero();
+
+	// along the trace that found it, to keep the nearest of several traces
+	double Distance = UE_BIG_NUMBER;
+
+	bool IsBehind(const FVector3d& Location) const
+	{
+		return !Normal.IsZero() && FVector3d::DotProduct(Location - Point, Normal) <= 0;
+	}
+
+	void AddHit(const FHitResult& Hit, const FVector3d& TraceStart)
+	{
+		if (Hit.Distance >= Distance)
+			return;
+		Point = Hit.bStartPenetrating ? TraceStart : FVector3d(Hit.ImpactPoint);
+		Normal = FVector3d(Hit.ImpactNormal).GetSafeNormal();
+		Distance = Hit.Distance;
+	}
+};
+
 UCLASS()
 class BUBBLEGUN_API ABubble : public AActor
 {
@@ -25,14 +81,29 @@ public:
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Bubble")
 	int Subdivisions = 3;
 
+	// subdivision levels the rendered mesh adds on top of the simulated one, its vertices follow the simulated ones
+	// through fixed Loop subdivision weights; 0 renders the simulated mesh
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Bubble")
+	int RenderRefinement = 0;
+
 	// dynamic mesh
 	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Bubble")
 	UDynamicMeshComponent* BubbleMesh;
 
-	// material instance of the bubble
+	// material instance of the bubble, shared by all bubbles; its BaseColor parameter is the default tint, and M_Bubble reads
+	// the tint and stretch from CustomPrimitiveData 0-2 and 3
 	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Bubble")
 	UMaterialInstance* BubbleMaterial;
 
+	// sphere drawn for distant bubbles, scaled from its 50 unit radius
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Bubble")
+	UStaticMesh* FarFieldMesh;
+
+	// material of the shared far-field sphere, reads the tint from PerInstanceCustomData 0-2 and the stretch from 3; BubbleMaterial if unset
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Bubble")
+	UMaterialInterface* FarFieldMaterial;
+
+	// center of mass of the published surface, up to one solve behind while bubble.AsyncSolve is on
 	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Bubble")
 	FVector CenterOfMass;
 
@@ -81,11 +152,22 @@ public:
 
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Bubble")
 	bool bRandomizeColor = false;
+
+	// seed of the randomized color, kept in snapshots. Spawners assign it so the color matches on every machine; 0 derives it
+	// from the name of level-placed bubbles, whose names are the same everywhere, and picks a local one for spawned bubbles
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Bubble")
+	int32 ColorSeed = 0;
+
+	// seed of the noise forces, 0 derives it from the actor name; each bubble draws from its own stream, so its
+	// motion does not depend on how many other bubbles were stepped before it
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Bubble")
+	int32 SimulationSeed = 0;
 	
 	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Bubble")
 	double ActualRadius = 0;
 
-	TMap<AActor*, TTuple<int32, FVector, double>> CurrentPushes;
+	// actors currently touching the bubble, fed by OnHit and consumed once per simulation step
+	FBubbleContactManifold Contacts;
 
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Bubble")
 	USoundWave* PopSound;
@@ -93,13 +175,105 @@ public:
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Bubble")
 	double PopForceBase = 1000;
 
+	// the pop shockwave reaches as far as its impulse stays above this, and fades to zero there
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Bubble")
+	double PopImpulseEpsilon = 50;
+
+	// hard cap on the reach of the pop shockwave
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Bubble")
+	double PopMaxRadius = 5000;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Bubble")
+	bool bCanChainPop = true;
+
+	// impulse from another bubble's pop at this bubble's surface needed to pop it too
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Bubble")
+	double ChainPopImpulseThreshold = 1000;
+
+	// farthest this bubble's pop sets off other bubbles, in its radii from its center to their surface; the impulse of a
+	// large bubble passes the threshold far out in its shockwave, so this is what keeps a chain reaction local
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Bubble", meta = (ClampMin = "0"))
+	double ChainPopReach = 3;
+
 protected:
 	// Called when the game starts or when spawned
 	virtual void BeginPlay() override;
 
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+
 public:	
-	// Called every frame
-	virtual void Tick(float DeltaTime) override;
+	// advances the simulation by DeltaTime in substeps, called by UBubbleSimulationSubsystem
+	void StepSimulation(double DeltaTime, int32 MaxSubsteps);
+
+	// cheap stand-in for a step while nobody is looking: relaxes the surface toward a sphere without forces or traces
+	void CatchUpSimulation(double DeltaTime);
+
+	// publishes the solve in flight to the mesh component, waiting for it unless bWait is false and it is still running
+	void CompleteSimulation(bool bWait = true);
+
+	// a solve is running on a worker task, see bubble.AsyncSolve
+	bool IsSolvePending() const { return bSolvePending; }
+
+	// time the last published solve took, the worker time of a solve launched now is about the same
+	double GetLastSolveSeconds() const { return LastSolveSeconds; }
+
+	// thread safe: records an interaction, it is applied on the game thread before the next solve is launched
+	void QueueCommand(const FBubbleCommand& Command);
+
+	// applies the queued interactions; does nothing while a solve is in flight, since the solve reads what they change
+	void ProcessCommands();
+
+	// true on dedicated servers and without a renderer: the surface only lives in the solver buffers, without
+	// normals, colors or a component mesh, and a sphere around it stands in for collision
+	bool IsHeadless() const { return bHeadless; }
+
+	// center of mass of the newest simulated surface, finishes the solve in flight first
+	UFUNCTION(BlueprintCallable, Category = "Bubble")
+	FVector GetCenterOfMass();
+
+	// world time of the last hit, used to keep recently touched bubbles at full rate
+	double GetLastInteractionTime() const { return LastInteractionTime; }
+
+	// hides the dynamic mesh while UBubbleFarFieldSubsystem draws the bubble as an instance, collision stays
+	void SetFarField(bool bInFarField);
+
+	bool IsFarField() const { return bFarField; }
+
+	// radii of the ellipsoid approximating the surface along the actor axes, for the far-field instance
+	FVector3d GetFarFieldExtents() const;
+
+	FLinearColor GetTint() const { return Tint; }
+
+	// subdivision level of the simulated mesh, Subdivisions or the adaptive level, capped by the bubble quality level
+	int32 GetMeshSubdivisions() const { return MeshSubdivisions; }
+
+	// caps the subdivision level at MaxSubdivisions; without adaptive remeshing the level is min(Subdivisions, MaxSubdivisions)
+	void SetSubdivisionCap(int32 MaxSubdivisions);
+
+	// level whose world-space edge length fits bubble.RemeshEdgeLength, scaled up with the view distance so the cost
+	// follows the on-screen size; the current level while bubble.Remesh is off or the bubble is headless
+	int32 GetAdaptiveSubdivisions(double ViewDistance) const;
+
+	// rebuilds the mesh at the level, up to the cap, resampling the current shape and interpolating the velocities
+	void Remesh(int32 Level);
+
+	// bit exact hash of the simulated state, for replays; the solve in flight must be complete
+	uint32 GetStateHash() const;
+
+	// restarts the noise stream on a seed drawn from it and returns the seed, for the start of a recording
+	int32 ReseedSimulation();
+
+	// driven by UBubbleReplaySubsystem instead of the simulation subsystem, hits are ignored; set before BeginPlay
+	void SetReplayDriven() { bReplayDriven = true; }
+
+	bool IsReplayDriven() const { return bReplayDriven; }
+
+	// a recorded solve with the recorded contacts of each substep, completed before returning; false without stepping if
+	// the contacts are not one list per substep or name faces the mesh does not have
+	bool ReplayStep(double StepTime, int32 Substeps, double RelaxTime, const TArray<TArray<FBubbleSolverContact>>& StepContacts);
+
+	// estimated memory held by the bubble, the mesh part is computed from element counts
+	FBubbleMemoryUsage GetMemoryUsage() const;
 
 	UFUNCTION(BlueprintCallable, Category = "Bubble")
 	void Generate();
@@ -120,9 +294,18 @@ public:
 	UFUNCTION()
 	void OnOverlapEnd(UPrimitiveComponent* OverlappedComp, AActor* OtherActor, UPrimitiveComponent* OtherComp, int32 OtherBodyIndex);
 
+	// queued, the radius changes before the next solve
 	UFUNCTION(BlueprintCallable, Category = "Bubble")
 	void GrowBubble(double Amount);
 
+	// queued velocity change of the vertices of a face, or of the whole bubble for INDEX_NONE
+	UFUNCTION(BlueprintCallable, Category = "Bubble")
+	void AddImpulse(const FVector& VelocityChange, int32 FaceIndex = -1);
+
+	// queued, the bubble is handed to the pop subsystem; safe from any thread unlike Pop
+	UFUNCTION(BlueprintCallable, Category = "Bubble")
+	void RequestPop();
+
 	UFUNCTION(BlueprintNativeEvent, BlueprintPure, Category = "Bubble")
 	float HitSingleVertexFactor(AActor* HitActor);
 
@@ -133,6 +316,202 @@ public:
 
 	float HitGlobalFactor_Implementation(AActor* HitActor) { return 1.0; }
 
+	// pops right away, game thread only
 	UFUNCTION(BlueprintCallable, Category = "Bubble")
 	void Pop();
+
+	// true once the bubble has popped or is queued to pop in a chain reaction
+	bool IsPopping() const { return bPopPending || bPopped; }
+
+	void MarkPopPending() { bPopPending = true; }
+
+	// triangle of the bubble surface in the given world-space direction from the center of mass
+	UFUNCTION(BlueprintCallable, Category = "Bubble")
+	int32 FindFaceInDirection(const FVector& Direction);
+
+	// triangle of the bubble surface under a world-space point, as seen from the center of mass
+	UFUNCTION(BlueprintCallable, Category = "Bubble")
+	int32 FindFaceAtPoint(const FVector& WorldPoint);
+
+	// intersects a world-space segment with the bubble surface without going through the physics scene
+	UFUNCTION(BlueprintCallable, Category = "Bubble")
+	bool RaycastBubble(const FVector& Start, const FVector& End, FVector& OutHitLocation, int32& OutFaceIndex);
+
+	// lag compensation on the server: the segment against the surface as it was at a past server time, interpolated
+	// from the rewind history without touching the live mesh; the live surface while nothing is recorded
+	UFUNCTION(BlueprintCallable, Category = "Bubble")
+	bool RaycastRewound(double ServerTime, const FVector& Start, const FVector& End, FVector& OutHitLocation);
+
+	// how far a sphere has to move down to rest on the published surface, for character floors; the surface is taken
+	// as a sphere around the center of mass through the point below, so the normal is radial and doesn't jitter with
+	// the triangles. Never waits for the solve in flight.
+	bool ComputeFloor(const FVector& SphereCenter, double SphereRadius, double& OutDistance, FVector& OutImpactPoint, FVector& OutNormal);
+
+	// velocity of the center of mass over the last published solve, the bubble moves by its vertices and not its transform
+	FVector GetCenterOfMassVelocity() const { return CenterOfMassVelocity; }
+
+	// lag compensation on the server: whether a sphere touched the surface at a past server time
+	UFUNCTION(BlueprintCallable, Category = "Bubble")
+	bool OverlapsRewound(double ServerTime, const FVector& SphereCenter, double SphereRadius) const;
+
+	// writes the simulation state as one contiguous binary block, see BubbleSnapshot.h for the layout
+	UFUNCTION(BlueprintCallable, Category = "Bubble")
+	void WriteSnapshot(TArray<uint8>& OutData, bool bHalfPrecision = true);
+
+	// replaces the simulation state with a snapshot, returns false if the data is not a valid snapshot
+	UFUNCTION(BlueprintCallable, Category = "Bubble")
+	bool RestoreSnapshot(const TArray<uint8>& Data);
+
+	// snapshot restored in BeginPlay instead of calling Generate, for deferred spawns
+	void SetPendingSnapshot(TArray<uint8>&& Data) { PendingSnapshot = MoveTemp(Data); }
+
+private:
+	// gathers the solve inputs on the game thread, then solves on a worker task or inline; ReplayContacts replace
+	// the contacts and impulses of the bubble
+	void RunSolve(double StepTime, int32 Substeps, double RelaxTime, const TArray<TArray<FBubbleSolverContact>>* ReplayContacts = nullptr);
+
+	// substeps, relaxation and normals on SolveMesh, touches nothing the game thread reads
+	void Solve(FBubbleSolveInputs& Inputs);
+
+	void SimulateStep(double DeltaTime, const TArray<FBubbleSolverContact>& SolverContacts, FBubbleSolveInputs& Inputs);
+
+	// collision planes ahead of every vertex for the solve, workers must not query the world: the planes of the last
+	// round of async traces, and a new round for the next solve; bDeterministic traces synchronously for replays
+	void GatherCollisionPlanes(FBubbleSolveInputs& Inputs, bool bDeterministic);
+
+	void OnCollisionTrace(const FTraceHandle& Handle, FTraceDatum& Datum, uint32 Round);
+
+	// drops the planes and the round in flight
+	void ResetCollisionTraces();
+
+	// planes of the last finished round of traces, for the next solve
+	TArray<FBubbleCollisionPlane> CollisionPlanes;
+
+	// planes of the round in flight, filled as its traces come back
+	TArray<FBubbleCollisionPlane> TracedCollisionPlanes;
+
+	int32 CollisionTracesInFlight = 0;
+
+	// bumped when the round in flight is dropped, its results are ignored
+	uint32 CollisionTraceRound = 0;
+
+	void RelaxSurface(double DeltaTime, const FBubbleSolveInputs& Inputs);
+
+	// copies positions, normals and colors of SolveMesh to the mesh component
+	void PublishSolve();
+
+	// back buffer of the simulation, owned by SolveTask while it runs; the component mesh is the front buffer
+	UE::Geometry::FDynamicMesh3 SolveMesh;
+
+	// with a refined rendered mesh: holds the front buffer of the simulated surface, which BubbleMesh no longer does, and
+	// the collision cooked from it, 4^RenderRefinement times fewer triangles than the rendered mesh; hidden
+	UPROPERTY()
+	UDynamicMeshComponent* CollisionMesh = nullptr;
+
+	// moves the collision to a hidden component holding the coarse surface, or back to BubbleMesh for nullptr
+	void SetCollisionMesh(UDynamicMesh* SurfaceMesh);
+
+	// with a refined rendered mesh: its back buffer, rebuilt from SolveMesh at the end of each solve
+	UE::Geometry::FDynamicMesh3 SolveRenderMesh;
+
+	// weights of the rendered vertices over the simulated ones, null while the simulated mesh is rendered directly
+	const FBubbleRefinementWeights* Refinement = nullptr;
+
+	double RenderAverageVertexArea = 0.0;
+
+	FVector3d SolveCenterOfMass = FVector3d::Zero();
+
+	double SolveActualRadius = 0.0;
+
+	// simulated time of the solve in flight, for CenterOfMassVelocity
+	double SolveDuration = 0.0;
+
+	FVector3d CenterOfMassVelocity = FVector3d::Zero();
+
+	// ratio of the longest to the shortest axis of the solved surface, for the material
+	float SolveStretch = 1.0f;
+
+	// back buffers of GlobalForce, BigNoiseVector and BigNoiseChangeTimer, which Blueprints see; taken from them at launch
+	// and copied back on publish
+	FVector3d SolveGlobalForce = FVector3d::Zero();
+
+	FVector3d SolveBigNoiseVector = FVector3d::Zero();
+
+	double SolveBigNoiseChangeTimer = 0.0;
+
+	// compact shape of the solved surface, recorded into RewindHistory on publish if bSolveRewindValid
+	FBubbleRewindState SolveRewindState;
+
+	bool bSolveRewindValid = false;
+
+	// recent compact shapes on servers, see bubble.RewindHistoryMs
+	FBubbleRewindHistory RewindHistory;
+
+	// the surface was replaced or edited outside a solve, SolveMesh is copied from it before the next one (only the
+	// center and radius when headless, where SolveMesh is the surface)
+	bool bSolveMeshStale = true;
+
+	// a solve was launched and its result is not published yet
+	bool bSolvePending = false;
+
+	// time the solve took, on the worker or inline, and its copy for the game thread once published
+	double SolveSeconds = 0.0;
+
+	double LastSolveSeconds = 0.0;
+
+	// interactions from gameplay, physics callbacks and other threads, see ProcessCommands
+	FBubbleCommandQueue Commands;
+
+	// impulses drained from the queue, added to the contacts of the first substep of the next solve
+	TArray<FBubbleSolverContact> PendingImpulses;
+
+	UE::Tasks::FTask SolveTask;
+
+	bool bHeadless = false;
+
+	// collision of headless bubbles, following the center of mass and the actual radius
+	UPROPERTY()
+	USphereComponent* CollisionProxy = nullptr;
+
+	// the published simulated surface: the component mesh, CollisionMesh's when the rendered mesh is refined, or SolveMesh when headless
+	const UE::Geometry::FDynamicMesh3& GetSurface() const;
+
+	// edits the published surface outside a solve
+	void EditSurface(TFunctionRef<void(UE::Geometry::FDynamicMesh3&)> Edit);
+
+	void UpdateCollisionProxy();
+
+	double LastInteractionTime = -UE_BIG_NUMBER;
+
+	bool bFarField = false;
+
+	// base color of the material, or the randomized one
+	FLinearColor Tint = FLinearColor::White;
+
+	// writes the tint to the material and the custom primitive data of the mesh
+	void ApplyTint();
+
+	// builds the mesh from the shared topology template of MeshSubdivisions, scaled to InitialRadius
+	void InitializeMesh();
+
+	int32 MeshSubdivisions = 0;
+
+	// quality cap of the subdivision level, see SetSubdivisionCap
+	int32 SubdivisionCap = 6;
+
+	TArray<uint8> PendingSnapshot;
+
+	bool bPopPending = false;
+
+	bool bReplayDriven = false;
+
+	// seeds the solve of each step, see SimulationSeed
+	FRandomStream SimulationRandom;
+
+	bool bPopped = false;
+
+	// direction -> triangle lookup around the center of mass, rebuilt lazily after a remesh or once the surface drifts away from it
+	FBubbleSphericalIndex SphericalIndex;
+
+	const FBubbleSphericalIndex& GetSphericalIndex();
 };
@@ -0,0 +1,218 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "BubbleBenchmark.h"
+
+#include "Bubble.h"
+#include "BubblegunProjectile.h"
+#include "Engine/World.h"
+#include "Misc/App.h"
+#include "Misc/FileHelper.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
+
+namespace
+{
+	constexpr uint32 InputRecordingMagic = 0x49524242; // "BBRI"
+
+	constexpr int32 InputRecordingVersion = 1;
+
+	/** Nearest rank percentile of sorted values */
+	float GetPercentile(const TArray<float>& Sorted, float Percentile)
+	{
+		if (Sorted.IsEmpty())
+		{
+			return 0.0f;
+		}
+		const int32 Rank = FMath::CeilToInt(Percentile * Sorted.Num()) - 1;
+		return Sorted[FMath::Clamp(Rank, 0, Sorted.Num() - 1)];
+	}
+}
+
+void FBubbleInputRecording::Reset()
+{
+	MapName.Reset();
+	RandomSeed = 0;
+	Actions.Reset();
+	FrameStarts.Reset();
+	Inputs.Reset();
+}
+
+bool FBubbleInputRecording::Save(const FString& Path)
+{
+	TArray<uint8> Data;
+	FMemoryWriter Writer(Data);
+
+	uint32 Magic = InputRecordingMagic;
+	int32 Version = InputRecordingVersion;
+	Writer << Magic << Version;
+	Writer << MapName << RandomSeed << Actions << FrameStarts << Inputs;
+
+	if (!FFileHelper::SaveArrayToFile(Data, *Path))
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Could not write input recording %s"), *Path);
+		return false;
+	}
+
+	UE_LOG(LogTemp, Log, TEXT("Input recording %s: %d frames of %s, %d inputs"), *Path, GetNumFrames(), *MapName, Inputs.Num());
+	return true;
+}
+
+bool FBubbleInputRecording::Load(const FString& Path)
+{
+	Reset();
+
+	TArray<uint8> Data;
+	if (!FFileHelper::LoadFileToArray(Data, *Path))
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Could not read input recording %s"), *Path);
+		return false;
+	}
+
+	FMemoryReader Reader(Data);
+	uint32 Magic = 0;
+	int32 Version = 0;
+	Reader << Magic << Version;
+	if (Magic != InputRecordingMagic || Version != InputRecordingVersion)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Input recording %s has version %d, expected %d"), *Path, Version, InputRecordingVersion);
+		return false;
+	}
+
+	Reader << MapName << RandomSeed << Actions << FrameStarts << Inputs;
+	if (Reader.IsError() || (FrameStarts.Num() > 0 && FrameStarts.Last() != Inputs.Num()))
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Input recording %s is corrupted"), *Path);
+		Reset();
+		return false;
+	}
+	return true;
+}
+
+void FBubbleInputRecording::ApplyDeterminism() const
+{
+	FApp::SetUseFixedTimeStep(true);
+	FApp::SetFixedDeltaTime(FixedDeltaTime);
+	FMath::RandInit(RandomSeed);
+	FMath::SRandInit(RandomSeed);
+}
+
+FBubbleBenchmarkStats::FBubbleBenchmarkStats(UWorld* InWorld)
+	: World(InWorld)
+{
+	TickStartHandle = FWorldDelegates::OnWorldTickStart.AddRaw(this, &FBubbleBenchmarkStats::OnWorldTickStart);
+	PostActorTickHandle = FWorldDelegates::OnWorldPostActorTick.AddRaw(this, &FBubbleBenchmarkStats::OnWorldPostActorTick);
+	ActorSpawnedHandle = InWorld->AddOnActorSpawnedHandler(FOnActorSpawned::FDelegate::CreateRaw(this, &FBubbleBenchmarkStats::OnActorSpawned));
+
+	PhysicsStartTick.Stats = this;
+	PhysicsStartTick.bCanEverTick = true;
+	PhysicsStartTick.TickGroup = TG_StartPhysics;
+	PhysicsStartTick.RegisterTickFunction(InWorld->PersistentLevel);
+
+	// The end of the physics tick group waits for the physics step, so this runs once it is done
+	PhysicsEndTick.Stats = this;
+	PhysicsEndTick.bEnd = true;
+	PhysicsEndTick.bCanEverTick = true;
+	PhysicsEndTick.TickGroup = TG_EndPhysics;
+	PhysicsEndTick.AddPrerequisite(InWorld, InWorld->EndPhysicsTickFunction);
+	PhysicsEndTick.RegisterTickFunction(InWorld->PersistentLevel);
+
+	LastFrameEnd = FPlatformTime::Seconds();
+}
+
+FBubbleBenchmarkStats::~FBubbleBenchmarkStats()
+{
+	FWorldDelegates::OnWorldTickStart.Remove(TickStartHandle);
+	FWorldDelegates::OnWorldPostActorTick.Remove(PostActorTickHandle);
+	if (UWorld* CurrentWorld = World.Get())
+	{
+		CurrentWorld->RemoveOnActorSpawnedHandler(ActorSpawnedHandle);
+	}
+	PhysicsStartTick.UnRegisterTickFunction();
+	PhysicsEndTick.UnRegisterTickFunction();
+}
+
+void FBubbleBenchmarkStats::EndFrame()
+{
+	const double Now = FPlatformTime::Seconds();
+	FrameTimes.Add(float((Now - LastFrameEnd) * 1000.0));
+	LastFrameEnd = Now;
+}
+
+void FBubbleBenchmarkStats::Report(const FString& CsvPath) const
+{
+	FString Csv = TEXT("Metric,Frames,P50,P95,P99,Max\n");
+
+	auto ReportTimes = [&Csv](const TCHAR* Name, TArray<float> Times)
+	{
+		Times.Sort();
+		const float P50 = GetPercentile(Times, 0.5f);
+		const float P95 = GetPercentile(Times, 0.95f);
+		const float P99 = GetPercentile(Times, 0.99f);
+		const float Max = Times.IsEmpty() ? 0.0f : Times.Last();
+		UE_LOG(LogTemp, Log, TEXT("Bubble benchmark %s: p50 %.2f ms, p95 %.2f ms, p99 %.2f ms, max %.2f ms over %d frames"), Name, P50, P95, P99, Max, Times.Num());
+		Csv += FString::Printf(TEXT("%s,%d,%.3f,%.3f,%.3f,%.3f\n"), Name, Times.Num(), P50, P95, P99, Max);
+	};
+	ReportTimes(TEXT("FrameTime"), FrameTimes);
+	ReportTimes(TEXT("GameThread"), GameThreadTimes);
+	ReportTimes(TEXT("Physics"), PhysicsTimes);
+
+	TArray<TPair<FName, int32>> Spawns = SpawnCounts.Array();
+	Spawns.Sort([](const TPair<FName, int32>& A, const TPair<FName, int32>& B) { return A.Value > B.Value; });
+	Csv += TEXT("Spawned,Count\n");
+	for (const TPair<FName, int32>& Spawn : Spawns)
+	{
+		UE_LOG(LogTemp, Log, TEXT("Bubble benchmark spawned %d %s"), Spawn.Value, *Spawn.Key.ToString());
+		Csv += FString::Printf(TEXT("%s,%d\n"), *Spawn.Key.ToString(), Spawn.Value);
+	}
+
+	if (!FFileHelper::SaveStringToFile(Csv, *CsvPath))
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Could not write benchmark report %s"), *CsvPath);
+	}
+}
+
+void FBubbleBenchmarkStats::FPhysicsTickFunction::ExecuteTick(float DeltaTime, ELevelTick TickType, ENamedThreads::Type CurrentThread, const FGraphEventRef& MyCompletionGraphEvent)
+{
+	if (!bEnd)
+	{
+		Stats->PhysicsStart = FPlatformTime::Seconds();
+	}
+	else if (Stats->PhysicsStart > 0.0)
+	{
+		Stats->PhysicsTimes.Add(float((FPlatformTime::Seconds() - Stats->PhysicsStart) * 1000.0));
+		Stats->PhysicsStart = 0.0;
+	}
+}
+
+void FBubbleBenchmarkStats::OnWorldTickStart(UWorld* TickedWorld, ELevelTick TickType, float DeltaTime)
+{
+	if (TickedWorld == World.Get())
+	{
+		TickStart = FPlatformTime::Seconds();
+	}
+}
+
+void FBubbleBenchmarkStats::OnWorldPostActorTick(UWorld* TickedWorld, ELevelTick TickType, float DeltaTime)
+{
+	if (TickedWorld == World.Get() && TickStart > 0.0)
+	{
+		GameThreadTimes.Add(float((FPlatformTime::Seconds() - TickStart) * 1000.0));
+		TickStart = 0.0;
+	}
+}
+
+void FBubbleBenchmarkStats::OnActorSpawned(AActor* Actor)
+{
+	// Bubbles and projectiles are counted together over their blueprint subclasses
+	FName Name = Actor->GetClass()->GetFName();
+	if (Actor->IsA<ABubble>())
+	{
+		Name = TEXT("Bubble");
+	}
+	else if (Actor->IsA<ABubblegunProjectile>())
+	{
+		Name = TEXT("Projectile");
+	}
+	++SpawnCounts.FindOrAdd(Name);
+}
@@ -0,0 +1,118 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Engine/EngineBaseTypes.h"
+
+class AActor;
+class UWorld;
+
+/** Value of one input action in one frame, actions without input are not stored */
+struct FBubbleRecordedInput
+{
+	uint16 ActionIndex = 0;
+
+	FVector3f Value = FVector3f::ZeroVector;
+
+	friend FArchive& operator<<(FArchive& Ar, FBubbleRecordedInput& Input)
+	{
+		return Ar << Input.ActionIndex << Input.Value;
+	}
+};
+
+/**
+ * Enhanced Input action values of a local player, frame by frame from the start of a map. Frames
+ * are a fixed time step both while recording and while replaying, and the global random streams
+ * are seeded the same, so a replay sends the game the same inputs at the same simulated times.
+ */
+struct FBubbleInputRecording
+{
+	static constexpr float FixedDeltaTime = 1.0f / 60.0f;
+
+	FString MapName;
+
+	int32 RandomSeed = 0;
+
+	/** Input actions by index, as asset paths */
+	TArray<FSoftObjectPath> Actions;
+
+	/** Inputs of frame i are Inputs[FrameStarts[i] .. FrameStarts[i + 1]) */
+	TArray<int32> FrameStarts;
+
+	TArray<FBubbleRecordedInput> Inputs;
+
+	int32 GetNumFrames() const { return FMath::Max(FrameStarts.Num() - 1, 0); }
+
+	void Reset();
+
+	bool Save(const FString& Path);
+
+	bool Load(const FString& Path);
+
+	/** Makes the engine step at FixedDeltaTime and seeds FMath's random streams with RandomSeed */
+	void ApplyDeterminism() const;
+};
+
+/**
+ * Frame time, game thread and physics timings and actor spawns of a world over a benchmark run.
+ * Game thread time is the world tick from its start to the end of the actor ticks; physics time
+ * is from the start of the physics tick group to the completion of the physics step.
+ */
+class FBubbleBenchmarkStats
+{
+public:
+	explicit FBubbleBenchmarkStats(UWorld* InWorld);
+
+	~FBubbleBenchmarkStats();
+
+	/** Called once per frame, after the world tick */
+	void EndFrame();
+
+	/** Logs the percentiles and spawn counts and writes them to a CSV file */
+	void Report(const FString& CsvPath) const;
+
+private:
+	struct FPhysicsTickFunction : public FTickFunction
+	{
+		FBubbleBenchmarkStats* Stats = nullptr;
+
+		bool bEnd = false;
+
+		virtual void ExecuteTick(float DeltaTime, ELevelTick TickType, ENamedThreads::Type CurrentThread, const FGraphEventRef& MyCompletionGraphEvent) override;
+		virtual FString DiagnosticMessage() override { return TEXT("FBubbleBenchmarkStats::FPhysicsTickFunction"); }
+	};
+
+	void OnWorldTickStart(UWorld* TickedWorld, ELevelTick TickType, float DeltaTime);
+
+	void OnWorldPostActorTick(UWorld* TickedWorld, ELevelTick TickType, float DeltaTime);
+
+	void OnActorSpawned(AActor* Actor);
+
+	TWeakObjectPtr<UWorld> World;
+
+	FDelegateHandle TickStartHandle;
+
+	FDelegateHandle PostActorTickHandle;
+
+	FDelegateHandle ActorSpawnedHandle;
+
+	FPhysicsTickFunction PhysicsStartTick;
+
+	FPhysicsTickFunction PhysicsEndTick;
+
+	double LastFrameEnd = 0.0;
+
+	double TickStart = 0.0;
+
+	double PhysicsStart = 0.0;
+
+	/** Milliseconds per frame */
+	TArray<float> FrameTimes;
+
+	TArray<float> GameThreadTimes;
+
+	TArray<float> PhysicsTimes;
+
+	TMap<FName, int32> SpawnCounts;
+};
@@ -2,8 +2,18 @@
 
 
 #include "BubbleCharacterMovementComponent.h"
+#include "Bubble.h"
+#include "BubblegunCharacter.h"
+#include "BubbleForceFieldSubsystem.h"
+#include "Components/CapsuleComponent.h"
 #include "Curves/CurveFloat.h"
 
+static TAutoConsoleVariable<bool> CVarBubbleCharacterFloor(
+	TEXT("bubble.CharacterFloor"),
+	true,
+	TEXT("Compute character floors on bubbles from the bubble surface instead of sweeping its collision mesh."),
+	ECVF_Default);
+
 float UBubbleCharacterMovementComponent::GetGravityZ() const
 {
 	if (GravityCurve)
@@ -22,11 +32,337 @@ bool UBubbleCharacterMovementComponent::DoJump(bool bReplayingMoves, float Delta
 	return Super::DoJump(bReplayingMoves, DeltaTime);
 }
 
-void UBubbleCharacterMovementComponent::TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction)
+void UBubbleCharacterMovementComponent::Dash()
+{
+	if (CanDash())
+	{
+		bWantsToDash = true;
+	}
+}
+
+void UBubbleCharacterMovementComponent::UpdateCharacterStateBeforeMovement(float DeltaSeconds)
 {
+	Super::UpdateCharacterStateBeforeMovement(DeltaSeconds);
+
 	GravityTimer = IsFalling()
-		? GravityTimer + DeltaTime
+		? GravityTimer + DeltaSeconds
 		: 0.f;
 
-	Super::TickComponent(DeltaTime, TickType, ThisTickFunction);
+	if (bWantsToDash && CanDash())
+	{
+		StartDash();
+	}
+	bWantsToDash = false;
+
+	UpdateDash(DeltaSeconds);
+
+	ApplyForceFields(DeltaSeconds);
+}
+
+void UBubbleCharacterMovementComponent::ApplyForceFields(float DeltaSeconds)
+{
+	const UBubbleForceFieldSubsystem* ForceFields = GetWorld()->GetSubsystem<UBubbleForceFieldSubsystem>();
+	if (!ForceFields || !ForceFields->HasFields() || !UpdatedComponent)
+	{
+		return;
+	}
+
+	// fields only depend on the location, so replayed moves see the same acceleration as the server
+	FVector Acceleration = ForceFields->GetCharacterAcceleration(UpdatedComponent->GetComponentLocation());
+	if (Acceleration.IsNearlyZero())
+	{
+		return;
+	}
+
+	Velocity += Acceleration * DeltaSeconds;
+	if (IsMovingOnGround() && Acceleration.Z > -GetGravityZ())
+	{
+		SetMovementMode(MOVE_Falling);
+	}
+}
+
+ABubble* UBubbleCharacterMovementComponent::GetBubbleFloor(const FHitResult* DownwardSweepResult, UPrimitiveComponent*& OutComponent) const
+{
+	OutComponent = nullptr;
+	if (!CVarBubbleCharacterFloor.GetValueOnGameThread())
+	{
+		return nullptr;
+	}
+
+	if (DownwardSweepResult && DownwardSweepResult->IsValidBlockingHit())
+	{
+		if (ABubble* Bubble = Cast<ABubble>(DownwardSweepResult->GetActor()))
+		{
+			OutComponent = DownwardSweepResult->GetComponent();
+			return Bubble;
+		}
+	}
+
+	UPrimitiveComponent* Base = GetMovementBase();
+	if (ABubble* Bubble = Base ? Cast<ABubble>(Base->GetOwner()) : nullptr)
+	{
+		OutComponent = Base;
+		return Bubble;
+	}
+	return nullptr;
+}
+
+void UBubbleCharacterMovementComponent::ComputeFloorDist(const FVector& CapsuleLocation, float LineDistance, float SweepDistance, FFindFloorResult& OutFloorResult, float SweepRadius, const FHitResult* DownwardSweepResult) const
+{
+	if (ComputeBubbleFloorDist(CapsuleLocation, SweepDistance, OutFloorResult, SweepRadius, DownwardSweepResult))
+	{
+		return;
+	}
+
+	Super::ComputeFloorDist(CapsuleLocation, LineDistance, SweepDistance, OutFloorResult, SweepRadius, DownwardSweepResult);
+}
+
+bool UBubbleCharacterMovementComponent::ComputeBubbleFloorDist(const FVector& CapsuleLocation, float SweepDistance, FFindFloorResult& OutFloorResult, float SweepRadius, const FHitResult* DownwardSweepResult) const
+{
+	UPrimitiveComponent* Component = nullptr;
+	ABubble* Bubble = GetBubbleFloor(DownwardSweepResult, Component);
+	if (!Bubble || !CharacterOwner)
+	{
+		return false;
+	}
+
+	// the bottom hemisphere of the capsule, with the radius the sweeps would use
+	const float HalfHeight = CharacterOwner->GetCapsuleComponent()->GetScaledCapsuleHalfHeight();
+	const FVector SphereCenter = CapsuleLocation - FVector(0.f, 0.f, HalfHeight - SweepRadius);
+
+	double Distance = 0.0;
+	FVector ImpactPoint;
+	FVector Normal;
+	if (!Bubble->ComputeFloor(SphereCenter, SweepRadius, Distance, ImpactPoint, Normal))
+	{
+		return false;
+	}
+
+	// the same clamp the sweep applies to penetrations
+	const float MaxPenetrationAdjust = FMath::Max(MAX_FLOOR_DIST, SweepRadius);
+	const float FloorDist = FMath::Max(-MaxPenetrationAdjust, float(Distance));
+
+	FHitResult Hit(1.f);
+	Hit.bBlockingHit = true;
+	Hit.TraceStart = CapsuleLocation;
+	Hit.TraceEnd = CapsuleLocation - FVector(0.f, 0.f, SweepDistance);
+	Hit.Time = SweepDistance > 0.f ? FMath::Clamp(FloorDist / SweepDistance, 0.f, 1.f) : 0.f;
+	Hit.Distance = FloorDist;
+	Hit.Location = CapsuleLocation - FVector(0.f, 0.f, FloorDist);
+	Hit.ImpactPoint = ImpactPoint;
+	Hit.Normal = Normal;
+	Hit.ImpactNormal = Normal;
+	Hit.HitObjectHandle = FActorInstanceHandle(Bubble);
+	Hit.Component = Component;
+
+	// anything else, like the ground next to the bubble, is left to the sweeps
+	if (FloorDist > SweepDistance || !IsWalkable(Hit))
+	{
+		return false;
+	}
+
+	OutFloorResult.SetFromSweep(Hit, FloorDist, true);
+	return true;
+}
+
+FVector UBubbleCharacterMovementComponent::GetImpartedMovementBaseVelocity() const
+{
+	UPrimitiveComponent* Component = nullptr;
+	const ABubble* Bubble = GetBubbleFloor(nullptr, Component);
+	if (!Bubble)
+	{
+		return Super::GetImpartedMovementBaseVelocity();
+	}
+
+	// jumping off a drifting bubble keeps its motion, like leaving any other moving base
+	FVector BaseVelocity = Bubble->GetCenterOfMassVelocity();
+	if (!bImpartBaseVelocityX)
+	{
+		BaseVelocity.X = 0.f;
+	}
+	if (!bImpartBaseVelocityY)
+	{
+		BaseVelocity.Y = 0.f;
+	}
+	if (!bImpartBaseVelocityZ)
+	{
+		BaseVelocity.Z = 0.f;
+	}
+	return BaseVelocity;
+}
+
+void UBubbleCharacterMovementComponent::UpdateFromCompressedFlags(uint8 Flags)
+{
+	Super::UpdateFromCompressedFlags(Flags);
+
+	bWantsToDash = (Flags & FSavedMove_Character::FLAG_Custom_0) != 0;
+}
+
+FNetworkPredictionData_Client* UBubbleCharacterMovementComponent::GetPredictionData_Client() const
+{
+	if (ClientPredictionData == nullptr)
+	{
+		UBubbleCharacterMovementComponent* MutableThis = const_cast<UBubbleCharacterMovementComponent*>(this);
+		MutableThis->ClientPredictionData = new FNetworkPredictionData_Client_Bubble(*this);
+	}
+
+	return ClientPredictionData;
+}
+
+ABubblegunCharacter* UBubbleCharacterMovementComponent::GetBubblegunCharacterOwner() const
+{
+	return Cast<ABubblegunCharacter>(CharacterOwner);
+}
+
+void UBubbleCharacterMovementComponent::StartDash()
+{
+	ABubblegunCharacter* Character = GetBubblegunCharacterOwner();
+	if (!Character)
+	{
+		return;
+	}
+
+	DashCooldownTimer = Character->GetDashCooldown();
+	DashTimer = Character->GetDashDuration();
+	PreDashJumpCount = Character->JumpCurrentCount;
+
+	// Acceleration is part of every saved move, so the dash direction replays identically
+	FVector MoveDir = Acceleration.GetSafeNormal();
+	if (MoveDir.IsNearlyZero())
+	{
+		MoveDir = UpdatedComponent->GetForwardVector();
+	}
+
+	SetMovementMode(EMovementMode::MOVE_Flying);
+	Velocity = MoveDir * Character->GetDashInitialSpeed();
+}
+
+void UBubbleCharacterMovementComponent::UpdateDash(float DeltaSeconds)
+{
+	ABubblegunCharacter* Character = GetBubblegunCharacterOwner();
+	if (!Character)
+	{
+		return;
+	}
+
+	if (DashTimer >= 0.f)
+	{
+		FVector Dir = Velocity.GetSafeNormal();
+		float StoppingSpeed = MaxWalkSpeed;
+		float T = 1.f - DashTimer / Character->GetDashDuration();
+		Velocity = Dir * FMath::Lerp(Character->GetDashInitialSpeed(), StoppingSpeed, T * T * T);
+
+		// Just finished dashing
+		if (DashTimer < DeltaSeconds)
+		{
+			SetMovementMode(EMovementMode::MOVE_Falling);
+			Velocity = Velocity.GetClampedToSize(0.f, MaxWalkSpeed);
+			Character->JumpCurrentCount = PreDashJumpCount;
+		}
+
+		DashTimer -= DeltaSeconds;
+		return;
+	}
+
+	if (DashCooldownTimer >= 0.f)
+	{
+		DashCooldownTimer -= DeltaSeconds;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+// FSavedMove_Bubble
+
+void FSavedMove_Bubble::Clear()
+{
+	Super::Clear();
+
+	bSavedWantsToDash = false;
+	SavedGravityTimer = 0.f;
+	SavedDashTimer = -1.f;
+	SavedDashCooldownTimer = -1.f;
+	SavedPreDashJumpCount = 0;
+}
+
+uint8 FSavedMove_Bubble::GetCompressedFlags() const
+{
+	uint8 Result = Super::GetCompressedFlags();
+
+	if (bSavedWantsToDash)
+	{
+		Result |= FLAG_Custom_0;
+	}
+
+	return Result;
+}
+
+bool FSavedMove_Bubble::CanCombineWith(const FSavedMovePtr& NewMove, ACharacter* InCharacter, float MaxDelta) const
+{
+	const FSavedMove_Bubble* NewBubbleMove = static_cast<const FSavedMove_Bubble*>(NewMove.Get());
+	if (bSavedWantsToDash != NewBubbleMove->bSavedWantsToDash)
+	{
+		return false;
+	}
+
+	// A move that starts or ends a dash changes the movement mode, keep it separate
+	if ((SavedDashTimer >= 0.f) != (NewBubbleMove->SavedDashTimer >= 0.f))
+	{
+		return false;
+	}
+
+	return Super::CanCombineWith(NewMove, InCharacter, MaxDelta);
+}
+
+void FSavedMove_Bubble::SetMoveFor(ACharacter* C, float InDeltaTime, FVector const& NewAccel, FNetworkPredictionData_Client_Character& ClientData)
+{
+	Super::SetMoveFor(C, InDeltaTime, NewAccel, ClientData);
+
+	if (UBubbleCharacterMovementComponent* Movement = Cast<UBubbleCharacterMovementComponent>(C->GetCharacterMovement()))
+	{
+		bSavedWantsToDash = Movement->bWantsToDash;
+		SavedGravityTimer = Movement->GravityTimer;
+		SavedDashTimer = Movement->DashTimer;
+		SavedDashCooldownTimer = Movement->DashCooldownTimer;
+		SavedPreDashJumpCount = Movement->PreDashJumpCount;
+	}
+}
+
+void FSavedMove_Bubble::PrepMoveFor(ACharacter* C)
+{
+	Super::PrepMoveFor(C);
+
+	// Rewind the timers to the state at the start of this move before it is replayed
+	if (UBubbleCharacterMovementComponent* Movement = Cast<UBubbleCharacterMovementComponent>(C->GetCharacterMovement()))
+	{
+		Movement->GravityTimer = SavedGravityTimer;
+		Movement->DashTimer = SavedDashTimer;
+		Movement->DashCooldownTimer = SavedDashCooldownTimer;
+		Movement->PreDashJumpCount = SavedPreDashJumpCount;
+	}
+}
+
+void FSavedMove_Bubble::CombineWith(const FSavedMove_Character* OldMove, ACharacter* InCharacter, APlayerController* PC, const FVector& OldStartLocation)
+{
+	Super::CombineWith(OldMove, InCharacter, PC, OldStartLocation);
+
+	// The combined move starts where the pending one did, so its timers have to as well
+	const FSavedMove_Bubble* OldBubbleMove = static_cast<const FSavedMove_Bubble*>(OldMove);
+	SavedGravityTimer = OldBubbleMove->SavedGravityTimer;
+	SavedDashTimer = OldBubbleMove->SavedDashTimer;
+	SavedDashCooldownTimer = OldBubbleMove->SavedDashCooldownTimer;
+	SavedPreDashJumpCount = OldBubbleMove->SavedPreDashJumpCount;
+	PrepMoveFor(InCharacter);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// FNetworkPredictionData_Client_Bubble
+
+FNetworkPredictionData_Client_Bubble::FNetworkPredictionData_Client_Bubble(const UCharacterMovementComponent& ClientMovement)
+	: Super(ClientMovement)
+{
+}
+
+FSavedMovePtr FNetworkPredictionData_Client_Bubble::AllocateNewMove()
+{
+	return FSavedMovePtr(new FSavedMove_Bubble());
 }
@@ -7,28 +7,99 @@
 #include "BubbleCharacterMovementComponent.generated.h"
 
 class UCurveFloat;
+class ABubble;
+class ABubblegunCharacter;
 
 /**
- * 
+ * Character movement with the curved jump gravity and the dash. Both are simulated inside
+ * PerformMovement so that they are recorded in saved moves and replay correctly after a
+ * server correction.
+ *
+ * Floors on bubbles are computed from the bubble surface directly rather than by sweeping the
+ * deforming trimesh, and a bubble base carries the character along with its center of mass.
  */
 UCLASS()
 class BUBBLEGUN_API UBubbleCharacterMovementComponent : public UCharacterMovementComponent
 {
 	GENERATED_BODY()
-	
+
+	friend class FSavedMove_Bubble;
+
 private:
 
 	UPROPERTY(EditDefaultsOnly)
 	UCurveFloat* GravityCurve;
 
-	float GravityTimer;
+	float GravityTimer = 0.f;
+
+	/** Set by input, consumed by the next simulated move */
+	bool bWantsToDash = false;
+
+	float DashTimer = -1.f;
+	float DashCooldownTimer = -1.f;
+	int32 PreDashJumpCount = 0;
 
 public:
 
+	/** Requests a dash on the next move, if the cooldown allows it */
+	void Dash();
+
+	bool IsDashing() const { return DashTimer >= 0.f; }
+	bool CanDash() const { return DashCooldownTimer < 0.f && !IsDashing(); }
+
 	// BEGIN UCharacterMovement Interface
 	float GetGravityZ() const override;
+	void ComputeFloorDist(const FVector& CapsuleLocation, float LineDistance, float SweepDistance, FFindFloorResult& OutFloorResult, float SweepRadius, const FHitResult* DownwardSweepResult = nullptr) const override;
+	FVector GetImpartedMovementBaseVelocity() const override;
 	bool DoJump(bool bReplayingMoves, float DeltaTime) override;
-	void TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction) override;
+	void UpdateCharacterStateBeforeMovement(float DeltaSeconds) override;
+	void UpdateFromCompressedFlags(uint8 Flags) override;
+	FNetworkPredictionData_Client* GetPredictionData_Client() const override;
 	// END UCharacterMovement Interface
 
+private:
+	ABubblegunCharacter* GetBubblegunCharacterOwner() const;
+
+	void StartDash();
+	void UpdateDash(float DeltaSeconds);
+
+	/** Adds the acceleration of force field volumes at the character location */
+	void ApplyForceFields(float DeltaSeconds);
+
+	/** Bubble the character stands on, or the one the downward sweep hit */
+	ABubble* GetBubbleFloor(const FHitResult* DownwardSweepResult, UPrimitiveComponent*& OutComponent) const;
+
+	/** Floor on a bubble from its surface, false to fall back to the sweeps */
+	bool ComputeBubbleFloorDist(const FVector& CapsuleLocation, float SweepDistance, FFindFloorResult& OutFloorResult, float SweepRadius, const FHitResult* DownwardSweepResult) const;
+};
+
+/** Saved move carrying the dash request and the timers that PerformMovement depends on */
+class FSavedMove_Bubble : public FSavedMove_Character
+{
+public:
+	typedef FSavedMove_Character Super;
+
+	bool bSavedWantsToDash = false;
+
+	float SavedGravityTimer = 0.f;
+	float SavedDashTimer = -1.f;
+	float SavedDashCooldownTimer = -1.f;
+	int32 SavedPreDashJumpCount = 0;
+
+	virtual void Clear() override;
+	virtual uint8 GetCompressedFlags() const override;
+	virtual bool CanCombineWith(const FSavedMovePtr& NewMove, ACharacter* InCharacter, float MaxDelta) const override;
+	virtual void SetMoveFor(ACharacter* C, float InDeltaTime, FVector const& NewAccel, FNetworkPredictionData_Client_Character& ClientData) override;
+	virtual void PrepMoveFor(ACharacter* C) override;
+	virtual void CombineWith(const FSavedMove_Character* OldMove, ACharacter* InCharacter, APlayerController* PC, const FVector& OldStartLocation) override;
+};
+
+class FNetworkPredictionData_Client_Bubble : public FNetworkPredictionData_Client_Character
+{
+public:
+	typedef FNetworkPredictionData_Client_Character Super;
+
+	FNetworkPredictionData_Client_Bubble(const UCharacterMovementComponent& ClientMovement);
+
+	virtual FSavedMovePtr AllocateNewMove() override;
 };
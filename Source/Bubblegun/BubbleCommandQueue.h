@@ -0,0 +1,82 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Containers/Queue.h"
+#include "UObject/WeakObjectPtrTemplates.h"
+
+enum class EBubbleCommandType : uint8
+{
+	/** Velocity change of one face, or of the whole bubble without a face */
+	Impulse,
+
+	/** Change of the rest radius, scaling the air pressure with it */
+	Grow,
+
+	/** Hands the bubble to the pop subsystem */
+	Pop,
+
+	/** A hit by another actor, merged into the contact manifold */
+	Contact,
+};
+
+/** An interaction with a bubble, recorded wherever it happens and applied by the bubble on the game thread */
+struct FBubbleCommand
+{
+	EBubbleCommandType Type = EBubbleCommandType::Impulse;
+
+	/** Impulse and Contact: triangle of the surface, INDEX_NONE for an impulse on the whole bubble */
+	int32 FaceIndex = INDEX_NONE;
+
+	/** Impulse: velocity change; Contact: hit normal */
+	FVector3d Vector = FVector3d::Zero();
+
+	/** Contact: hit point in barycentric coordinates of FaceIndex */
+	FVector3d Barycentric = FVector3d(1.0 / 3.0);
+
+	/** Grow: radius change; Contact: distance of the actor from the center of mass */
+	double Scalar = 0.0;
+
+	/** Contact: the actor that hit the bubble */
+	TWeakObjectPtr<AActor> Actor;
+
+	static FBubbleCommand MakeImpulse(const FVector3d& VelocityChange, int32 FaceIndex)
+	{
+		FBubbleCommand Command;
+		Command.Type = EBubbleCommandType::Impulse;
+		Command.FaceIndex = FaceIndex;
+		Command.Vector = VelocityChange;
+		return Command;
+	}
+
+	static FBubbleCommand MakeGrow(double Amount)
+	{
+		FBubbleCommand Command;
+		Command.Type = EBubbleCommandType::Grow;
+		Command.Scalar = Amount;
+		return Command;
+	}
+
+	static FBubbleCommand MakePop()
+	{
+		FBubbleCommand Command;
+		Command.Type = EBubbleCommandType::Pop;
+		return Command;
+	}
+
+	static FBubbleCommand MakeContact(AActor* Actor, int32 FaceIndex, const FVector3d& Barycentric, const FVector3d& Normal, double Distance)
+	{
+		FBubbleCommand Command;
+		Command.Type = EBubbleCommandType::Contact;
+		Command.Actor = Actor;
+		Command.FaceIndex = FaceIndex;
+		Command.Barycentric = Barycentric;
+		Command.Vector = Normal;
+		Command.Scalar = Distance;
+		return Command;
+	}
+};
+
+/** Lock-free, any number of producers on any thread, drained by the bubble on the game thread */
+using FBubbleCommandQueue = TQueue<FBubbleCommand, EQueueMode::Mpsc>;
@@ -0,0 +1,121 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "BubbleContactManifold.h"
+
+#include "DynamicMesh/DynamicMesh3.h"
+#include "GameFramework/Actor.h"
+
+using UE::Geometry::FDynamicMesh3;
+
+FBubbleContact& FBubbleContactManifold::AddHit(AActor* Actor, int32 FaceIndex, const FVector3d& Barycentric, const FVector3d& Normal, double Distance, bool& bOutNewContact)
+{
+	FBubbleContact* Contact = FindContact(Actor);
+	bOutNewContact = Contact == nullptr;
+	if (bOutNewContact)
+	{
+		Contact = &AddContact(Actor);
+	}
+
+	// The latest hit decides where the contact is and the distance it releases at, so a contact
+	// that keeps touching a growing or shrinking bubble follows its size; the push direction is
+	// averaged over the step
+	Contact->EngageDistance = Distance;
+	Contact->FaceIndex = FaceIndex;
+	Contact->Barycentric = Barycentric;
+	Contact->PendingNormalSum += Normal;
+	Contact->PendingHits++;
+
+	return *Contact;
+}
+
+void FBubbleContactManifold::Update(const FDynamicMesh3& Mesh, const FVector3d& WorldCenterOfMass, double StepTime, double VertexPushStrength, double GlobalPushStrength, TArray<FBubbleSolverContact>& OutSolverContacts)
+{
+	OutSolverContacts.Reset(Contacts.Num());
+
+	// Substeps and frame rate must not change how hard a resting contact pushes
+	const double SustainedScale = StepTime * 60.0;
+
+	for (int32 i = Contacts.Num() - 1; i >= 0; i--)
+	{
+		FBubbleContact& Contact = Contacts[i];
+
+		AActor* Actor = Contact.Actor.Get();
+		if (!IsValid(Actor) || !Mesh.IsTriangle(Contact.FaceIndex))
+		{
+			Contacts.RemoveAtSwap(i, EAllowShrinking::No);
+			continue;
+		}
+
+		double ActorDistance = (Actor->GetActorLocation() - WorldCenterOfMass).Size();
+		if (ActorDistance > Contact.EngageDistance * 1.5)
+		{
+			Contacts.RemoveAtSwap(i, EAllowShrinking::No);
+			continue;
+		}
+
+		FVector3d V0, V1, V2;
+		Mesh.GetTriVertices(Contact.FaceIndex, V0, V1, V2);
+		Contact.LocalPoint = V0 * Contact.Barycentric.X + V1 * Contact.Barycentric.Y + V2 * Contact.Barycentric.Z;
+
+		FBubbleSolverContact& SolverContact = OutSolverContacts.AddDefaulted_GetRef();
+		SolverContact.FaceIndex = Contact.FaceIndex;
+
+		if (Contact.PendingHits > 0)
+		{
+			Contact.Normal = Contact.PendingNormalSum.GetSafeNormal();
+
+			// impact, applied once per step no matter how many hits the actor generated
+			SolverContact.VertexVelocityDelta += Contact.Normal / 3 * VertexPushStrength * Contact.VertexFactor;
+			SolverContact.GlobalForce += Contact.Normal * GlobalPushStrength * Contact.GlobalFactor;
+
+			Contact.PendingHits = 0;
+			Contact.PendingNormalSum = FVector3d::Zero();
+		}
+
+		// sustained push for as long as the contact lives
+		SolverContact.VertexVelocityDelta += Contact.Normal / 3 * VertexPushStrength * SustainedScale;
+		SolverContact.GlobalForce += Contact.Normal * GlobalPushStrength * SustainedScale;
+	}
+}
+
+FBubbleContact& FBubbleContactManifold::AddContact(AActor* Actor)
+{
+	FBubbleContact& Contact = Contacts.AddDefaulted_GetRef();
+	Contact.Id = NextContactId++;
+	Contact.Actor = Actor;
+	return Contact;
+}
+
+FBubbleContact* FBubbleContactManifold::FindContact(const AActor* Actor)
+{
+	return Contacts.FindByPredicate([Actor](const FBubbleContact& Contact) { return Contact.Actor.Get() == Actor; });
+}
+
+void FBubbleContactManifold::Reset()
+{
+	Contacts.Reset();
+}
+
+FVector3d FBubbleContactManifold::ComputeBarycentric(const FVector3d& Point, const FVector3d& V0, const FVector3d& V1, const FVector3d& V2)
+{
+	FVector3d E0 = V1 - V0;
+	FVector3d E1 = V2 - V0;
+	FVector3d P = Point - V0;
+	double D00 = E0.Dot(E0);
+	double D01 = E0.Dot(E1);
+	double D11 = E1.Dot(E1);
+	double D20 = P.Dot(E0);
+	double D21 = P.Dot(E1);
+	double Denom = D00 * D11 - D01 * D01;
+	if (FMath::Abs(Denom) < UE_DOUBLE_SMALL_NUMBER)
+	{
+		return FVector3d(1.0 / 3.0);
+	}
+
+	double V = (D11 * D20 - D01 * D21) / Denom;
+	double W = (D00 * D21 - D01 * D20) / Denom;
+	V = FMath::Clamp(V, 0.0, 1.0);
+	W = FMath::Clamp(W, 0.0, 1.0 - V);
+	return FVector3d(1.0 - V - W, V, W);
+}
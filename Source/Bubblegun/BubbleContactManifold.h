@@ -0,0 +1,93 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "UObject/WeakObjectPtrTemplates.h"
+
+namespace UE::Geometry { class FDynamicMesh3; }
+
+/** A contact between a bubble and another actor that persists for as long as the actor keeps pushing */
+struct FBubbleContact
+{
+	/** Stable for the whole lifetime of the contact */
+	int32 Id = INDEX_NONE;
+
+	TWeakObjectPtr<AActor> Actor;
+
+	/** Triangle of the bubble mesh the contact is on */
+	int32 FaceIndex = INDEX_NONE;
+
+	/** Contact point in barycentric coordinates of FaceIndex, so it follows the surface as it deforms */
+	FVector3d Barycentric = FVector3d(1.0 / 3.0);
+
+	/** Contact point in bubble space, refreshed every step */
+	FVector3d LocalPoint = FVector3d::Zero();
+
+	/** Push direction, averaged over all hits coalesced into the last step */
+	FVector3d Normal = FVector3d::Zero();
+
+	/** Distance of the actor from the center of mass when the contact began */
+	double EngageDistance = 0.0;
+
+	/** Blueprint hit factors, evaluated on every hit */
+	double VertexFactor = 1.0;
+	double GlobalFactor = 1.0;
+
+	/** Hits received since the last step */
+	int32 PendingHits = 0;
+
+	FVector3d PendingNormalSum = FVector3d::Zero();
+};
+
+/** What the solver needs from a contact for one step */
+struct FBubbleSolverContact
+{
+	int32 FaceIndex = INDEX_NONE;
+
+	/** Added to each of the three face vertices */
+	FVector3d VertexVelocityDelta = FVector3d::Zero();
+
+	FVector3d GlobalForce = FVector3d::Zero();
+};
+
+/**
+ * Per-bubble set of persistent contacts. Hit callbacks only record into it, all hits from one
+ * actor between two steps are merged into a single contact, and the solver consumes the result
+ * once per step as a compact array.
+ */
+class BUBBLEGUN_API FBubbleContactManifold
+{
+public:
+	/** Records a hit. Returns the contact it was merged into; bOutNewContact is set if the contact was created by this hit. */
+	FBubbleContact& AddHit(AActor* Actor, int32 FaceIndex, const FVector3d& Barycentric, const FVector3d& Normal, double Distance, bool& bOutNewContact);
+
+	/**
+	 * Drops contacts whose actor is gone or has moved away from the bubble, refreshes the contact points
+	 * and fills the solver contacts for a step of StepTime. The impact of new hits is applied once, the
+	 * sustained push of a contact is tuned per step at 60 Hz and scaled to StepTime.
+	 */
+	void Update(const UE::Geometry::FDynamicMesh3& Mesh, const FVector3d& WorldCenterOfMass, double StepTime, double VertexPushStrength, double GlobalPushStrength, TArray<FBubbleSolverContact>& OutSolverContacts);
+
+	/** Adds a contact without a hit, e.g. when restoring a saved state */
+	FBubbleContact& AddContact(AActor* Actor);
+
+	FBubbleContact* FindContact(const AActor* Actor);
+
+	const TArray<FBubbleContact>& GetContacts() const { return Contacts; }
+
+	int32 Num() const { return Contacts.Num(); }
+
+	SIZE_T GetAllocatedSize() const { return Contacts.GetAllocatedSize(); }
+
+	void Reset();
+
+	/** Barycentric coordinates of Point with respect to the triangle V0, V1, V2 */
+	static FVector3d ComputeBarycentric(const FVector3d& Point, const FVector3d& V0, const FVector3d& V1, const FVector3d& V2);
+
+private:
+	/** Contacts are few per bubble, a flat array is cheaper to search than a map */
+	TArray<FBubbleContact> Contacts;
+
+	int32 NextContactId = 0;
+};
@@ -0,0 +1,42 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "BubbleCrowdEmitter.h"
+
+#include "Components/SceneComponent.h"
+
+ABubbleCrowdEmitter::ABubbleCrowdEmitter()
+{
+	PrimaryActorTick.bCanEverTick = true;
+
+	RootComponent = CreateDefaultSubobject<USceneComponent>(TEXT("Root"));
+}
+
+void ABubbleCrowdEmitter::BeginPlay()
+{
+	Super::BeginPlay();
+
+	if (UBubbleCrowdSubsystem* Crowd = GetWorld()->GetSubsystem<UBubbleCrowdSubsystem>())
+	{
+		ProfileIndex = Crowd->RegisterProfile(Profile);
+	}
+}
+
+void ABubbleCrowdEmitter::Tick(float DeltaTime)
+{
+	Super::Tick(DeltaTime);
+
+	UBubbleCrowdSubsystem* Crowd = GetWorld()->GetSubsystem<UBubbleCrowdSubsystem>();
+	if (!bEmitting || !Crowd || ProfileIndex == INDEX_NONE)
+	{
+		return;
+	}
+
+	PendingSpawns += SpawnRate * DeltaTime;
+	int32 Count = FMath::FloorToInt32(PendingSpawns);
+	if (Count > 0)
+	{
+		PendingSpawns -= Count;
+		Crowd->SpawnBubbles(ProfileIndex, GetActorLocation(), GetActorTransform().TransformVectorNoScale(InitialVelocity), Spread, Count);
+	}
+}
@@ -0,0 +1,47 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "GameFramework/Actor.h"
+#include "BubbleCrowdSubsystem.h"
+#include "BubbleCrowdEmitter.generated.h"
+
+/** Continuously releases crowd bubbles of one profile, e.g. a bubble machine or a foaming pool */
+UCLASS()
+class BUBBLEGUN_API ABubbleCrowdEmitter : public AActor
+{
+	GENERATED_BODY()
+
+public:
+	ABubbleCrowdEmitter();
+
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Bubble Crowd")
+	FBubbleCrowdProfile Profile;
+
+	/** Bubbles per second */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Bubble Crowd")
+	float SpawnRate = 200.0f;
+
+	/** Initial velocity in the local space of the emitter */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Bubble Crowd")
+	FVector InitialVelocity = FVector(0.0, 0.0, 100.0);
+
+	/** Bubbles appear within this distance of the emitter */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Bubble Crowd")
+	float Spread = 20.0f;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Bubble Crowd")
+	bool bEmitting = true;
+
+	virtual void Tick(float DeltaTime) override;
+
+protected:
+	virtual void BeginPlay() override;
+
+private:
+	int32 ProfileIndex = INDEX_NONE;
+
+	/** Fraction of a bubble carried over to the next tick */
+	float PendingSpawns = 0.0f;
+};
@@ -0,0 +1,69 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "MassEntityTypes.h"
+#include "BubbleCrowdFragments.generated.h"
+
+USTRUCT()
+struct FBubbleCrowdTransformFragment : public FMassFragment
+{
+	GENERATED_BODY()
+
+	FVector Location = FVector::ZeroVector;
+};
+
+USTRUCT()
+struct FBubbleCrowdVelocityFragment : public FMassFragment
+{
+	GENERATED_BODY()
+
+	FVector3f Velocity = FVector3f::ZeroVector;
+};
+
+USTRUCT()
+struct FBubbleCrowdRadiusFragment : public FMassFragment
+{
+	GENERATED_BODY()
+
+	float Radius = 5.0f;
+};
+
+/** Phase of the surface oscillation; pulse, wobble and velocity stretch are all derived from it at render time */
+USTRUCT()
+struct FBubbleCrowdDeformationFragment : public FMassFragment
+{
+	GENERATED_BODY()
+
+	float Phase = 0.0f;
+
+	/** Oscillations per second */
+	float Frequency = 2.0f;
+};
+
+USTRUCT()
+struct FBubbleCrowdLifetimeFragment : public FMassFragment
+{
+	GENERATED_BODY()
+
+	float Age = 0.0f;
+
+	float Lifetime = 5.0f;
+};
+
+/** Index into the profiles of UBubbleCrowdSubsystem, shared so every chunk holds bubbles of a single profile */
+USTRUCT()
+struct FBubbleCrowdProfileFragment : public FMassConstSharedFragment
+{
+	GENERATED_BODY()
+
+	int32 ProfileIndex = INDEX_NONE;
+};
+
+/** Added when a bubble popped or expired, the pop processor removes it */
+USTRUCT()
+struct FBubbleCrowdPoppedTag : public FMassTag
+{
+	GENERATED_BODY()
+};
@@ -0,0 +1,307 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "BubbleCrowdProcessors.h"
+
+#include "BubbleCrowdFragments.h"
+#include "BubbleCrowdSubsystem.h"
+#include "BubbleForceFieldSubsystem.h"
+#include "BubbleSDFSubsystem.h"
+#include "BubbleSimulationSubsystem.h"
+#include "Bubblegun.h"
+#include "Engine/World.h"
+#include "MassCommandBuffer.h"
+#include "MassExecutionContext.h"
+
+static TAutoConsoleVariable<float> CVarBubbleCrowdPromotionDistance(
+	TEXT("bubble.CrowdPromotionDistance"),
+	300.0f,
+	TEXT("Crowd bubbles closer than this to a viewer are turned into full bubble actors, if their profile has a promoted class."),
+	ECVF_Default);
+
+namespace
+{
+	/** Radius of the engine's basic sphere */
+	constexpr float UnitSphereRadius = 50.0f;
+
+	/** Fraction of the normal velocity kept when bouncing off static geometry */
+	constexpr float Restitution = 0.5f;
+
+	/** Bubbles of a chunk request distance field bricks in cells of this size, so a scattered chunk does not request the box around all of them */
+	constexpr double RequestCellSize = 500.0;
+
+	/** Stretch along the direction of motion never exceeds this */
+	constexpr float MaxStretch = 0.3f;
+
+	FBox GetChunkBounds(TConstArrayView<FBubbleCrowdTransformFragment> Transforms, TConstArrayView<FBubbleCrowdRadiusFragment> Radii)
+	{
+		FBox Bounds(ForceInit);
+		for (int32 i = 0; i < Transforms.Num(); i++)
+		{
+			Bounds += FBox::BuildAABB(Transforms[i].Location, FVector(Radii[i].Radius));
+		}
+		return Bounds;
+	}
+}
+
+UBubbleCrowdProcessor::UBubbleCrowdProcessor()
+	: EntityQuery(*this)
+{
+	bAutoRegisterWithProcessingPhases = false;
+
+	// the processors talk to world subsystems and actors
+	bRequiresGameThreadExecution = true;
+}
+
+UBubbleCrowdSubsystem& UBubbleCrowdProcessor::GetCrowd() const
+{
+	return *CastChecked<UBubbleCrowdSubsystem>(GetOuter());
+}
+
+void UBubbleCrowdIntegrationProcessor::ConfigureQueries()
+{
+	EntityQuery.AddRequirement<FBubbleCrowdTransformFragment>(EMassFragmentAccess::ReadWrite);
+	EntityQuery.AddRequirement<FBubbleCrowdVelocityFragment>(EMassFragmentAccess::ReadWrite);
+	EntityQuery.AddRequirement<FBubbleCrowdRadiusFragment>(EMassFragmentAccess::ReadOnly);
+	EntityQuery.AddRequirement<FBubbleCrowdDeformationFragment>(EMassFragmentAccess::ReadWrite);
+	EntityQuery.AddRequirement<FBubbleCrowdLifetimeFragment>(EMassFragmentAccess::ReadWrite);
+	EntityQuery.AddConstSharedRequirement<FBubbleCrowdProfileFragment>();
+	EntityQuery.AddTagRequirement<FBubbleCrowdPoppedTag>(EMassFragmentPresence::None);
+}
+
+void UBubbleCrowdIntegrationProcessor::Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context)
+{
+	LLM_SCOPE_BYTAG(BubbleSimulation);
+
+	const UBubbleCrowdSubsystem& Crowd = GetCrowd();
+	const UBubbleForceFieldSubsystem* ForceFields = Crowd.GetWorld()->GetSubsystem<UBubbleForceFieldSubsystem>();
+	TArray<FBubbleForceField> Fields;
+
+	EntityQuery.ForEachEntityChunk(EntityManager, Context, [&](FMassExecutionContext& ChunkContext)
+	{
+		const FBubbleCrowdProfile& Profile = Crowd.GetProfile(ChunkContext.GetConstSharedFragment<FBubbleCrowdProfileFragment>().ProfileIndex);
+		TArrayView<FBubbleCrowdTransformFragment> Transforms = ChunkContext.GetMutableFragmentView<FBubbleCrowdTransformFragment>();
+		TArrayView<FBubbleCrowdVelocityFragment> Velocities = ChunkContext.GetMutableFragmentView<FBubbleCrowdVelocityFragment>();
+		TConstArrayView<FBubbleCrowdRadiusFragment> Radii = ChunkContext.GetFragmentView<FBubbleCrowdRadiusFragment>();
+		TArrayView<FBubbleCrowdDeformationFragment> Deformations = ChunkContext.GetMutableFragmentView<FBubbleCrowdDeformationFragment>();
+		TArrayView<FBubbleCrowdLifetimeFragment> Lifetimes = ChunkContext.GetMutableFragmentView<FBubbleCrowdLifetimeFragment>();
+		const float DeltaTime = ChunkContext.GetDeltaTimeSeconds();
+
+		// one field lookup for the whole chunk
+		Fields.Reset();
+		if (ForceFields && ForceFields->HasFields())
+		{
+			ForceFields->GetBubbleFields(GetChunkBounds(Transforms, Radii), Fields);
+		}
+
+		const FVector3f Buoyancy(0.0f, 0.0f, Profile.Buoyancy);
+		const float DragFactor = FMath::Max(1.0f - Profile.Drag * DeltaTime, 0.0f);
+		for (int32 i = 0; i < ChunkContext.GetNumEntities(); i++)
+		{
+			FVector3f Acceleration = Buoyancy;
+			for (const FBubbleForceField& Field : Fields)
+			{
+				Acceleration += FVector3f(Field.Evaluate(Transforms[i].Location));
+			}
+
+			FVector3f& Velocity = Velocities[i].Velocity;
+			Velocity = (Velocity + Acceleration * DeltaTime) * DragFactor;
+			Transforms[i].Location += FVector(Velocity * DeltaTime);
+
+			FBubbleCrowdDeformationFragment& Deformation = Deformations[i];
+			Deformation.Phase = FMath::Fmod(Deformation.Phase + UE_TWO_PI * Deformation.Frequency * DeltaTime, UE_TWO_PI);
+
+			FBubbleCrowdLifetimeFragment& Lifetime = Lifetimes[i];
+			Lifetime.Age += DeltaTime;
+			if (Lifetime.Age >= Lifetime.Lifetime)
+			{
+				ChunkContext.Defer().AddTag<FBubbleCrowdPoppedTag>(ChunkContext.GetEntity(i));
+			}
+		}
+	});
+}
+
+void UBubbleCrowdCollisionProcessor::ConfigureQueries()
+{
+	EntityQuery.AddRequirement<FBubbleCrowdTransformFragment>(EMassFragmentAccess::ReadWrite);
+	EntityQuery.AddRequirement<FBubbleCrowdVelocityFragment>(EMassFragmentAccess::ReadWrite);
+	EntityQuery.AddRequirement<FBubbleCrowdRadiusFragment>(EMassFragmentAccess::ReadOnly);
+	EntityQuery.AddConstSharedRequirement<FBubbleCrowdProfileFragment>();
+	EntityQuery.AddTagRequirement<FBubbleCrowdPoppedTag>(EMassFragmentPresence::None);
+}
+
+void UBubbleCrowdCollisionProcessor::Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context)
+{
+	LLM_SCOPE_BYTAG(BubbleCollision);
+
+	const UBubbleCrowdSubsystem& Crowd = GetCrowd();
+	UBubbleSDFSubsystem* SDF = Crowd.GetWorld()->GetSubsystem<UBubbleSDFSubsystem>();
+	if (!SDF)
+	{
+		return;
+	}
+	TSet<FIntVector> RequestedCells;
+
+	EntityQuery.ForEachEntityChunk(EntityManager, Context, [&](FMassExecutionContext& ChunkContext)
+	{
+		const FBubbleCrowdProfile& Profile = Crowd.GetProfile(ChunkContext.GetConstSharedFragment<FBubbleCrowdProfileFragment>().ProfileIndex);
+		TArrayView<FBubbleCrowdTransformFragment> Transforms = ChunkContext.GetMutableFragmentView<FBubbleCrowdTransformFragment>();
+		TArrayView<FBubbleCrowdVelocityFragment> Velocities = ChunkContext.GetMutableFragmentView<FBubbleCrowdVelocityFragment>();
+		TConstArrayView<FBubbleCrowdRadiusFragment> Radii = ChunkContext.GetFragmentView<FBubbleCrowdRadiusFragment>();
+
+		for (int32 i = 0; i < ChunkContext.GetNumEntities(); i++)
+		{
+			const FVector& Location = Transforms[i].Location;
+			FIntVector Cell(
+				FMath::FloorToInt32(Location.X / RequestCellSize),
+				FMath::FloorToInt32(Location.Y / RequestCellSize),
+				FMath::FloorToInt32(Location.Z / RequestCellSize));
+			bool bAlreadyRequested = false;
+			RequestedCells.Add(Cell, &bAlreadyRequested);
+			if (!bAlreadyRequested)
+			{
+				// crowd bubbles are far smaller than a cell, a little margin covers the ones on its edge
+				FVector Min = FVector(Cell) * RequestCellSize;
+				SDF->RequestRegion(FBox(Min, Min + FVector(RequestCellSize)).ExpandBy(UnitSphereRadius));
+			}
+
+			float Distance;
+			FVector Gradient;
+			const float Radius = Radii[i].Radius;
+			if (!SDF->Sample(Location, Distance, Gradient) || Distance >= Radius)
+			{
+				continue;
+			}
+
+			if (Profile.bPopOnContact)
+			{
+				ChunkContext.Defer().AddTag<FBubbleCrowdPoppedTag>(ChunkContext.GetEntity(i));
+				continue;
+			}
+
+			FVector3f Normal = FVector3f(Gradient.GetSafeNormal());
+			Transforms[i].Location += FVector(Normal) * (Radius - Distance);
+			FVector3f& Velocity = Velocities[i].Velocity;
+			float NormalSpeed = FVector3f::DotProduct(Velocity, Normal);
+			if (NormalSpeed < 0.0f)
+			{
+				Velocity -= (1.0f + Restitution) * NormalSpeed * Normal;
+			}
+		}
+	});
+}
+
+void UBubbleCrowdPromotionProcessor::ConfigureQueries()
+{
+	EntityQuery.AddRequirement<FBubbleCrowdTransformFragment>(EMassFragmentAccess::ReadOnly);
+	EntityQuery.AddRequirement<FBubbleCrowdRadiusFragment>(EMassFragmentAccess::ReadOnly);
+	EntityQuery.AddConstSharedRequirement<FBubbleCrowdProfileFragment>();
+	EntityQuery.AddTagRequirement<FBubbleCrowdPoppedTag>(EMassFragmentPresence::None);
+}
+
+void UBubbleCrowdPromotionProcessor::Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context)
+{
+	UBubbleCrowdSubsystem& Crowd = GetCrowd();
+	const UBubbleSimulationSubsystem* Simulation = Crowd.GetWorld()->GetSubsystem<UBubbleSimulationSubsystem>();
+	if (!Simulation || !Simulation->HasViewers())
+	{
+		return;
+	}
+	const double PromotionDistance = CVarBubbleCrowdPromotionDistance.GetValueOnGameThread();
+	bool bBudgetLeft = true;
+
+	EntityQuery.ForEachEntityChunk(EntityManager, Context, [&](FMassExecutionContext& ChunkContext)
+	{
+		const int32 ProfileIndex = ChunkContext.GetConstSharedFragment<FBubbleCrowdProfileFragment>().ProfileIndex;
+		const FBubbleCrowdProfile& Profile = Crowd.GetProfile(ProfileIndex);
+		if (!bBudgetLeft || !Profile.PromotedClass)
+		{
+			return;
+		}
+
+		TConstArrayView<FBubbleCrowdTransformFragment> Transforms = ChunkContext.GetFragmentView<FBubbleCrowdTransformFragment>();
+		TConstArrayView<FBubbleCrowdRadiusFragment> Radii = ChunkContext.GetFragmentView<FBubbleCrowdRadiusFragment>();
+		for (int32 i = 0; i < ChunkContext.GetNumEntities() && bBudgetLeft; i++)
+		{
+			if (Radii[i].Radius < Profile.MinPromotedRadius || Simulation->GetViewDistance(Transforms[i].Location) > PromotionDistance)
+			{
+				continue;
+			}
+
+			FBubbleCrowdPromotion Promotion;
+			Promotion.ProfileIndex = ProfileIndex;
+			Promotion.Location = Transforms[i].Location;
+			Promotion.Radius = Radii[i].Radius;
+			bBudgetLeft = Crowd.TryPromote(Promotion);
+			if (bBudgetLeft)
+			{
+				ChunkContext.Defer().DestroyEntity(ChunkContext.GetEntity(i));
+				Crowd.OnBubblesRemoved(1);
+			}
+		}
+	});
+}
+
+void UBubbleCrowdPopProcessor::ConfigureQueries()
+{
+	EntityQuery.AddRequirement<FBubbleCrowdTransformFragment>(EMassFragmentAccess::ReadOnly);
+	EntityQuery.AddTagRequirement<FBubbleCrowdPoppedTag>(EMassFragmentPresence::All);
+}
+
+void UBubbleCrowdPopProcessor::Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context)
+{
+	UBubbleCrowdSubsystem& Crowd = GetCrowd();
+
+	EntityQuery.ForEachEntityChunk(EntityManager, Context, [&](FMassExecutionContext& ChunkContext)
+	{
+		ChunkContext.Defer().DestroyEntities(ChunkContext.GetEntities());
+		Crowd.OnBubblesRemoved(ChunkContext.GetNumEntities());
+	});
+}
+
+void UBubbleCrowdRenderProcessor::ConfigureQueries()
+{
+	EntityQuery.AddRequirement<FBubbleCrowdTransformFragment>(EMassFragmentAccess::ReadOnly);
+	EntityQuery.AddRequirement<FBubbleCrowdVelocityFragment>(EMassFragmentAccess::ReadOnly);
+	EntityQuery.AddRequirement<FBubbleCrowdRadiusFragment>(EMassFragmentAccess::ReadOnly);
+	EntityQuery.AddRequirement<FBubbleCrowdDeformationFragment>(EMassFragmentAccess::ReadOnly);
+	EntityQuery.AddConstSharedRequirement<FBubbleCrowdProfileFragment>();
+	EntityQuery.AddTagRequirement<FBubbleCrowdPoppedTag>(EMassFragmentPresence::None);
+}
+
+void UBubbleCrowdRenderProcessor::Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context)
+{
+	LLM_SCOPE_BYTAG(BubbleMesh);
+
+	UBubbleCrowdSubsystem& Crowd = GetCrowd();
+	if (!Crowd.IsRendering())
+	{
+		return;
+	}
+
+	EntityQuery.ForEachEntityChunk(EntityManager, Context, [&](FMassExecutionContext& ChunkContext)
+	{
+		const int32 ProfileIndex = ChunkContext.GetConstSharedFragment<FBubbleCrowdProfileFragment>().ProfileIndex;
+		const FBubbleCrowdProfile& Profile = Crowd.GetProfile(ProfileIndex);
+		TConstArrayView<FBubbleCrowdTransformFragment> Transforms = ChunkContext.GetFragmentView<FBubbleCrowdTransformFragment>();
+		TConstArrayView<FBubbleCrowdVelocityFragment> Velocities = ChunkContext.GetFragmentView<FBubbleCrowdVelocityFragment>();
+		TConstArrayView<FBubbleCrowdRadiusFragment> Radii = ChunkContext.GetFragmentView<FBubbleCrowdRadiusFragment>();
+		TConstArrayView<FBubbleCrowdDeformationFragment> Deformations = ChunkContext.GetFragmentView<FBubbleCrowdDeformationFragment>();
+
+		TArray<FTransform>& RenderTransforms = Crowd.GetRenderTransforms(ProfileIndex);
+		RenderTransforms.Reserve(RenderTransforms.Num() + ChunkContext.GetNumEntities());
+		for (int32 i = 0; i < ChunkContext.GetNumEntities(); i++)
+		{
+			const FVector3f& Velocity = Velocities[i].Velocity;
+			const float Phase = Deformations[i].Phase;
+			const float Speed = Velocity.Size();
+
+			// the sphere's X axis follows the motion, pulse scales all axes and wobble plus stretch the X axis, volume preserving
+			FQuat Rotation = Speed > UE_KINDA_SMALL_NUMBER ? FRotationMatrix::MakeFromX(FVector(Velocity / Speed)).ToQuat() : FQuat::Identity;
+			float Uniform = Radii[i].Radius / UnitSphereRadius * (1.0f + Profile.PulseAmplitude * FMath::Sin(Phase));
+			float Along = (1.0f + FMath::Min(Profile.StretchPerSpeed * Speed, MaxStretch)) * (1.0f + Profile.WobbleAmplitude * FMath::Sin(2.0f * Phase));
+			float Across = FMath::InvSqrt(Along);
+			RenderTransforms.Emplace(Rotation, Transforms[i].Location, FVector(Along, Across, Across) * Uniform);
+		}
+	});
+}
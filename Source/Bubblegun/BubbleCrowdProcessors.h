@@ -0,0 +1,80 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "MassProcessor.h"
+#include "MassEntityQuery.h"
+#include "BubbleCrowdProcessors.generated.h"
+
+class UBubbleCrowdSubsystem;
+
+/** Processors owned and run by UBubbleCrowdSubsystem, outside of the Mass processing phases */
+UCLASS(Abstract)
+class BUBBLEGUN_API UBubbleCrowdProcessor : public UMassProcessor
+{
+	GENERATED_BODY()
+
+public:
+	UBubbleCrowdProcessor();
+
+protected:
+	UBubbleCrowdSubsystem& GetCrowd() const;
+
+	FMassEntityQuery EntityQuery;
+};
+
+/** Buoyancy, drag and force field volumes; ages the bubbles and marks the expired ones popped */
+UCLASS()
+class BUBBLEGUN_API UBubbleCrowdIntegrationProcessor : public UBubbleCrowdProcessor
+{
+	GENERATED_BODY()
+
+protected:
+	virtual void ConfigureQueries() override;
+	virtual void Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context) override;
+};
+
+/** Static geometry from the shared distance field cache, one lookup per bubble and no scene queries */
+UCLASS()
+class BUBBLEGUN_API UBubbleCrowdCollisionProcessor : public UBubbleCrowdProcessor
+{
+	GENERATED_BODY()
+
+protected:
+	virtual void ConfigureQueries() override;
+	virtual void Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context) override;
+};
+
+/** Hands bubbles near a player over to full actors, within the per-tick promotion budget */
+UCLASS()
+class BUBBLEGUN_API UBubbleCrowdPromotionProcessor : public UBubbleCrowdProcessor
+{
+	GENERATED_BODY()
+
+protected:
+	virtual void ConfigureQueries() override;
+	virtual void Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context) override;
+};
+
+/** Removes popped bubbles */
+UCLASS()
+class BUBBLEGUN_API UBubbleCrowdPopProcessor : public UBubbleCrowdProcessor
+{
+	GENERATED_BODY()
+
+protected:
+	virtual void ConfigureQueries() override;
+	virtual void Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context) override;
+};
+
+/** Builds the instance transforms, with the deformation modes in the scale */
+UCLASS()
+class BUBBLEGUN_API UBubbleCrowdRenderProcessor : public UBubbleCrowdProcessor
+{
+	GENERATED_BODY()
+
+protected:
+	virtual void ConfigureQueries() override;
+	virtual void Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context) override;
+};
@@ -0,0 +1,247 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "BubbleCrowdSubsystem.h"
+
+#include "Bubble.h"
+#include "BubbleCrowdFragments.h"
+#include "BubbleCrowdProcessors.h"
+#include "Bubblegun.h"
+#include "Components/InstancedStaticMeshComponent.h"
+#include "Engine/StaticMesh.h"
+#include "Engine/World.h"
+#include "MassEntitySubsystem.h"
+#include "MassExecutor.h"
+#include "MassProcessingTypes.h"
+#include "Misc/App.h"
+
+static TAutoConsoleVariable<int32> CVarBubbleCrowdMaxBubbles(
+	TEXT("bubble.CrowdMaxBubbles"),
+	16384,
+	TEXT("Crowd bubbles alive at once in a world, spawns beyond it are dropped."),
+	ECVF_Default);
+
+static TAutoConsoleVariable<int32> CVarBubbleCrowdMaxPromotionsPerFrame(
+	TEXT("bubble.CrowdMaxPromotionsPerFrame"),
+	2,
+	TEXT("Crowd bubbles turned into full bubble actors per tick at most, the rest wait for the next ticks."),
+	ECVF_Default);
+
+void UBubbleCrowdSubsystem::Initialize(FSubsystemCollectionBase& Collection)
+{
+	Super::Initialize(Collection);
+
+	UMassEntitySubsystem* EntitySubsystem = Collection.InitializeDependency<UMassEntitySubsystem>();
+	FMassEntityManager& EntityManager = EntitySubsystem->GetMutableEntityManager();
+	Archetype = EntityManager.CreateArchetype({
+		FBubbleCrowdTransformFragment::StaticStruct(),
+		FBubbleCrowdVelocityFragment::StaticStruct(),
+		FBubbleCrowdRadiusFragment::StaticStruct(),
+		FBubbleCrowdDeformationFragment::StaticStruct(),
+		FBubbleCrowdLifetimeFragment::StaticStruct(),
+		FBubbleCrowdProfileFragment::StaticStruct(),
+	});
+
+	Processors.Add(NewObject<UBubbleCrowdIntegrationProcessor>(this));
+	Processors.Add(NewObject<UBubbleCrowdCollisionProcessor>(this));
+	Processors.Add(NewObject<UBubbleCrowdPromotionProcessor>(this));
+	Processors.Add(NewObject<UBubbleCrowdPopProcessor>(this));
+	Processors.Add(NewObject<UBubbleCrowdRenderProcessor>(this));
+	for (UBubbleCrowdProcessor* Processor : Processors)
+	{
+		Processor->CallInitialize(this);
+	}
+
+	bRendering = FApp::CanEverRender() && GetWorld()->GetNetMode() != NM_DedicatedServer;
+	if (bRendering)
+	{
+		SphereMesh = LoadObject<UStaticMesh>(nullptr, TEXT("/Engine/BasicShapes/Sphere.Sphere"));
+	}
+	Random.GenerateNewSeed();
+}
+
+int32 UBubbleCrowdSubsystem::RegisterProfile(const FBubbleCrowdProfile& Profile)
+{
+	RenderTransforms.AddDefaulted();
+	Batches.Add(nullptr);
+	return Profiles.Add(Profile);
+}
+
+void UBubbleCrowdSubsystem::SpawnBubbles(int32 ProfileIndex, const FVector& Location, const FVector& Velocity, float Spread, int32 Count)
+{
+	LLM_SCOPE_BYTAG(BubbleSimulation);
+
+	if (!Profiles.IsValidIndex(ProfileIndex))
+	{
+		return;
+	}
+	Count = FMath::Min(Count, CVarBubbleCrowdMaxBubbles.GetValueOnGameThread() - NumBubbles);
+	if (Count <= 0)
+	{
+		return;
+	}
+
+	FMassEntityManager& EntityManager = GetWorld()->GetSubsystem<UMassEntitySubsystem>()->GetMutableEntityManager();
+	FBubbleCrowdProfileFragment ProfileFragment;
+	ProfileFragment.ProfileIndex = ProfileIndex;
+	FMassArchetypeSharedFragmentValues SharedValues;
+	SharedValues.Add(EntityManager.GetOrCreateConstSharedFragment(ProfileFragment));
+	SharedValues.Sort();
+
+	TArray<FMassEntityHandle> Entities;
+	TSharedRef<FMassEntityManager::FEntityCreationContext> CreationContext = EntityManager.BatchCreateEntities(Archetype, SharedValues, Count, Entities);
+
+	const FBubbleCrowdProfile& Profile = Profiles[ProfileIndex];
+	for (const FMassEntityHandle& Entity : Entities)
+	{
+		EntityManager.GetFragmentDataChecked<FBubbleCrowdTransformFragment>(Entity).Location = Location + Random.GetUnitVector() * Random.FRandRange(0.0f, Spread);
+		EntityManager.GetFragmentDataChecked<FBubbleCrowdVelocityFragment>(Entity).Velocity = FVector3f(Velocity);
+		EntityManager.GetFragmentDataChecked<FBubbleCrowdRadiusFragment>(Entity).Radius = Random.FRandRange(Profile.RadiusRange.X, Profile.RadiusRange.Y);
+
+		// random phases and slightly different frequencies keep neighbours from pulsing in unison
+		FBubbleCrowdDeformationFragment& Deformation = EntityManager.GetFragmentDataChecked<FBubbleCrowdDeformationFragment>(Entity);
+		Deformation.Phase = Random.FRandRange(0.0f, UE_TWO_PI);
+		Deformation.Frequency *= Random.FRandRange(0.8f, 1.25f);
+
+		EntityManager.GetFragmentDataChecked<FBubbleCrowdLifetimeFragment>(Entity).Lifetime = Random.FRandRange(Profile.LifetimeRange.X, Profile.LifetimeRange.Y);
+	}
+	NumBubbles += Entities.Num();
+}
+
+bool UBubbleCrowdSubsystem::TryPromote(const FBubbleCrowdPromotion& Promotion)
+{
+	if (PromotionBudget <= 0)
+	{
+		return false;
+	}
+	PromotionBudget--;
+	Promotions.Add(Promotion);
+	return true;
+}
+
+void UBubbleCrowdSubsystem::SpawnPromotedBubbles()
+{
+	for (const FBubbleCrowdPromotion& Promotion : Promotions)
+	{
+		TSubclassOf<ABubble> Class = Profiles[Promotion.ProfileIndex].PromotedClass;
+		ABubble* Bubble = GetWorld()->SpawnActorDeferred<ABubble>(Class, FTransform(Promotion.Location), nullptr, nullptr, ESpawnActorCollisionHandlingMethod::AlwaysSpawn);
+		if (!Bubble)
+		{
+			continue;
+		}
+
+		// same pressure scaling as growing the bubble to this size
+		double Scale = Promotion.Radius / Bubble->InitialRadius;
+		Bubble->AirPressureForce *= FMath::Pow(Scale, 4);
+		Bubble->InitialRadius = Promotion.Radius;
+		Bubble->Radius = Promotion.Radius;
+		// from where it was promoted, the spawned actor's name differs between machines
+		Bubble->ColorSeed = int32(HashCombineFast(Promotion.ProfileIndex, GetTypeHash(Promotion.Location)));
+		Bubble->FinishSpawning(FTransform(Promotion.Location));
+	}
+	Promotions.Reset();
+}
+
+UInstancedStaticMeshComponent* UBubbleCrowdSubsystem::GetOrCreateBatch(int32 ProfileIndex)
+{
+	if (Batches[ProfileIndex])
+	{
+		return Batches[ProfileIndex];
+	}
+
+	if (!HostActor)
+	{
+		FActorSpawnParameters SpawnParams;
+		SpawnParams.ObjectFlags |= RF_Transient;
+		HostActor = GetWorld()->SpawnActor<AActor>(AActor::StaticClass(), FTransform::Identity, SpawnParams);
+
+		USceneComponent* Root = NewObject<USceneComponent>(HostActor, TEXT("Root"));
+		HostActor->SetRootComponent(Root);
+		Root->RegisterComponent();
+	}
+
+	// plain instances rather than a hierarchy, every instance moves every tick
+	UInstancedStaticMeshComponent* Component = NewObject<UInstancedStaticMeshComponent>(HostActor);
+	Component->SetStaticMesh(SphereMesh);
+	Component->SetMaterial(0, Profiles[ProfileIndex].Material);
+	Component->SetMobility(EComponentMobility::Movable);
+	Component->SetCollisionEnabled(ECollisionEnabled::NoCollision);
+	Component->SetCastShadow(false);
+	Component->SetupAttachment(HostActor->GetRootComponent());
+	Component->RegisterComponent();
+	HostActor->AddInstanceComponent(Component);
+
+	Batches[ProfileIndex] = Component;
+	return Component;
+}
+
+void UBubbleCrowdSubsystem::UpdateInstances()
+{
+	LLM_SCOPE_BYTAG(BubbleMesh);
+
+	if (!bRendering || !SphereMesh)
+	{
+		return;
+	}
+
+	for (int32 ProfileIndex = 0; ProfileIndex < Profiles.Num(); ProfileIndex++)
+	{
+		const TArray<FTransform>& Transforms = RenderTransforms[ProfileIndex];
+		if (Transforms.IsEmpty() && !Batches[ProfileIndex])
+		{
+			continue;
+		}
+
+		// instances are anonymous, only a change in count adds or removes any
+		UInstancedStaticMeshComponent* Component = GetOrCreateBatch(ProfileIndex);
+		int32 Existing = Component->GetInstanceCount();
+		if (Existing > Transforms.Num())
+		{
+			TArray<int32> Removed;
+			for (int32 i = Transforms.Num(); i < Existing; i++)
+			{
+				Removed.Add(i);
+			}
+			Component->RemoveInstances(Removed);
+		}
+		else if (Existing < Transforms.Num())
+		{
+			Component->AddInstances(TArray<FTransform>(Transforms.GetData() + Existing, Transforms.Num() - Existing), false, true);
+		}
+
+		if (Existing > 0 && Transforms.Num() > 0)
+		{
+			Component->BatchUpdateInstancesTransforms(0, TArray<FTransform>(Transforms.GetData(), FMath::Min(Existing, Transforms.Num())), true, true);
+		}
+	}
+}
+
+void UBubbleCrowdSubsystem::Tick(float DeltaTime)
+{
+	LLM_SCOPE_BYTAG(BubbleSimulation);
+
+	PromotionBudget = CVarBubbleCrowdMaxPromotionsPerFrame.GetValueOnGameThread();
+	for (TArray<FTransform>& Transforms : RenderTransforms)
+	{
+		Transforms.Reset();
+	}
+
+	// commands deferred by a processor are flushed before the next one runs, so the pop processor sees this tick's pops
+	if (NumBubbles > 0)
+	{
+		FMassEntityManager& EntityManager = GetWorld()->GetSubsystem<UMassEntitySubsystem>()->GetMutableEntityManager();
+		for (UBubbleCrowdProcessor* Processor : Processors)
+		{
+			FMassProcessingContext ProcessingContext(EntityManager, DeltaTime);
+			UE::Mass::Executor::Run(*Processor, ProcessingContext);
+		}
+	}
+
+	SpawnPromotedBubbles();
+	UpdateInstances();
+}
+
+TStatId UBubbleCrowdSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UBubbleCrowdSubsystem, STATGROUP_Tickables);
+}
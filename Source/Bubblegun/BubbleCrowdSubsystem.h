@@ -0,0 +1,157 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "MassEntityTypes.h"
+#include "MassArchetypeTypes.h"
+#include "BubbleCrowdSubsystem.generated.h"
+
+class ABubble;
+class UBubbleCrowdProcessor;
+class UInstancedStaticMeshComponent;
+class UMaterialInterface;
+class UStaticMesh;
+
+/** How the bubbles of one emitter look and move */
+USTRUCT(BlueprintType)
+struct FBubbleCrowdProfile
+{
+	GENERATED_BODY()
+
+	/** Radius is picked uniformly between X and Y */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Bubble Crowd")
+	FVector2D RadiusRange = FVector2D(3.0, 10.0);
+
+	/** Seconds until the bubble pops on its own, picked uniformly between X and Y */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Bubble Crowd")
+	FVector2D LifetimeRange = FVector2D(3.0, 8.0);
+
+	/** Upward acceleration in cm/s^2 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Bubble Crowd")
+	float Buoyancy = 150.0f;
+
+	/** Fraction of the velocity lost per second */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Bubble Crowd")
+	float Drag = 1.5f;
+
+	/** Relative change of the radius by the breathing mode */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Bubble Crowd")
+	float PulseAmplitude = 0.04f;
+
+	/** Relative squash along the direction of motion by the wobble mode */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Bubble Crowd")
+	float WobbleAmplitude = 0.08f;
+
+	/** Relative stretch along the direction of motion per cm/s of speed, capped at 30% */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Bubble Crowd")
+	float StretchPerSpeed = 0.0005f;
+
+	/** Pop when touching static geometry, otherwise bounce off it */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Bubble Crowd")
+	bool bPopOnContact = true;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Bubble Crowd")
+	TObjectPtr<UMaterialInterface> Material;
+
+	/** Bubbles close to a player become actors of this class, none are promoted if unset */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Bubble Crowd")
+	TSubclassOf<ABubble> PromotedClass;
+
+	/** Only bubbles at least this large are promoted */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Bubble Crowd")
+	float MinPromotedRadius = 8.0f;
+};
+
+/** A crowd bubble that is turned into an actor after the processors ran */
+struct FBubbleCrowdPromotion
+{
+	int32 ProfileIndex = INDEX_NONE;
+
+	FVector Location = FVector::ZeroVector;
+
+	float Radius = 0.0f;
+};
+
+/**
+ * Thousands of small bubbles as Mass entities: position, velocity, radius, a deformation phase and
+ * a lifetime per bubble, processed chunk by chunk by a fixed set of processors that this subsystem
+ * runs every tick, and drawn as instances of a shared sphere per profile. No per-vertex surface
+ * exists; a bubble that comes close to a player is promoted to a full ABubble.
+ */
+UCLASS()
+class BUBBLEGUN_API UBubbleCrowdSubsystem : public UTickableWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	virtual void Initialize(FSubsystemCollectionBase& Collection) override;
+
+	/** Returns the index to spawn bubbles of the profile with, emitters register theirs once */
+	UFUNCTION(BlueprintCallable, Category = "Bubble Crowd")
+	int32 RegisterProfile(const FBubbleCrowdProfile& Profile);
+
+	/** Spawns bubbles at random points within Spread of the location, dropped beyond bubble.CrowdMaxBubbles */
+	UFUNCTION(BlueprintCallable, Category = "Bubble Crowd")
+	void SpawnBubbles(int32 ProfileIndex, const FVector& Location, const FVector& Velocity, float Spread, int32 Count);
+
+	UFUNCTION(BlueprintCallable, Category = "Bubble Crowd")
+	int32 GetNumBubbles() const { return NumBubbles; }
+
+	const FBubbleCrowdProfile& GetProfile(int32 ProfileIndex) const { return Profiles[ProfileIndex]; }
+
+	/** False on dedicated servers and without a renderer, the render processor is skipped then */
+	bool IsRendering() const { return bRendering; }
+
+	/** Filled by the render processor, one array per profile */
+	TArray<FTransform>& GetRenderTransforms(int32 ProfileIndex) { return RenderTransforms[ProfileIndex]; }
+
+	/** Claims one of the promotions left this tick, false when the budget is spent */
+	bool TryPromote(const FBubbleCrowdPromotion& Promotion);
+
+	/** Called by the pop processor */
+	void OnBubblesRemoved(int32 Count) { NumBubbles -= Count; }
+
+	// FTickableGameObject
+	virtual void Tick(float DeltaTime) override;
+	virtual TStatId GetStatId() const override;
+
+private:
+	void SpawnPromotedBubbles();
+
+	void UpdateInstances();
+
+	UInstancedStaticMeshComponent* GetOrCreateBatch(int32 ProfileIndex);
+
+	UPROPERTY(Transient)
+	TArray<FBubbleCrowdProfile> Profiles;
+
+	/** Integration, collision, promotion, pop and render, in that order */
+	UPROPERTY(Transient)
+	TArray<TObjectPtr<UBubbleCrowdProcessor>> Processors;
+
+	UPROPERTY(Transient)
+	TObjectPtr<AActor> HostActor;
+
+	/** One instanced component per profile, created on first use */
+	UPROPERTY(Transient)
+	TArray<TObjectPtr<UInstancedStaticMeshComponent>> Batches;
+
+	UPROPERTY(Transient)
+	TObjectPtr<UStaticMesh> SphereMesh;
+
+	TArray<TArray<FTransform>> RenderTransforms;
+
+	TArray<FBubbleCrowdPromotion> Promotions;
+
+	int32 PromotionBudget = 0;
+
+	FMassArchetypeHandle Archetype;
+
+	int32 NumBubbles = 0;
+
+	bool bRendering = true;
+
+	FRandomStream Random;
+};
@@ -0,0 +1,161 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "BubbleFarFieldSubsystem.h"
+
+#include "Bubble.h"
+#include "Bubblegun.h"
+#include "BubbleScalabilitySettings.h"
+#include "BubbleSimulationSubsystem.h"
+#include "Components/HierarchicalInstancedStaticMeshComponent.h"
+#include "Engine/StaticMesh.h"
+#include "Engine/World.h"
+
+static TAutoConsoleVariable<bool> CVarBubbleFarField(
+	TEXT("bubble.FarField"),
+	true,
+	TEXT("Draw distant bubbles as instances of a shared sphere instead of their own dynamic meshes."),
+	ECVF_Default);
+
+static TAutoConsoleVariable<float> CVarBubbleFarFieldDistance(
+	TEXT("bubble.FarFieldDistance"),
+	6000.0f,
+	TEXT("Distance from the nearest viewer beyond which bubbles are drawn as instances. They switch back 10% closer."),
+	ECVF_Default);
+
+namespace
+{
+	/** Radius of the engine's basic sphere */
+	constexpr double UnitSphereRadius = 50.0;
+
+	/** Tint in 0-2, ratio of the longest to the shortest axis in 3 */
+	constexpr int32 NumCustomDataFloats = 4;
+}
+
+void UBubbleFarFieldSubsystem::RegisterBubble(ABubble* Bubble)
+{
+	Bubbles.Add(Bubble);
+}
+
+void UBubbleFarFieldSubsystem::UnregisterBubble(ABubble* Bubble)
+{
+	Bubbles.RemoveSwap(Bubble, EAllowShrinking::No);
+}
+
+UHierarchicalInstancedStaticMeshComponent* UBubbleFarFieldSubsystem::GetOrCreateBatch(UMaterialInterface* Material)
+{
+	if (TObjectPtr<UHierarchicalInstancedStaticMeshComponent>* Existing = Batches.Find(Material))
+	{
+		return *Existing;
+	}
+
+	if (!HostActor)
+	{
+		FActorSpawnParameters SpawnParams;
+		SpawnParams.ObjectFlags |= RF_Transient;
+		HostActor = GetWorld()->SpawnActor<AActor>(AActor::StaticClass(), FTransform::Identity, SpawnParams);
+
+		USceneComponent* Root = NewObject<USceneComponent>(HostActor, TEXT("Root"));
+		HostActor->SetRootComponent(Root);
+		Root->RegisterComponent();
+	}
+
+	UHierarchicalInstancedStaticMeshComponent* Component = NewObject<UHierarchicalInstancedStaticMeshComponent>(HostActor);
+	Component->SetMaterial(0, Material);
+	Component->SetNumCustomDataFloats(NumCustomDataFloats);
+	Component->SetCollisionEnabled(ECollisionEnabled::NoCollision);
+	Component->SetupAttachment(HostActor->GetRootComponent());
+	Component->RegisterComponent();
+	HostActor->AddInstanceComponent(Component);
+
+	Batches.Add(Material, Component);
+	return Component;
+}
+
+void UBubbleFarFieldSubsystem::Tick(float DeltaTime)
+{
+	LLM_SCOPE_BYTAG(BubbleMesh);
+
+	const UBubbleSimulationSubsystem* Simulation = GetWorld()->GetSubsystem<UBubbleSimulationSubsystem>();
+	EBubbleRenderPath RenderPath = UBubbleScalabilitySettings::GetActiveLevel().RenderPath;
+	bool bEnabled = CVarBubbleFarField.GetValueOnGameThread() && RenderPath != EBubbleRenderPath::DynamicMesh
+		&& Simulation && GetWorld()->GetNetMode() != NM_DedicatedServer;
+	double FarFieldDistance = RenderPath == EBubbleRenderPath::FarFieldAlways ? 0.0 : CVarBubbleFarFieldDistance.GetValueOnGameThread();
+
+	for (auto& [Component, Owners] : BatchBubbles)
+	{
+		Owners.Reset();
+	}
+
+	for (int32 i = Bubbles.Num() - 1; i >= 0; i--)
+	{
+		ABubble* Bubble = Bubbles[i].Get();
+		if (!IsValid(Bubble))
+		{
+			Bubbles.RemoveAtSwap(i, EAllowShrinking::No);
+			continue;
+		}
+
+		UMaterialInterface* Material = Bubble->FarFieldMaterial ? Bubble->FarFieldMaterial : Bubble->BubbleMaterial;
+		bool bFarField = false;
+		if (bEnabled && Material && Bubble->FarFieldMesh)
+		{
+			double Distance = Simulation->GetViewDistance(Bubble->GetActorLocation() + Bubble->CenterOfMass);
+			bFarField = Distance > FarFieldDistance * (Bubble->IsFarField() ? 0.9 : 1.0);
+		}
+		Bubble->SetFarField(bFarField);
+
+		if (bFarField)
+		{
+			UHierarchicalInstancedStaticMeshComponent* Component = GetOrCreateBatch(Material);
+			if (!Component->GetStaticMesh())
+			{
+				Component->SetStaticMesh(Bubble->FarFieldMesh);
+			}
+			BatchBubbles.FindOrAdd(Component).Add(Bubble);
+		}
+	}
+
+	TArray<float> CustomData;
+	for (const auto& [Material, Component] : Batches)
+	{
+		const TArray<ABubble*>* Owners = BatchBubbles.Find(Component);
+		int32 Count = Owners ? Owners->Num() : 0;
+
+		InstanceTransforms.Reset(Count);
+		CustomData.Reset(Count * NumCustomDataFloats);
+		for (int32 i = 0; i < Count; i++)
+		{
+			const ABubble* Bubble = (*Owners)[i];
+			FVector3d Extents = Bubble->GetFarFieldExtents();
+			InstanceTransforms.Emplace(Bubble->GetActorQuat(), Bubble->GetActorLocation() + Bubble->CenterOfMass, Extents / UnitSphereRadius);
+
+			FLinearColor Tint = Bubble->GetTint();
+			CustomData.Add(Tint.R);
+			CustomData.Add(Tint.G);
+			CustomData.Add(Tint.B);
+			CustomData.Add(Extents.GetMax() / FMath::Max(Extents.GetMin(), UE_DOUBLE_KINDA_SMALL_NUMBER));
+		}
+
+		// instance i always belongs to the i-th far bubble, only a change in count rebuilds the instances
+		if (Component->GetInstanceCount() != Count)
+		{
+			Component->ClearInstances();
+			Component->AddInstances(InstanceTransforms, false, true);
+		}
+		else if (Count > 0)
+		{
+			Component->BatchUpdateInstancesTransforms(0, InstanceTransforms, true, true);
+		}
+
+		for (int32 i = 0; i < Count; i++)
+		{
+			Component->SetCustomData(i, MakeArrayView(CustomData.GetData() + i * NumCustomDataFloats, NumCustomDataFloats), i == Count - 1);
+		}
+	}
+}
+
+TStatId UBubbleFarFieldSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UBubbleFarFieldSubsystem, STATGROUP_Tickables);
+}
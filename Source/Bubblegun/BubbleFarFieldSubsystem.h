@@ -0,0 +1,50 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "BubbleFarFieldSubsystem.generated.h"
+
+class ABubble;
+class UHierarchicalInstancedStaticMeshComponent;
+class UMaterialInterface;
+
+/**
+ * Draws distant bubbles as instances of one shared unit sphere per material instead of one dynamic
+ * mesh proxy each. Instance scale carries the squash and stretch of the simulated surface, custom
+ * data carries the tint. Bubbles switch back to their own dynamic mesh when a viewer comes close,
+ * with some hysteresis so they do not flicker at the threshold.
+ */
+UCLASS()
+class BUBBLEGUN_API UBubbleFarFieldSubsystem : public UTickableWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	void RegisterBubble(ABubble* Bubble);
+
+	void UnregisterBubble(ABubble* Bubble);
+
+	// FTickableGameObject
+	virtual void Tick(float DeltaTime) override;
+	virtual TStatId GetStatId() const override;
+
+private:
+	UHierarchicalInstancedStaticMeshComponent* GetOrCreateBatch(UMaterialInterface* Material);
+
+	TArray<TWeakObjectPtr<ABubble>> Bubbles;
+
+	/** Owns the instanced components, spawned on first use */
+	UPROPERTY(Transient)
+	TObjectPtr<AActor> HostActor;
+
+	/** One instanced component per far-field material */
+	UPROPERTY(Transient)
+	TMap<TObjectPtr<UMaterialInterface>, TObjectPtr<UHierarchicalInstancedStaticMeshComponent>> Batches;
+
+	/** Reused between ticks to avoid reallocating */
+	TMap<UHierarchicalInstancedStaticMeshComponent*, TArray<ABubble*>> BatchBubbles;
+
+	TArray<FTransform> InstanceTransforms;
+};
@@ -0,0 +1,260 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "BubbleForceFieldSubsystem.h"
+
+#include "Bubblegun.h"
+
+namespace
+{
+	/** Edge of one cell of the hash grid, about the size of a typical volume */
+	constexpr double CellSize = 1000.0;
+
+	/** Volumes spanning more cells than this go into every query instead */
+	constexpr int32 MaxCellsPerField = 512;
+}
+
+FVector3d FBubbleForceField::Evaluate(const FVector3d& Location) const
+{
+	return Transform.TransformVectorNoScale(EvaluateLocal(Transform.InverseTransformPosition(Location)));
+}
+
+FVector3d FBubbleForceField::EvaluateLocal(const FVector3d& Local) const
+{
+	// how far toward the edge the point is, 0 in the center and 1 on the boundary
+	double EdgeFraction = 0.0;
+	if (Shape == EBubbleForceFieldShape::Box)
+	{
+		FVector3d Normalized = Local.GetAbs() / Extent;
+		EdgeFraction = Normalized.GetMax();
+	}
+	else
+	{
+		EdgeFraction = FMath::Max(FMath::Sqrt(Local.X * Local.X + Local.Y * Local.Y) / Extent.X, FMath::Abs(Local.Z) / Extent.Z);
+	}
+	if (EdgeFraction > 1.0)
+	{
+		return FVector3d::ZeroVector;
+	}
+
+	FVector3d Acceleration;
+	switch (FieldType)
+	{
+	case EBubbleForceFieldType::Uniform:
+		Acceleration = Uniform;
+		break;
+	case EBubbleForceFieldType::Radial:
+		Acceleration = Local.GetSafeNormal() * Strength;
+		break;
+	case EBubbleForceFieldType::Vortex:
+		Acceleration = FVector3d(-Local.Y, Local.X, 0.0).GetSafeNormal() * Strength;
+		break;
+	case EBubbleForceFieldType::VectorGrid:
+	default:
+		Acceleration = SampleGrid(Local);
+		break;
+	}
+
+	if (bLinearFalloff && (FieldType == EBubbleForceFieldType::Radial || FieldType == EBubbleForceFieldType::Vortex))
+	{
+		Acceleration *= 1.0 - EdgeFraction;
+	}
+
+	return Acceleration;
+}
+
+void FBubbleForceField::AddForces(TConstArrayView<FBubbleForceField> Fields, const FVector3d& Offset, TConstArrayView<FVector3d> Positions, TArrayView<FVector3d> InOutForces)
+{
+	check(Positions.Num() == InOutForces.Num());
+
+	TArray<FVector3d> LocalPositions;
+	LocalPositions.SetNumUninitialized(Positions.Num());
+
+	// one field at a time over the whole batch, so the field data stays hot and the branches predictable
+	for (const FBubbleForceField& Field : Fields)
+	{
+		// the batch offset and the inverse of the field transform folded into one matrix, built once per field
+		const FMatrix44d WorldToLocal = FTranslationMatrix44d(Offset) * Field.Transform.ToInverseMatrixWithScale();
+		const FMatrix44d LocalToWorld = Field.Transform.ToMatrixNoScale();
+
+		for (int32 i = 0; i < Positions.Num(); i++)
+		{
+			LocalPositions[i] = WorldToLocal.TransformPosition(Positions[i]);
+		}
+
+		for (int32 i = 0; i < Positions.Num(); i++)
+		{
+			InOutForces[i] += LocalToWorld.TransformVector(Field.EvaluateLocal(LocalPositions[i]));
+		}
+	}
+}
+
+FVector3d FBubbleForceField::SampleGrid(const FVector3d& Local) const
+{
+	if (GridResolution.X < 2 || GridResolution.Y < 2 || GridResolution.Z < 2 || Grid.Num() != GridResolution.X * GridResolution.Y * GridResolution.Z)
+	{
+		return FVector3d::ZeroVector;
+	}
+
+	// the grid covers the bounding box of the shape
+	FVector3d BoxExtent = Shape == EBubbleForceFieldShape::Box ? Extent : FVector3d(Extent.X, Extent.X, Extent.Z);
+	FVector3d Cell = (Local + BoxExtent) / (2.0 * BoxExtent) * FVector3d(GridResolution - FIntVector(1));
+	int32 X = FMath::Clamp(FMath::FloorToInt32(Cell.X), 0, GridResolution.X - 2);
+	int32 Y = FMath::Clamp(FMath::FloorToInt32(Cell.Y), 0, GridResolution.Y - 2);
+	int32 Z = FMath::Clamp(FMath::FloorToInt32(Cell.Z), 0, GridResolution.Z - 2);
+	FVector3f F = FVector3f(FMath::Clamp(Cell - FVector3d(X, Y, Z), FVector3d::ZeroVector, FVector3d::OneVector));
+
+	auto At = [this](int32 I, int32 J, int32 K) { return Grid[I + GridResolution.X * (J + GridResolution.Y * K)]; };
+	FVector3f C00 = FMath::Lerp(At(X, Y, Z), At(X + 1, Y, Z), F.X);
+	FVector3f C10 = FMath::Lerp(At(X, Y + 1, Z), At(X + 1, Y + 1, Z), F.X);
+	FVector3f C01 = FMath::Lerp(At(X, Y, Z + 1), At(X + 1, Y, Z + 1), F.X);
+	FVector3f C11 = FMath::Lerp(At(X, Y + 1, Z + 1), At(X + 1, Y + 1, Z + 1), F.X);
+	return FVector3d(FMath::Lerp(FMath::Lerp(C00, C10, F.Y), FMath::Lerp(C01, C11, F.Y), F.Z));
+}
+
+void UBubbleForceFieldSubsystem::RegisterVolume(const ABubbleForceFieldVolume* Volume)
+{
+	LLM_SCOPE_BYTAG(BubbleSimulation);
+
+	FBubbleForceField* Field = Fields.FindByPredicate([Volume](const FBubbleForceField& Existing) { return Existing.Volume.Get() == Volume; });
+	if (!Field)
+	{
+		Field = &Fields.AddDefaulted_GetRef();
+		Field->Volume = Volume;
+	}
+
+	Field->Transform = Volume->GetActorTransform();
+	Field->Shape = Volume->Shape;
+	Field->FieldType = Volume->FieldType;
+	Field->Extent = Volume->Extent.ComponentMax(FVector(1.0));
+	Field->Strength = Volume->Strength;
+	Field->Uniform = Volume->Direction.GetSafeNormal() * Volume->Strength;
+	Field->bLinearFalloff = Volume->bLinearFalloff;
+	Field->GridResolution = Volume->GridResolution;
+	Field->Grid.Reset(Volume->GridVectors.Num());
+	for (const FVector& Vector : Volume->GridVectors)
+	{
+		Field->Grid.Add(FVector3f(Vector * Volume->Strength));
+	}
+	Field->bAffectsBubbles = Volume->bAffectsBubbles;
+	Field->bAffectsCharacters = Volume->bAffectsCharacters;
+	Field->CharacterScale = Volume->CharacterScale;
+
+	FVector3d BoxExtent = Field->Shape == EBubbleForceFieldShape::Box ? Field->Extent : FVector3d(Field->Extent.X, Field->Extent.X, Field->Extent.Z);
+	Field->Bounds = FBox(-BoxExtent, BoxExtent).TransformBy(Field->Transform);
+
+	RebuildIndex();
+}
+
+void UBubbleForceFieldSubsystem::UnregisterVolume(const ABubbleForceFieldVolume* Volume)
+{
+	if (Fields.RemoveAll([Volume](const FBubbleForceField& Existing) { return Existing.Volume.Get() == Volume; }) > 0)
+	{
+		RebuildIndex();
+	}
+}
+
+FIntVector UBubbleForceFieldSubsystem::GetCell(const FVector& Location) const
+{
+	return FIntVector(
+		FMath::FloorToInt32(Location.X / CellSize),
+		FMath::FloorToInt32(Location.Y / CellSize),
+		FMath::FloorToInt32(Location.Z / CellSize));
+}
+
+void UBubbleForceFieldSubsystem::RebuildIndex()
+{
+	Cells.Reset();
+	for (int32 i = 0; i < Fields.Num(); i++)
+	{
+		FIntVector Min = GetCell(Fields[i].Bounds.Min);
+		FIntVector Max = GetCell(Fields[i].Bounds.Max);
+		FIntVector Size = Max - Min + FIntVector(1);
+		if ((int64)Size.X * Size.Y * Size.Z > MaxCellsPerField)
+		{
+			// huge volumes live in a reserved cell that every query visits
+			Cells.FindOrAdd(FIntVector(MAX_int32)).Add(i);
+			continue;
+		}
+
+		for (int32 Z = Min.Z; Z <= Max.Z; Z++)
+		{
+			for (int32 Y = Min.Y; Y <= Max.Y; Y++)
+			{
+				for (int32 X = Min.X; X <= Max.X; X++)
+				{
+					Cells.FindOrAdd(FIntVector(X, Y, Z)).Add(i);
+				}
+			}
+		}
+	}
+}
+
+void UBubbleForceFieldSubsystem::GatherFields(const FBox& Bounds, TArray<int32, TInlineAllocator<8>>& OutFields) const
+{
+	OutFields.Reset();
+	if (Fields.IsEmpty())
+	{
+		return;
+	}
+
+	auto AddCell = [&](const FIntVector& Cell)
+	{
+		if (const TArray<int32>* CellFields = Cells.Find(Cell))
+		{
+			for (int32 FieldIndex : *CellFields)
+			{
+				if (Fields[FieldIndex].Bounds.Intersect(Bounds))
+				{
+					OutFields.AddUnique(FieldIndex);
+				}
+			}
+		}
+	};
+
+	AddCell(FIntVector(MAX_int32));
+	FIntVector Min = GetCell(Bounds.Min);
+	FIntVector Max = GetCell(Bounds.Max);
+	for (int32 Z = Min.Z; Z <= Max.Z; Z++)
+	{
+		for (int32 Y = Min.Y; Y <= Max.Y; Y++)
+		{
+			for (int32 X = Min.X; X <= Max.X; X++)
+			{
+				AddCell(FIntVector(X, Y, Z));
+			}
+		}
+	}
+}
+
+void UBubbleForceFieldSubsystem::GetBubbleFields(const FBox& Bounds, TArray<FBubbleForceField>& OutFields) const
+{
+	OutFields.Reset();
+
+	TArray<int32, TInlineAllocator<8>> Overlapping;
+	GatherFields(Bounds, Overlapping);
+	for (int32 FieldIndex : Overlapping)
+	{
+		if (Fields[FieldIndex].bAffectsBubbles)
+		{
+			OutFields.Add(Fields[FieldIndex]);
+		}
+	}
+}
+
+FVector3d UBubbleForceFieldSubsystem::GetCharacterAcceleration(const FVector3d& Location) const
+{
+	TArray<int32, TInlineAllocator<8>> Overlapping;
+	GatherFields(FBox(Location, Location), Overlapping);
+
+	FVector3d Acceleration = FVector3d::ZeroVector;
+	for (int32 FieldIndex : Overlapping)
+	{
+		const FBubbleForceField& Field = Fields[FieldIndex];
+		if (Field.bAffectsCharacters)
+		{
+			Acceleration += Field.Evaluate(Location) * Field.CharacterScale;
+		}
+	}
+	return Acceleration;
+}
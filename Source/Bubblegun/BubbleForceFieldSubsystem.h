@@ -0,0 +1,90 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "BubbleForceFieldVolume.h"
+#include "BubbleForceFieldSubsystem.generated.h"
+
+/** Snapshot of a force field volume, evaluated without touching the actor */
+struct FBubbleForceField
+{
+	TWeakObjectPtr<const ABubbleForceFieldVolume> Volume;
+
+	FTransform Transform;
+
+	FBox Bounds;
+
+	EBubbleForceFieldShape Shape = EBubbleForceFieldShape::Box;
+
+	EBubbleForceFieldType FieldType = EBubbleForceFieldType::Uniform;
+
+	FVector3d Extent = FVector3d::ZeroVector;
+
+	/** Strength times the normalized direction for uniform fields */
+	FVector3d Uniform = FVector3d::ZeroVector;
+
+	double Strength = 0.0;
+
+	bool bLinearFalloff = true;
+
+	FIntVector GridResolution = FIntVector::ZeroValue;
+
+	/** Already scaled by Strength */
+	TArray<FVector3f> Grid;
+
+	bool bAffectsBubbles = true;
+
+	bool bAffectsCharacters = true;
+
+	double CharacterScale = 1.0;
+
+	/** World-space acceleration at a world location, zero outside the volume */
+	FVector3d Evaluate(const FVector3d& Location) const;
+
+	/** Adds the accelerations of all fields at Offset + Positions[i] to InOutForces[i] */
+	static void AddForces(TConstArrayView<FBubbleForceField> Fields, const FVector3d& Offset, TConstArrayView<FVector3d> Positions, TArrayView<FVector3d> InOutForces);
+
+private:
+	/** Acceleration in the space of the volume at a point in that space, zero outside the volume */
+	FVector3d EvaluateLocal(const FVector3d& Local) const;
+
+	FVector3d SampleGrid(const FVector3d& Local) const;
+};
+
+/**
+ * Registry of force field volumes with a uniform hash grid over their bounds. Bubbles copy the
+ * fields around them on the game thread and run each one over all their vertices at once in the
+ * solve; characters query a single point from their movement component.
+ */
+UCLASS()
+class BUBBLEGUN_API UBubbleForceFieldSubsystem : public UWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	/** Adds the volume, or replaces its snapshot if it is already registered */
+	void RegisterVolume(const ABubbleForceFieldVolume* Volume);
+
+	void UnregisterVolume(const ABubbleForceFieldVolume* Volume);
+
+	/** Copies the fields affecting bubbles that overlap Bounds, so a solve off the game thread can evaluate them */
+	void GetBubbleFields(const FBox& Bounds, TArray<FBubbleForceField>& OutFields) const;
+
+	/** Sum of the character accelerations of all fields at a location */
+	FVector3d GetCharacterAcceleration(const FVector3d& Location) const;
+
+	bool HasFields() const { return !Fields.IsEmpty(); }
+
+private:
+	void RebuildIndex();
+
+	void GatherFields(const FBox& Bounds, TArray<int32, TInlineAllocator<8>>& OutFields) const;
+
+	FIntVector GetCell(const FVector& Location) const;
+
+	TArray<FBubbleForceField> Fields;
+
+	TMap<FIntVector, TArray<int32>> Cells;
+};
@@ -0,0 +1,51 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "BubbleForceFieldVolume.h"
+
+#include "BubbleForceFieldSubsystem.h"
+#include "Components/BoxComponent.h"
+
+ABubbleForceFieldVolume::ABubbleForceFieldVolume()
+{
+	PrimaryActorTick.bCanEverTick = false;
+
+	BoundsComponent = CreateDefaultSubobject<UBoxComponent>(TEXT("Bounds"));
+	BoundsComponent->SetCollisionEnabled(ECollisionEnabled::NoCollision);
+	BoundsComponent->SetHiddenInGame(true);
+	BoundsComponent->SetCanEverAffectNavigation(false);
+	RootComponent = BoundsComponent;
+}
+
+void ABubbleForceFieldVolume::OnConstruction(const FTransform& Transform)
+{
+	Super::OnConstruction(Transform);
+
+	FVector BoxExtent = Shape == EBubbleForceFieldShape::Box ? Extent : FVector(Extent.X, Extent.X, Extent.Z);
+	BoundsComponent->SetBoxExtent(BoxExtent, false);
+}
+
+void ABubbleForceFieldVolume::BeginPlay()
+{
+	Super::BeginPlay();
+
+	RefreshForceField();
+}
+
+void ABubbleForceFieldVolume::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	if (UBubbleForceFieldSubsystem* Subsystem = GetWorld()->GetSubsystem<UBubbleForceFieldSubsystem>())
+	{
+		Subsystem->UnregisterVolume(this);
+	}
+
+	Super::EndPlay(EndPlayReason);
+}
+
+void ABubbleForceFieldVolume::RefreshForceField()
+{
+	if (UBubbleForceFieldSubsystem* Subsystem = GetWorld()->GetSubsystem<UBubbleForceFieldSubsystem>())
+	{
+		Subsystem->RegisterVolume(this);
+	}
+}
@@ -0,0 +1,103 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "GameFramework/Actor.h"
+#include "BubbleForceFieldVolume.generated.h"
+
+class UBoxComponent;
+
+UENUM(BlueprintType)
+enum class EBubbleForceFieldShape : uint8
+{
+	Box,
+
+	/** Around the local Z axis */
+	Cylinder,
+};
+
+UENUM(BlueprintType)
+enum class EBubbleForceFieldType : uint8
+{
+	/** Same acceleration everywhere, along Direction */
+	Uniform,
+
+	/** Away from the center, or toward it with a negative strength */
+	Radial,
+
+	/** Around the local Z axis, counterclockwise for a positive strength */
+	Vortex,
+
+	/** Trilinear interpolation of GridVectors over the bounding box of the volume */
+	VectorGrid,
+};
+
+/**
+ * Volume applying an acceleration field to bubble vertices and characters. Fields are evaluated
+ * in batches by UBubbleForceFieldSubsystem, the volume itself does not tick or receive overlaps.
+ * Call RefreshForceField after moving or editing a volume at runtime.
+ */
+UCLASS()
+class BUBBLEGUN_API ABubbleForceFieldVolume : public AActor
+{
+	GENERATED_BODY()
+
+public:
+	ABubbleForceFieldVolume();
+
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Force Field")
+	EBubbleForceFieldShape Shape = EBubbleForceFieldShape::Box;
+
+	/** Half size of the box, or radius in X and half height in Z of the cylinder */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Force Field")
+	FVector Extent = FVector(200.0);
+
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Force Field")
+	EBubbleForceFieldType FieldType = EBubbleForceFieldType::Uniform;
+
+	/** Acceleration in cm/s^2 */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Force Field")
+	float Strength = 1000.0f;
+
+	/** Local direction of a uniform field */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Force Field", meta = (EditCondition = "FieldType == EBubbleForceFieldType::Uniform"))
+	FVector Direction = FVector::UpVector;
+
+	/** Radial and vortex fields fade out linearly toward the edge of the volume */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Force Field")
+	bool bLinearFalloff = true;
+
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Force Field", meta = (EditCondition = "FieldType == EBubbleForceFieldType::VectorGrid"))
+	FIntVector GridResolution = FIntVector(2, 2, 2);
+
+	/** Local vectors scaled by Strength, X fastest, GridResolution samples per axis */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Force Field", meta = (EditCondition = "FieldType == EBubbleForceFieldType::VectorGrid"))
+	TArray<FVector> GridVectors;
+
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Force Field")
+	bool bAffectsBubbles = true;
+
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Force Field")
+	bool bAffectsCharacters = true;
+
+	/** Multiplier of the acceleration applied to characters */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Force Field", meta = (EditCondition = "bAffectsCharacters"))
+	float CharacterScale = 1.0f;
+
+	/** Re-registers the field after the volume moved or its properties changed */
+	UFUNCTION(BlueprintCallable, Category = "Force Field")
+	void RefreshForceField();
+
+	virtual void OnConstruction(const FTransform& Transform) override;
+
+protected:
+	virtual void BeginPlay() override;
+
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+
+private:
+	/** Shows the bounds of the volume in the editor, no collision */
+	UPROPERTY(VisibleAnywhere, Category = "Force Field")
+	UBoxComponent* BoundsComponent;
+};
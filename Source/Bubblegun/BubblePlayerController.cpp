@@ -3,3 +3,205 @@
 
 #include "BubblePlayerController.h"
 
+#include "EnhancedInputComponent.h"
+#include "EnhancedPlayerInput.h"
+#include "InputAction.h"
+#include "Kismet/GameplayStatics.h"
+#include "Misc/CommandLine.h"
+#include "Misc/Paths.h"
+
+namespace
+{
+	/** Relative paths on the command line are under Saved/BubbleBenchmarks */
+	FString GetBenchmarkPath(const FString& Name)
+	{
+		return FPaths::IsRelative(Name) ? FPaths::Combine(FPaths::ProjectSavedDir(), TEXT("BubbleBenchmarks"), Name) : Name;
+	}
+}
+
+void ABubblePlayerController::BubbleStopInputRecording()
+{
+	if (!bRecordingInput)
+	{
+		return;
+	}
+	bRecordingInput = false;
+	Recording.Save(RecordingPath);
+}
+
+void ABubblePlayerController::BeginPlay()
+{
+	Super::BeginPlay();
+
+	if (!IsLocalPlayerController())
+	{
+		return;
+	}
+
+	FString Name;
+	if (FParse::Value(FCommandLine::Get(), TEXT("BubbleBenchmark="), Name))
+	{
+		RecordingPath = GetBenchmarkPath(Name);
+		if (!Recording.Load(RecordingPath))
+		{
+			return;
+		}
+
+		const FString MapName = UGameplayStatics::GetCurrentLevelName(this);
+		if (Recording.MapName != MapName)
+		{
+			UE_LOG(LogTemp, Warning, TEXT("Input recording %s was made on %s, not %s"), *RecordingPath, *Recording.MapName, *MapName);
+		}
+
+		for (const FSoftObjectPath& Path : Recording.Actions)
+		{
+			// Missing actions stay null and their inputs are skipped
+			Actions.Add(Cast<UInputAction>(Path.TryLoad()));
+		}
+
+		Recording.ApplyDeterminism();
+		bBenchmarking = true;
+		BenchmarkFrame = 0;
+		BenchmarkStats = MakeUnique<FBubbleBenchmarkStats>(GetWorld());
+	}
+	else if (FParse::Value(FCommandLine::Get(), TEXT("BubbleRecordInput="), Name))
+	{
+		RecordingPath = GetBenchmarkPath(Name);
+		Recording.Reset();
+		Recording.MapName = UGameplayStatics::GetCurrentLevelName(this);
+		Recording.RandomSeed = int32(FPlatformTime::Cycles());
+		Recording.FrameStarts.Add(0);
+		Recording.ApplyDeterminism();
+		bRecordingInput = true;
+	}
+}
+
+void ABubblePlayerController::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	BubbleStopInputRecording();
+	if (bBenchmarking)
+	{
+		FinishBenchmark();
+	}
+
+	Super::EndPlay(EndPlayReason);
+}
+
+void ABubblePlayerController::PlayerTick(float DeltaTime)
+{
+	if (bBenchmarking)
+	{
+		if (BenchmarkFrame > 0)
+		{
+			BenchmarkStats->EndFrame();
+		}
+
+		if (BenchmarkFrame >= Recording.GetNumFrames())
+		{
+			FinishBenchmark();
+		}
+		else if (UEnhancedPlayerInput* EnhancedInput = GetEnhancedInput())
+		{
+			// Injected inputs are processed with the next input of this tick, so frame i gets the inputs it was recorded with
+			for (int32 Index = Recording.FrameStarts[BenchmarkFrame]; Index < Recording.FrameStarts[BenchmarkFrame + 1]; ++Index)
+			{
+				const FBubbleRecordedInput& Input = Recording.Inputs[Index];
+				const UInputAction* Action = Actions.IsValidIndex(Input.ActionIndex) ? Actions[Input.ActionIndex].Get() : nullptr;
+				if (Action)
+				{
+					EnhancedInput->InjectInputForAction(Action, FInputActionValue(Action->ValueType, FVector(Input.Value)));
+				}
+			}
+			++BenchmarkFrame;
+		}
+	}
+
+	Super::PlayerTick(DeltaTime);
+}
+
+void ABubblePlayerController::PostProcessInput(const float DeltaTime, const bool bGamePaused)
+{
+	Super::PostProcessInput(DeltaTime, bGamePaused);
+
+	if (!bRecordingInput)
+	{
+		return;
+	}
+
+	UEnhancedPlayerInput* EnhancedInput = GetEnhancedInput();
+	if (!EnhancedInput)
+	{
+		return;
+	}
+
+	// Weapons bind their actions when they are picked up, so new actions are looked for every frame
+	GatherActions();
+
+	for (int32 ActionIndex = 0; ActionIndex < Actions.Num(); ++ActionIndex)
+	{
+		const FVector Value = EnhancedInput->GetActionValue(Actions[ActionIndex]).Get<FVector>();
+		if (!Value.IsZero())
+		{
+			FBubbleRecordedInput& Input = Recording.Inputs.AddDefaulted_GetRef();
+			Input.ActionIndex = uint16(ActionIndex);
+			Input.Value = FVector3f(Value);
+		}
+	}
+	Recording.FrameStarts.Add(Recording.Inputs.Num());
+}
+
+UEnhancedPlayerInput* ABubblePlayerController::GetEnhancedInput() const
+{
+	return Cast<UEnhancedPlayerInput>(PlayerInput);
+}
+
+void ABubblePlayerController::GatherActions()
+{
+	auto AddBindings = [this](const UInputComponent* Component)
+	{
+		const UEnhancedInputComponent* EnhancedComponent = Cast<UEnhancedInputComponent>(Component);
+		if (!EnhancedComponent)
+		{
+			return;
+		}
+		for (const TUniquePtr<FEnhancedInputActionEventBinding>& Binding : EnhancedComponent->GetActionEventBindings())
+		{
+			const UInputAction* Action = Binding->GetAction();
+			if (Action && !Actions.Contains(Action) && Actions.Num() <= MAX_uint16)
+			{
+				Actions.Add(Action);
+				Recording.Actions.Add(FSoftObjectPath(Action));
+			}
+		}
+	};
+
+	// The pawn binds movement on its own input component and weapons bind on the controller's
+	AddBindings(InputComponent);
+	if (APawn* ControlledPawn = GetPawn())
+	{
+		AddBindings(ControlledPawn->InputComponent);
+	}
+	for (const TWeakObjectPtr<UInputComponent>& Component : CurrentInputStack)
+	{
+		AddBindings(Component.Get());
+	}
+}
+
+void ABubblePlayerController::FinishBenchmark()
+{
+	if (!bBenchmarking)
+	{
+		return;
+	}
+	bBenchmarking = false;
+
+	const FString ReportPath = FPaths::ChangeExtension(RecordingPath, TEXT("csv"));
+	BenchmarkStats->Report(ReportPath);
+	BenchmarkStats.Reset();
+	UE_LOG(LogTemp, Log, TEXT("Bubble benchmark %s finished after %d frames, report in %s"), *RecordingPath, BenchmarkFrame, *ReportPath);
+
+	if (!GIsEditor)
+	{
+		FPlatformMisc::RequestExit(false, TEXT("BubbleBenchmark"));
+	}
+}
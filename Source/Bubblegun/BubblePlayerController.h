@@ -3,15 +3,57 @@
 #pragma once
 
 #include "CoreMinimal.h"
+#include "BubbleBenchmark.h"
 #include "GameFramework/PlayerController.h"
 #include "BubblePlayerController.generated.h"
 
+class UEnhancedPlayerInput;
+class UInputAction;
+
 /**
- * 
+ * Player controller that can record the Enhanced Input actions of its player and play them back
+ * as a scripted benchmark. Start the game with -BubbleRecordInput=<file> to record until the map
+ * ends or BubbleStopInputRecording is run, and with -BubbleBenchmark=<file> to replay a recording
+ * on the same map, e.g. headless with -nullrhi, which reports the frame times, game thread and
+ * physics times and spawned actors when the recording ends and then exits.
  */
 UCLASS()
 class BUBBLEGUN_API ABubblePlayerController : public APlayerController
 {
 	GENERATED_BODY()
-	
+
+public:
+	/** Ends an input recording started from the command line and writes it */
+	UFUNCTION(Exec)
+	void BubbleStopInputRecording();
+
+protected:
+	virtual void BeginPlay() override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+	virtual void PlayerTick(float DeltaTime) override;
+	virtual void PostProcessInput(const float DeltaTime, const bool bGamePaused) override;
+
+private:
+	UEnhancedPlayerInput* GetEnhancedInput() const;
+
+	/** Adds the actions bound on the input stack that are not in Actions yet, so indices of a recording stay stable */
+	void GatherActions();
+
+	void FinishBenchmark();
+
+	/** Actions of the recording by index */
+	UPROPERTY(Transient)
+	TArray<TObjectPtr<const UInputAction>> Actions;
+
+	FBubbleInputRecording Recording;
+
+	FString RecordingPath;
+
+	bool bRecordingInput = false;
+
+	bool bBenchmarking = false;
+
+	int32 BenchmarkFrame = 0;
+
+	TUniquePtr<FBubbleBenchmarkStats> BenchmarkStats;
 };
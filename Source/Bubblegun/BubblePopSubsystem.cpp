@@ -0,0 +1,290 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "BubblePopSubsystem.h"
+
+#include "Bubble.h"
+#include "Engine/OverlapResult.h"
+#include "Engine/World.h"
+#include "GameFramework/Character.h"
+#include "GameFramework/CharacterMovementComponent.h"
+#include "Kismet/GameplayStatics.h"
+#include "Sound/SoundBase.h"
+
+static TAutoConsoleVariable<int32> CVarBubbleMaxChainPopsPerFrame(
+	TEXT("bubble.MaxChainPopsPerFrame"),
+	8,
+	TEXT("Maximum number of chain-reaction bubble pops processed in one frame, the rest wait for the next frame."),
+	ECVF_Default);
+
+static TAutoConsoleVariable<float> CVarBubblePopAudioClusterSize(
+	TEXT("bubble.PopAudioClusterSize"),
+	500.0f,
+	TEXT("Pops of one frame with the same sound within a grid cell of this size play as a single voice."),
+	ECVF_Default);
+
+static TAutoConsoleVariable<int32> CVarBubblePopAudioMaxVoices(
+	TEXT("bubble.PopAudioMaxVoices"),
+	6,
+	TEXT("Pop voices playing at once at most, clusters beyond it are dropped, quietest first."),
+	ECVF_Default);
+
+namespace
+{
+	/** Pop of a bubble this large plays at unit volume and pitch */
+	constexpr double ReferencePopRadius = 100.0;
+
+	/** Voices of looping or unknown length count against the budget this long */
+	constexpr double MaxPopVoiceDuration = 2.0;
+}
+
+double UBubblePopSubsystem::GetImpulseScale(const ABubble* Bubble)
+{
+	return GetImpulseScale(Bubble->ActualRadius, Bubble->PopForceBase);
+}
+
+double UBubblePopSubsystem::GetImpulseScale(double ActualRadius, double PopForceBase)
+{
+	double PopForce = FMath::Max(0.0, FMath::Pow(ActualRadius - 30, 2.5));
+	return PopForce * PopForceBase;
+}
+
+double UBubblePopSubsystem::GetImpulse(double ImpulseScale, double ShockwaveRadius, double Distance)
+{
+	if (ShockwaveRadius <= 0)
+	{
+		return 0.0;
+	}
+	return FMath::Max(0.0, ImpulseScale * (1.0 / FMath::Max(Distance, 1.0) - 1.0 / ShockwaveRadius));
+}
+
+bool UBubblePopSubsystem::ReachesChainPop(double ImpulseScale, double ShockwaveRadius, double PoppedRadius, double ChainPopReach, double Distance, double Threshold)
+{
+	return Distance <= PoppedRadius * ChainPopReach && GetImpulse(ImpulseScale, ShockwaveRadius, Distance) >= Threshold;
+}
+
+double UBubblePopSubsystem::GetShockwaveRadius(const ABubble* Bubble)
+{
+	return GetShockwaveRadius(GetImpulseScale(Bubble), Bubble->PopImpulseEpsilon, Bubble->PopMaxRadius);
+}
+
+double UBubblePopSubsystem::GetShockwaveRadius(double ImpulseScale, double Epsilon, double MaxRadius)
+{
+	return FMath::Min(ImpulseScale / FMath::Max(Epsilon, UE_DOUBLE_SMALL_NUMBER), MaxRadius);
+}
+
+void UBubblePopSubsystem::EmitShockwave(ABubble* Bubble)
+{
+	double ImpulseScale = GetImpulseScale(Bubble);
+	double Radius = GetShockwaveRadius(Bubble);
+	if (ImpulseScale <= 0 || Radius <= 0)
+	{
+		return;
+	}
+
+	FVector Center = Bubble->GetActorLocation() + Bubble->CenterOfMass;
+
+	FCollisionQueryParams QueryParams(SCENE_QUERY_STAT(BubblePop), false, Bubble);
+	TArray<FOverlapResult> Overlaps;
+	GetWorld()->OverlapMultiByObjectType(Overlaps, Center, FQuat::Identity, FCollisionObjectQueryParams::AllDynamicObjects, FCollisionShape::MakeSphere(Radius), QueryParams);
+
+	TSet<AActor*> VisitedActors;
+	for (const FOverlapResult& Overlap : Overlaps)
+	{
+		AActor* Actor = Overlap.GetActor();
+		if (!IsValid(Actor) || Actor == Bubble)
+		{
+			continue;
+		}
+
+		if (ACharacter* Character = Cast<ACharacter>(Actor))
+		{
+			bool bAlreadyVisited = false;
+			VisitedActors.Add(Actor, &bAlreadyVisited);
+			if (bAlreadyVisited)
+			{
+				continue;
+			}
+
+			FVector Offset = Character->GetActorLocation() - Center;
+			CharacterImpulses.FindOrAdd(Character) += Offset.GetSafeNormal() * GetImpulse(ImpulseScale, Radius, Offset.Size());
+		}
+		else if (ABubble* OtherBubble = Cast<ABubble>(Actor))
+		{
+			bool bAlreadyVisited = false;
+			VisitedActors.Add(Actor, &bAlreadyVisited);
+			if (bAlreadyVisited || !OtherBubble->bCanChainPop || OtherBubble->IsPopping())
+			{
+				continue;
+			}
+
+			double Distance = (OtherBubble->GetActorLocation() + OtherBubble->CenterOfMass - Center).Size() - OtherBubble->ActualRadius;
+			if (ReachesChainPop(ImpulseScale, Radius, Bubble->ActualRadius, Bubble->ChainPopReach, Distance, OtherBubble->ChainPopImpulseThreshold))
+			{
+				QueuePop(OtherBubble);
+			}
+		}
+		else
+		{
+			UPrimitiveComponent* Primitive = Overlap.GetComponent();
+			if (!Primitive || !Primitive->IsSimulatingPhysics())
+			{
+				continue;
+			}
+
+			FVector ClosestPoint;
+			double Distance = Primitive->GetClosestPointOnCollision(Center, ClosestPoint);
+			if (Distance <= 0)
+			{
+				// inside the collision or no distance support for the shape
+				ClosestPoint = Primitive->Bounds.Origin;
+			}
+			FVector Offset = ClosestPoint - Center;
+			FVector Impulse = Offset.GetSafeNormal() * GetImpulse(ImpulseScale, Radius, Offset.Size());
+			if (Impulse.IsZero())
+			{
+				continue;
+			}
+
+			FPrimitiveImpulse& Pending = PrimitiveImpulses.FindOrAdd(Primitive);
+			double Weight = Impulse.Size();
+			Pending.Impulse += Impulse;
+			Pending.WeightedLocation += ClosestPoint * Weight;
+			Pending.Weight += Weight;
+		}
+	}
+}
+
+void UBubblePopSubsystem::QueuePop(ABubble* Bubble)
+{
+	if (Bubble->IsPopping())
+	{
+		return;
+	}
+
+	Bubble->MarkPopPending();
+	PopQueue.Add(Bubble);
+}
+
+void UBubblePopSubsystem::AddPopSound(USoundBase* Sound, const FVector& Location, double Radius)
+{
+	if (!Sound)
+	{
+		return;
+	}
+
+	double CellSize = FMath::Max(CVarBubblePopAudioClusterSize.GetValueOnGameThread(), 1.0f);
+	FIntVector Cell(
+		FMath::FloorToInt32(Location.X / CellSize),
+		FMath::FloorToInt32(Location.Y / CellSize),
+		FMath::FloorToInt32(Location.Z / CellSize));
+
+	FPopSoundCluster& Cluster = PopSounds.FindOrAdd({ Sound, Cell });
+	double Weight = FMath::Max(Radius, 1.0);
+	Cluster.Sound = Sound;
+	Cluster.WeightedLocation += Location * Weight;
+	Cluster.RadiusSum += Weight;
+	Cluster.MaxRadius = FMath::Max(Cluster.MaxRadius, Weight);
+	Cluster.Count++;
+}
+
+void UBubblePopSubsystem::Tick(float DeltaTime)
+{
+	// bubbles queued by the pops below wait for the next frame
+	int32 Budget = FMath::Min(CVarBubbleMaxChainPopsPerFrame.GetValueOnGameThread(), PopQueue.Num());
+	TArray<TWeakObjectPtr<ABubble>> ToPop(PopQueue.GetData(), Budget);
+	PopQueue.RemoveAt(0, Budget, EAllowShrinking::No);
+
+	for (const TWeakObjectPtr<ABubble>& Bubble : ToPop)
+	{
+		if (Bubble.IsValid())
+		{
+			Bubble->Pop();
+		}
+	}
+
+	FlushImpulses();
+	FlushPopSounds();
+}
+
+void UBubblePopSubsystem::FlushImpulses()
+{
+	for (const auto& [Character, Impulse] : CharacterImpulses)
+	{
+		if (Character.IsValid())
+		{
+			Character->GetCharacterMovement()->AddImpulse(Impulse, true);
+		}
+	}
+	CharacterImpulses.Reset();
+
+	for (const auto& [Primitive, Pending] : PrimitiveImpulses)
+	{
+		if (Primitive.IsValid() && Pending.Weight > 0)
+		{
+			Primitive->AddImpulseAtLocation(Pending.Impulse, Pending.WeightedLocation / Pending.Weight);
+		}
+	}
+	PrimitiveImpulses.Reset();
+}
+
+void UBubblePopSubsystem::FlushPopSounds()
+{
+	double Now = GetWorld()->GetAudioTimeSeconds();
+	VoiceEndTimes.RemoveAllSwap([Now](double EndTime) { return EndTime <= Now; }, EAllowShrinking::No);
+	if (PopSounds.IsEmpty())
+	{
+		return;
+	}
+
+	struct FPopVoice
+	{
+		USoundBase* Sound = nullptr;
+		FVector Location = FVector::ZeroVector;
+		float Volume = 1.0f;
+		float Pitch = 1.0f;
+	};
+
+	TArray<FPopVoice, TInlineAllocator<16>> Voices;
+	for (const auto& [Key, Cluster] : PopSounds)
+	{
+		USoundBase* Sound = Cluster.Sound.Get();
+		if (!Sound)
+		{
+			continue;
+		}
+
+		// every doubling of the pops in a cluster adds a quarter of the volume and lowers the pitch a little,
+		// larger bubbles pop louder and deeper
+		double Layers = FMath::Log2(double(Cluster.Count));
+		double AverageRadius = Cluster.RadiusSum / Cluster.Count;
+
+		FPopVoice& Voice = Voices.AddDefaulted_GetRef();
+		Voice.Sound = Sound;
+		Voice.Location = Cluster.WeightedLocation / Cluster.RadiusSum;
+		Voice.Volume = FMath::Clamp(FMath::Sqrt(Cluster.MaxRadius / ReferencePopRadius) * (1.0 + 0.25 * Layers), 0.2, 2.0);
+		Voice.Pitch = FMath::Clamp(FMath::Pow(ReferencePopRadius / AverageRadius, 0.25) / (1.0 + 0.05 * Layers), 0.5, 2.0);
+	}
+	PopSounds.Reset();
+
+	int32 FreeVoices = CVarBubblePopAudioMaxVoices.GetValueOnGameThread() - VoiceEndTimes.Num();
+	if (Voices.Num() > FreeVoices)
+	{
+		Voices.Sort([](const FPopVoice& A, const FPopVoice& B) { return A.Volume > B.Volume; });
+	}
+
+	for (int32 i = 0; i < FMath::Min(Voices.Num(), FreeVoices); i++)
+	{
+		const FPopVoice& Voice = Voices[i];
+		UGameplayStatics::PlaySoundAtLocation(this, Voice.Sound, Voice.Location, Voice.Volume, Voice.Pitch);
+
+		float Duration = Voice.Sound->GetDuration();
+		Duration = Duration > 0.0f && Duration < MaxPopVoiceDuration ? Duration / Voice.Pitch : MaxPopVoiceDuration;
+		VoiceEndTimes.Add(Now + Duration);
+	}
+}
+
+TStatId UBubblePopSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UBubblePopSubsystem, STATGROUP_Tickables);
+}
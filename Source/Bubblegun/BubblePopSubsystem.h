@@ -0,0 +1,104 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "BubblePopSubsystem.generated.h"
+
+class ABubble;
+class ACharacter;
+class UPrimitiveComponent;
+class USoundBase;
+
+/**
+ * Runs the shockwave of popping bubbles. Each pop does a single overlap query bounded by the
+ * distance at which its impulse falls below the bubble's epsilon, impulses from all pops in a
+ * frame are summed per target and applied once, and bubbles caught in a shockwave are queued to
+ * pop on a later frame with a per-frame cap, so chain reactions spread over several frames. Pop
+ * sounds of a frame are clustered by sound and location and each cluster plays a single voice,
+ * louder and lower the more and the larger bubbles it holds, within a budget of concurrent voices.
+ */
+UCLASS()
+class BUBBLEGUN_API UBubblePopSubsystem : public UTickableWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	/** Gathers everything in reach of the popping bubble and queues the impulses and chain pops */
+	void EmitShockwave(ABubble* Bubble);
+
+	/** Queues a bubble to be popped by the subsystem on a later frame */
+	void QueuePop(ABubble* Bubble);
+
+	/** Queues the pop sound of a bubble, it is played together with the other pops of the frame */
+	void AddPopSound(USoundBase* Sound, const FVector& Location, double Radius);
+
+	/** Strength of a pop, see GetImpulse */
+	static double GetImpulseScale(const ABubble* Bubble);
+
+	static double GetImpulseScale(double ActualRadius, double PopForceBase);
+
+	/**
+	 * Impulse of a pop at a given distance, ImpulseScale * (1 / Distance - 1 / ShockwaveRadius): it falls off with the
+	 * distance like a point source and fades to zero at the edge of the shockwave instead of ending at full strength
+	 */
+	static double GetImpulse(double ImpulseScale, double ShockwaveRadius, double Distance);
+
+	/**
+	 * Whether a pop sets off a bubble whose surface is Distance from the popping bubble's center: the impulse there
+	 * has to reach the threshold, and the bubble has to be within ChainPopReach radii of the popping one
+	 */
+	static bool ReachesChainPop(double ImpulseScale, double ShockwaveRadius, double PoppedRadius, double ChainPopReach, double Distance, double Threshold);
+
+	/** Distance at which the impulse of a pop without the fade would drop to the bubble's epsilon, at most PopMaxRadius */
+	static double GetShockwaveRadius(const ABubble* Bubble);
+
+	static double GetShockwaveRadius(double ImpulseScale, double Epsilon, double MaxRadius);
+
+	// FTickableGameObject
+	virtual void Tick(float DeltaTime) override;
+	virtual TStatId GetStatId() const override;
+
+private:
+	void FlushImpulses();
+
+	/** Plays one voice per cluster of pops, loudest first until the voice budget is spent */
+	void FlushPopSounds();
+
+	struct FPrimitiveImpulse
+	{
+		FVector Impulse = FVector::ZeroVector;
+
+		/** Impulse-weighted sum of the application points */
+		FVector WeightedLocation = FVector::ZeroVector;
+
+		double Weight = 0.0;
+	};
+
+	TMap<TWeakObjectPtr<ACharacter>, FVector> CharacterImpulses;
+
+	TMap<TWeakObjectPtr<UPrimitiveComponent>, FPrimitiveImpulse> PrimitiveImpulses;
+
+	TArray<TWeakObjectPtr<ABubble>> PopQueue;
+
+	struct FPopSoundCluster
+	{
+		TWeakObjectPtr<USoundBase> Sound;
+
+		/** Radius-weighted sum of the pop locations */
+		FVector WeightedLocation = FVector::ZeroVector;
+
+		double RadiusSum = 0.0;
+
+		double MaxRadius = 0.0;
+
+		int32 Count = 0;
+	};
+
+	/** Pops of this frame by sound and cell of bubble.PopAudioClusterSize */
+	TMap<TPair<TWeakObjectPtr<USoundBase>, FIntVector>, FPopSoundCluster> PopSounds;
+
+	/** Audio time at which each voice started by the subsystem ends */
+	TArray<double> VoiceEndTimes;
+};
@@ -0,0 +1,444 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "BubbleReplaySubsystem.h"
+
+#include "Bubble.h"
+#include "EngineUtils.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
+
+namespace
+{
+	constexpr uint32 ReplayMagic = 0x50524242; // "BBRP"
+
+	// 2: contacts and snapshots use the sorted vertex and face order of the templates
+	constexpr int32 ReplayVersion = 2;
+
+	/** Counts beyond these are not something a recording produces, the file is corrupt */
+	constexpr int32 MaxReplaySubsteps = 256;
+
+	constexpr int32 MaxReplayContacts = 4096;
+
+	/** Relative paths of the console commands are under Saved/BubbleReplays */
+	FString GetReplayPath(const TArray<FString>& Args)
+	{
+		FString Name = Args.Num() > 0 ? Args[0] : TEXT("BubbleReplay.bin");
+		return FPaths::IsRelative(Name) ? FPaths::Combine(FPaths::ProjectSavedDir(), TEXT("BubbleReplays"), Name) : Name;
+	}
+}
+
+static FAutoConsoleCommandWithWorldAndArgs BubbleReplayRecordCommand(
+	TEXT("bubble.ReplayRecord"),
+	TEXT("Starts recording the bubbles of the world for a replay."),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+	{
+		if (UBubbleReplaySubsystem* Subsystem = World ? World->GetSubsystem<UBubbleReplaySubsystem>() : nullptr)
+		{
+			Subsystem->StartRecording();
+		}
+	}));
+
+static FAutoConsoleCommandWithWorldAndArgs BubbleReplayStopCommand(
+	TEXT("bubble.ReplayStop"),
+	TEXT("Stops the bubble recording and writes it to the file given, Saved/BubbleReplays/BubbleReplay.bin by default."),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+	{
+		if (UBubbleReplaySubsystem* Subsystem = World ? World->GetSubsystem<UBubbleReplaySubsystem>() : nullptr)
+		{
+			Subsystem->StopRecording(GetReplayPath(Args));
+		}
+	}));
+
+static FAutoConsoleCommandWithWorldAndArgs BubbleReplayPlayCommand(
+	TEXT("bubble.ReplayPlay"),
+	TEXT("Replays a bubble recording and logs the first frame each bubble's state hash differs from the recorded one."),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+	{
+		if (UBubbleReplaySubsystem* Subsystem = World ? World->GetSubsystem<UBubbleReplaySubsystem>() : nullptr)
+		{
+			Subsystem->StartReplay(GetReplayPath(Args));
+		}
+	}));
+
+FArchive& operator<<(FArchive& Ar, FBubbleReplaySpawn& Spawn)
+{
+	Ar << Spawn.ClassPath << Spawn.Transform << Spawn.Seed << Spawn.RenderRefinement;
+	Ar << Spawn.SpringCoefficient << Spawn.VelocityDamping << Spawn.ForceNoiseMagnitude << Spawn.ForceBigNoiseMagnitude;
+	Ar << Spawn.BigNoiseChangeInterval << Spawn.GlobalBounceMultiplier;
+	return Ar << Spawn.Snapshot;
+}
+
+FArchive& operator<<(FArchive& Ar, FBubbleReplayEvent& Event)
+{
+	uint8 Type = uint8(Event.Type);
+	Ar << Event.Frame << Event.BubbleId << Type;
+	Event.Type = EBubbleReplayEventType(Type);
+
+	// only what the type uses is stored, steps make up nearly all of a recording
+	switch (Event.Type)
+	{
+	case EBubbleReplayEventType::Step:
+	{
+		Ar << Event.StateHash << Event.Scalar << Event.Substeps << Event.RelaxTime;
+		int32 SubstepCount = Event.Contacts.Num();
+		Ar << SubstepCount;
+		if (Ar.IsLoading())
+		{
+			// every substep has its contacts, even when there are none
+			if (SubstepCount != Event.Substeps || SubstepCount < 0 || SubstepCount > MaxReplaySubsteps)
+			{
+				Ar.SetError();
+				return Ar;
+			}
+			Event.Contacts.SetNum(SubstepCount);
+		}
+		for (TArray<FBubbleSolverContact>& Contacts : Event.Contacts)
+		{
+			int32 ContactCount = Contacts.Num();
+			Ar << ContactCount;
+			if (Ar.IsLoading())
+			{
+				if (ContactCount < 0 || ContactCount > MaxReplayContacts || Ar.IsError())
+				{
+					Ar.SetError();
+					return Ar;
+				}
+				Contacts.SetNum(ContactCount);
+			}
+			for (FBubbleSolverContact& Contact : Contacts)
+			{
+				Ar << Contact.FaceIndex << Contact.VertexVelocityDelta << Contact.GlobalForce;
+			}
+		}
+		break;
+	}
+	case EBubbleReplayEventType::Grow:
+		Ar << Event.Scalar;
+		break;
+	case EBubbleReplayEventType::Remesh:
+		Ar << Event.Level;
+		break;
+	default:
+		break;
+	}
+	return Ar;
+}
+
+void UBubbleReplaySubsystem::StartRecording()
+{
+	if (bRecording || bReplaying)
+	{
+		return;
+	}
+
+	bRecording = true;
+	Frame = 0;
+	Spawns.Reset();
+	Events.Reset();
+	RecordedIds.Reset();
+
+	for (TActorIterator<ABubble> It(GetWorld()); It; ++It)
+	{
+		if (It->HasActorBegunPlay())
+		{
+			CaptureBubble(*It);
+		}
+	}
+}
+
+bool UBubbleReplaySubsystem::StopRecording(const FString& Path)
+{
+	if (!bRecording)
+	{
+		return false;
+	}
+	bRecording = false;
+	RecordedIds.Reset();
+
+	TArray<uint8> Data;
+	FMemoryWriter Writer(Data);
+	uint32 Magic = ReplayMagic;
+	int32 Version = ReplayVersion;
+	Writer << Magic << Version;
+	Writer << Spawns;
+	Writer << Events;
+
+	const int32 EventCount = Events.Num();
+	Spawns.Reset();
+	Events.Reset();
+	if (!FFileHelper::SaveArrayToFile(Data, *Path))
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Could not write bubble replay %s"), *Path);
+		return false;
+	}
+
+	UE_LOG(LogTemp, Log, TEXT("Bubble replay %s: %u frames, %d events, %d bytes"), *Path, Frame, EventCount, Data.Num());
+	return true;
+}
+
+bool UBubbleReplaySubsystem::StartReplay(const FString& Path)
+{
+	if (bRecording || bReplaying)
+	{
+		return false;
+	}
+
+	TArray<uint8> Data;
+	if (!FFileHelper::LoadFileToArray(Data, *Path))
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Could not read bubble replay %s"), *Path);
+		return false;
+	}
+
+	FMemoryReader Reader(Data);
+	uint32 Magic = 0;
+	int32 Version = 0;
+	Reader << Magic << Version;
+	if (Magic != ReplayMagic || Version != ReplayVersion)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Bubble replay %s has version %d, expected %d"), *Path, Version, ReplayVersion);
+		return false;
+	}
+	Reader << Spawns;
+	Reader << Events;
+	if (Reader.IsError())
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Bubble replay %s is corrupted"), *Path);
+		Spawns.Reset();
+		Events.Reset();
+		return false;
+	}
+
+	bReplaying = true;
+	Frame = 0;
+	NextEvent = 0;
+	ComparedSteps = 0;
+	MismatchedSteps = 0;
+	ReplayBubbles.Init(nullptr, Spawns.Num());
+	DivergedFrames.Init(INDEX_NONE, Spawns.Num());
+	return true;
+}
+
+void UBubbleReplaySubsystem::CaptureBubble(ABubble* Bubble)
+{
+	if (!bRecording || Bubble->IsReplayDriven() || Bubble->IsPopping() || RecordedIds.Contains(Bubble))
+	{
+		return;
+	}
+
+	const int32 Id = Spawns.Num();
+	FBubbleReplaySpawn& Spawn = Spawns.AddDefaulted_GetRef();
+	Spawn.ClassPath = Bubble->GetClass()->GetPathName();
+	Spawn.Transform = Bubble->GetActorTransform();
+	Spawn.Seed = Bubble->ReseedSimulation();
+	Spawn.RenderRefinement = Bubble->RenderRefinement;
+	Spawn.SpringCoefficient = Bubble->SpringCoefficient;
+	Spawn.VelocityDamping = Bubble->VelocityDamping;
+	Spawn.ForceNoiseMagnitude = Bubble->ForceNoiseMagnitude;
+	Spawn.ForceBigNoiseMagnitude = Bubble->ForceBigNoiseMagnitude;
+	Spawn.BigNoiseChangeInterval = Bubble->BigNoiseChangeInterval;
+	Spawn.GlobalBounceMultiplier = Bubble->GlobalBounceMultiplier;
+
+	// a snapshot rounds the state, the bubble continues from the rounded one so the replay starts where it did
+	Bubble->WriteSnapshot(Spawn.Snapshot, false);
+	Bubble->RestoreSnapshot(Spawn.Snapshot);
+
+	RecordedIds.Add(Bubble, Id);
+	AddEvent(Id, EBubbleReplayEventType::Spawn);
+}
+
+int32 UBubbleReplaySubsystem::FindRecordedId(const ABubble* Bubble) const
+{
+	const int32* Id = bRecording ? RecordedIds.Find(Bubble) : nullptr;
+	return Id ? *Id : INDEX_NONE;
+}
+
+FBubbleReplayEvent& UBubbleReplaySubsystem::AddEvent(int32 BubbleId, EBubbleReplayEventType Type)
+{
+	LLM_SCOPE_BYTAG(BubbleSimulation);
+
+	FBubbleReplayEvent& Event = Events.AddDefaulted_GetRef();
+	Event.Frame = Frame;
+	Event.BubbleId = BubbleId;
+	Event.Type = Type;
+	return Event;
+}
+
+void UBubbleReplaySubsystem::RecordStep(const ABubble* Bubble, double StepTime, int32 Substeps, double RelaxTime, const TArray<TArray<FBubbleSolverContact>>& Contacts)
+{
+	const int32 Id = FindRecordedId(Bubble);
+	if (Id == INDEX_NONE)
+	{
+		return;
+	}
+
+	FBubbleReplayEvent& Event = AddEvent(Id, EBubbleReplayEventType::Step);
+	Event.StateHash = Bubble->GetStateHash();
+	Event.Scalar = StepTime;
+	Event.Substeps = Substeps;
+	Event.RelaxTime = RelaxTime;
+	Event.Contacts = Contacts;
+}
+
+void UBubbleReplaySubsystem::RecordGrow(const ABubble* Bubble, double Amount)
+{
+	const int32 Id = FindRecordedId(Bubble);
+	if (Id != INDEX_NONE)
+	{
+		AddEvent(Id, EBubbleReplayEventType::Grow).Scalar = Amount;
+	}
+}
+
+void UBubbleReplaySubsystem::RecordRemesh(const ABubble* Bubble, int32 Level)
+{
+	const int32 Id = FindRecordedId(Bubble);
+	if (Id != INDEX_NONE)
+	{
+		AddEvent(Id, EBubbleReplayEventType::Remesh).Level = Level;
+	}
+}
+
+void UBubbleReplaySubsystem::RecordPop(const ABubble* Bubble)
+{
+	const int32 Id = FindRecordedId(Bubble);
+	if (Id != INDEX_NONE)
+	{
+		AddEvent(Id, EBubbleReplayEventType::Pop);
+	}
+}
+
+void UBubbleReplaySubsystem::ApplyEvent(const FBubbleReplayEvent& Event)
+{
+	if (!Spawns.IsValidIndex(Event.BubbleId))
+	{
+		return;
+	}
+
+	if (Event.Type == EBubbleReplayEventType::Spawn)
+	{
+		const FBubbleReplaySpawn& Spawn = Spawns[Event.BubbleId];
+		UClass* BubbleClass = FSoftClassPath(Spawn.ClassPath).TryLoadClass<ABubble>();
+		ABubble* Bubble = BubbleClass ? GetWorld()->SpawnActorDeferred<ABubble>(BubbleClass, Spawn.Transform, nullptr, nullptr, ESpawnActorCollisionHandlingMethod::AlwaysSpawn) : nullptr;
+		if (!Bubble)
+		{
+			return;
+		}
+
+		Bubble->SetReplayDriven();
+		Bubble->SimulationSeed = Spawn.Seed;
+		Bubble->RenderRefinement = Spawn.RenderRefinement;
+		Bubble->SpringCoefficient = Spawn.SpringCoefficient;
+		Bubble->VelocityDamping = Spawn.VelocityDamping;
+		Bubble->ForceNoiseMagnitude = Spawn.ForceNoiseMagnitude;
+		Bubble->ForceBigNoiseMagnitude = Spawn.ForceBigNoiseMagnitude;
+		Bubble->BigNoiseChangeInterval = Spawn.BigNoiseChangeInterval;
+		Bubble->GlobalBounceMultiplier = Spawn.GlobalBounceMultiplier;
+		Bubble->SetPendingSnapshot(TArray<uint8>(Spawn.Snapshot));
+		Bubble->FinishSpawning(Spawn.Transform);
+		ReplayBubbles[Event.BubbleId] = Bubble;
+		return;
+	}
+
+	ABubble* Bubble = ReplayBubbles[Event.BubbleId].Get();
+	if (!IsValid(Bubble))
+	{
+		return;
+	}
+
+	switch (Event.Type)
+	{
+	case EBubbleReplayEventType::Step:
+	{
+		ComparedSteps++;
+		if (Bubble->GetStateHash() != Event.StateHash)
+		{
+			MismatchedSteps++;
+			if (DivergedFrames[Event.BubbleId] == INDEX_NONE)
+			{
+				DivergedFrames[Event.BubbleId] = Event.Frame;
+				UE_LOG(LogTemp, Warning, TEXT("Bubble replay: bubble %d diverged in frame %u"), Event.BubbleId, Event.Frame);
+			}
+		}
+		if (!Bubble->ReplayStep(Event.Scalar, Event.Substeps, Event.RelaxTime, Event.Contacts))
+		{
+			UE_LOG(LogTemp, Warning, TEXT("Bubble replay: step of bubble %d in frame %u does not fit its mesh, the replay is rejected"), Event.BubbleId, Event.Frame);
+			bRejected = true;
+		}
+		break;
+	}
+	case EBubbleReplayEventType::Grow:
+		Bubble->GrowBubble(Event.Scalar);
+		Bubble->ProcessCommands();
+		break;
+	case EBubbleReplayEventType::Remesh:
+		Bubble->Remesh(Event.Level);
+		break;
+	case EBubbleReplayEventType::Pop:
+		Bubble->Pop();
+		break;
+	default:
+		break;
+	}
+}
+
+void UBubbleReplaySubsystem::FinishReplay()
+{
+	int32 DivergedBubbles = 0;
+	for (int64 DivergedFrame : DivergedFrames)
+	{
+		DivergedBubbles += DivergedFrame != INDEX_NONE;
+	}
+
+	if (bRejected)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Bubble replay rejected after %d steps over %u frames"), ComparedSteps, Frame);
+	}
+	else if (MismatchedSteps == 0)
+	{
+		UE_LOG(LogTemp, Log, TEXT("Bubble replay matched: %d bubbles, %d steps over %u frames"), Spawns.Num(), ComparedSteps, Frame);
+	}
+	else
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Bubble replay diverged: %d of %d bubbles, %d of %d steps"), DivergedBubbles, Spawns.Num(), MismatchedSteps, ComparedSteps);
+	}
+
+	bReplaying = false;
+	bRejected = false;
+	Spawns.Reset();
+	Events.Reset();
+	ReplayBubbles.Reset();
+	DivergedFrames.Reset();
+}
+
+void UBubbleReplaySubsystem::Tick(float DeltaTime)
+{
+	if (bRecording)
+	{
+		Frame++;
+		return;
+	}
+	if (!bReplaying)
+	{
+		return;
+	}
+
+	// events of a frame are applied in the order they were recorded in, independent of this frame's delta time
+	while (NextEvent < Events.Num() && Events[NextEvent].Frame <= Frame && !bRejected)
+	{
+		ApplyEvent(Events[NextEvent++]);
+	}
+	Frame++;
+
+	if (NextEvent >= Events.Num() || bRejected)
+	{
+		FinishReplay();
+	}
+}
+
+TStatId UBubbleReplaySubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UBubbleReplaySubsystem, STATGROUP_Tickables);
+}
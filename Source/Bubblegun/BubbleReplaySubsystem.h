@@ -0,0 +1,167 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "BubbleContactManifold.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "UObject/ObjectKey.h"
+#include "BubbleReplaySubsystem.generated.h"
+
+class ABubble;
+
+enum class EBubbleReplayEventType : uint8
+{
+	/** A bubble enters the recording, with its spawn parameters and state */
+	Spawn,
+
+	/** A solve with its step times and the contacts of every substep */
+	Step,
+
+	Grow,
+
+	Remesh,
+
+	Pop,
+};
+
+/** What a bubble started a recording from, everything else the solver reads is in the recorded events */
+struct FBubbleReplaySpawn
+{
+	FString ClassPath;
+
+	FTransform Transform;
+
+	int32 Seed = 0;
+
+	int32 RenderRefinement = 0;
+
+	double SpringCoefficient = 0.0;
+
+	double VelocityDamping = 0.0;
+
+	double ForceNoiseMagnitude = 0.0;
+
+	double ForceBigNoiseMagnitude = 0.0;
+
+	double BigNoiseChangeInterval = 0.0;
+
+	double GlobalBounceMultiplier = 0.0;
+
+	/** Full precision snapshot, the recorded bubble itself continues from its decoded state */
+	TArray<uint8> Snapshot;
+
+	friend FArchive& operator<<(FArchive& Ar, FBubbleReplaySpawn& Spawn);
+};
+
+struct FBubbleReplayEvent
+{
+	/** Tick of the replay subsystem since the recording started */
+	uint32 Frame = 0;
+
+	int32 BubbleId = INDEX_NONE;
+
+	EBubbleReplayEventType Type = EBubbleReplayEventType::Step;
+
+	/** Step: hash of the state the step started from, see ABubble::GetStateHash */
+	uint32 StateHash = 0;
+
+	int32 Substeps = 0;
+
+	/** Step: step time; Grow: radius change */
+	double Scalar = 0.0;
+
+	double RelaxTime = 0.0;
+
+	/** Remesh: subdivision level */
+	int32 Level = 0;
+
+	/** Step: solver contacts of each substep, hits and impulses already merged */
+	TArray<TArray<FBubbleSolverContact>> Contacts;
+
+	friend FArchive& operator<<(FArchive& Ar, FBubbleReplayEvent& Event);
+};
+
+/**
+ * Records what bubbles receive from the world and replays it. A recording holds, per bubble, its
+ * seed, solver parameters and starting state, followed by every solve with the contacts it was
+ * given and every growth, remesh and pop, with the frame it happened in. A replay spawns the bubbles
+ * again, drives them with the recorded events only and compares the hash of the state before each
+ * step, so any change to the solver that changes its results shows up as the first diverging frame.
+ *
+ * Static geometry and force fields are read from the world during replay as well, so a recording is
+ * replayed in the level and net mode it was made in.
+ */
+UCLASS()
+class BUBBLEGUN_API UBubbleReplaySubsystem : public UTickableWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	/** Starts recording all bubbles in the world and the ones spawned later */
+	void StartRecording();
+
+	/** Ends the recording and writes it to a file, returns false if nothing was recorded or writing failed */
+	bool StopRecording(const FString& Path);
+
+	bool IsRecording() const { return bRecording; }
+
+	/** Spawns the bubbles of a recording and drives them through its events over the next ticks */
+	bool StartReplay(const FString& Path);
+
+	bool IsReplaying() const { return bReplaying; }
+
+	/** Adds a bubble to the recording, called for bubbles that begin play while recording */
+	void CaptureBubble(ABubble* Bubble);
+
+	/** Called by the bubble before launching a solve, while its state is the one the solve starts from */
+	void RecordStep(const ABubble* Bubble, double StepTime, int32 Substeps, double RelaxTime, const TArray<TArray<FBubbleSolverContact>>& Contacts);
+
+	void RecordGrow(const ABubble* Bubble, double Amount);
+
+	void RecordRemesh(const ABubble* Bubble, int32 Level);
+
+	void RecordPop(const ABubble* Bubble);
+
+	// FTickableGameObject
+	virtual void Tick(float DeltaTime) override;
+	virtual TStatId GetStatId() const override;
+
+private:
+	/** Recording id of the bubble, INDEX_NONE if it is not recorded */
+	int32 FindRecordedId(const ABubble* Bubble) const;
+
+	FBubbleReplayEvent& AddEvent(int32 BubbleId, EBubbleReplayEventType Type);
+
+	void ApplyEvent(const FBubbleReplayEvent& Event);
+
+	void FinishReplay();
+
+	bool bRecording = false;
+
+	bool bReplaying = false;
+
+	/** Replay: an event did not fit its bubble, the rest of the replay is not applied */
+	bool bRejected = false;
+
+	/** Recording: ticks since the start; replay: the next frame to apply */
+	uint32 Frame = 0;
+
+	TArray<FBubbleReplaySpawn> Spawns;
+
+	TArray<FBubbleReplayEvent> Events;
+
+	TMap<TObjectKey<ABubble>, int32> RecordedIds;
+
+	/** Replay: the spawned bubbles by recording id */
+	TArray<TWeakObjectPtr<ABubble>> ReplayBubbles;
+
+	/** Replay: first frame each bubble diverged in, INDEX_NONE while it matches */
+	TArray<int64> DivergedFrames;
+
+	int32 NextEvent = 0;
+
+	int32 ComparedSteps = 0;
+
+	int32 MismatchedSteps = 0;
+};
@@ -0,0 +1,236 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "BubbleRewindHistory.h"
+
+#include "DynamicMesh/DynamicMesh3.h"
+
+using UE::Geometry::FDynamicMesh3;
+
+namespace
+{
+	/** Samples along a ray inside the bounding sphere before the crossing is refined */
+	constexpr int32 RaycastSteps = 16;
+
+	constexpr int32 BisectionSteps = 8;
+
+	/** Real spherical harmonics up to order 2 in a normalized direction */
+	void EvaluateBasis(const FVector3d& D, double Out[FBubbleRewindState::NumCoefficients])
+	{
+		Out[0] = 0.282095;
+		Out[1] = 0.488603 * D.Y;
+		Out[2] = 0.488603 * D.Z;
+		Out[3] = 0.488603 * D.X;
+		Out[4] = 1.092548 * D.X * D.Y;
+		Out[5] = 1.092548 * D.Y * D.Z;
+		Out[6] = 0.315392 * (3.0 * D.Z * D.Z - 1.0);
+		Out[7] = 1.092548 * D.X * D.Z;
+		Out[8] = 0.546274 * (D.X * D.X - D.Y * D.Y);
+	}
+}
+
+void FBubbleRewindState::Fit(const FDynamicMesh3& Mesh, const FVector3d& ActorLocation, const FVector3d& CenterOfMass)
+{
+	Center = ActorLocation + CenterOfMass;
+	FMemory::Memzero(Coefficients);
+
+	double RadiusSum = 0.0;
+	double MaxDistance = 0.0;
+	int32 VertexCount = 0;
+	for (int32 i : Mesh.VertexIndicesItr())
+	{
+		double Distance = (Mesh.GetVertex(i) - CenterOfMass).Size();
+		RadiusSum += Distance;
+		MaxDistance = FMath::Max(MaxDistance, Distance);
+		VertexCount++;
+	}
+	if (VertexCount == 0)
+	{
+		Radius = MaxRadius = 0.0f;
+		return;
+	}
+	Radius = float(RadiusSum / VertexCount);
+	MaxRadius = float(MaxDistance);
+
+	// the vertices of the subdivided icosahedron sample the sphere nearly uniformly, so projecting onto the basis
+	// with equal weights is close to the least squares fit
+	double Sums[NumCoefficients] = {};
+	double Basis[NumCoefficients];
+	for (int32 i : Mesh.VertexIndicesItr())
+	{
+		FVector3d Offset = Mesh.GetVertex(i) - CenterOfMass;
+		double Distance = Offset.Size();
+		if (Distance <= UE_DOUBLE_SMALL_NUMBER)
+		{
+			continue;
+		}
+
+		EvaluateBasis(Offset / Distance, Basis);
+		for (int32 k = 0; k < NumCoefficients; k++)
+		{
+			Sums[k] += (Distance - Radius) * Basis[k];
+		}
+	}
+	for (int32 k = 0; k < NumCoefficients; k++)
+	{
+		Coefficients[k] = float(Sums[k] * 4.0 * UE_DOUBLE_PI / VertexCount);
+	}
+}
+
+double FBubbleRewindState::EvaluateRadius(const FVector3d& Direction) const
+{
+	double Basis[NumCoefficients];
+	EvaluateBasis(Direction, Basis);
+
+	double Result = Radius;
+	for (int32 k = 0; k < NumCoefficients; k++)
+	{
+		Result += Coefficients[k] * Basis[k];
+	}
+	return Result;
+}
+
+bool FBubbleRewindState::Raycast(const FVector3d& Start, const FVector3d& End, double& OutDistance) const
+{
+	FVector3d Direction = End - Start;
+	double Length = Direction.Size();
+	if (Length <= UE_DOUBLE_SMALL_NUMBER || MaxRadius <= 0.0f)
+	{
+		return false;
+	}
+	Direction /= Length;
+
+	// only the part of the segment inside the bounding sphere can hit
+	FVector3d Offset = Start - Center;
+	double B = FVector3d::DotProduct(Offset, Direction);
+	double C = Offset.SizeSquared() - FMath::Square(double(MaxRadius));
+	double Discriminant = B * B - C;
+	if (Discriminant < 0.0)
+	{
+		return false;
+	}
+	double SqrtDiscriminant = FMath::Sqrt(Discriminant);
+	double T0 = FMath::Max(-B - SqrtDiscriminant, 0.0);
+	double T1 = FMath::Min(-B + SqrtDiscriminant, Length);
+	if (T0 > T1)
+	{
+		return false;
+	}
+
+	// positive outside the surface, negative inside
+	auto SignedDistance = [this, &Start, &Direction](double T)
+	{
+		FVector3d Point = Start + Direction * T - Center;
+		double Distance = Point.Size();
+		return Distance <= UE_DOUBLE_SMALL_NUMBER ? -Radius : Distance - EvaluateRadius(Point / Distance);
+	};
+
+	if (SignedDistance(T0) <= 0.0)
+	{
+		OutDistance = T0;
+		return true;
+	}
+
+	double Previous = T0;
+	for (int32 Step = 1; Step <= RaycastSteps; Step++)
+	{
+		double T = FMath::Lerp(T0, T1, double(Step) / RaycastSteps);
+		if (SignedDistance(T) > 0.0)
+		{
+			Previous = T;
+			continue;
+		}
+
+		double Outside = Previous;
+		double Inside = T;
+		for (int32 i = 0; i < BisectionSteps; i++)
+		{
+			double Middle = (Outside + Inside) * 0.5;
+			if (SignedDistance(Middle) > 0.0)
+			{
+				Outside = Middle;
+			}
+			else
+			{
+				Inside = Middle;
+			}
+		}
+		OutDistance = Inside;
+		return true;
+	}
+	return false;
+}
+
+bool FBubbleRewindState::Overlaps(const FVector3d& SphereCenter, double SphereRadius) const
+{
+	FVector3d Offset = SphereCenter - Center;
+	double Distance = Offset.Size();
+	if (Distance <= SphereRadius)
+	{
+		return true;
+	}
+	if (Distance - SphereRadius > MaxRadius)
+	{
+		return false;
+	}
+	return Distance - EvaluateRadius(Offset / Distance) <= SphereRadius;
+}
+
+FBubbleRewindState FBubbleRewindState::Lerp(const FBubbleRewindState& A, const FBubbleRewindState& B, double Alpha)
+{
+	FBubbleRewindState Result;
+	Result.Time = FMath::Lerp(A.Time, B.Time, Alpha);
+	Result.Center = FMath::Lerp(A.Center, B.Center, Alpha);
+	Result.Radius = FMath::Lerp(A.Radius, B.Radius, float(Alpha));
+	Result.MaxRadius = FMath::Lerp(A.MaxRadius, B.MaxRadius, float(Alpha));
+	for (int32 k = 0; k < NumCoefficients; k++)
+	{
+		Result.Coefficients[k] = FMath::Lerp(A.Coefficients[k], B.Coefficients[k], float(Alpha));
+	}
+	return Result;
+}
+
+bool FBubbleRewindHistory::WantsRecord(double Time, double History) const
+{
+	return States.IsEmpty() || Time - GetOrdered(States.Num() - 1).Time >= History / Capacity;
+}
+
+void FBubbleRewindHistory::Record(const FBubbleRewindState& State)
+{
+	if (States.Num() < Capacity)
+	{
+		States.Add(State);
+		return;
+	}
+
+	States[Head] = State;
+	Head = (Head + 1) % Capacity;
+}
+
+bool FBubbleRewindHistory::GetState(double Time, FBubbleRewindState& OutState) const
+{
+	if (States.IsEmpty())
+	{
+		return false;
+	}
+
+	const int32 Num = States.Num();
+	if (Time <= GetOrdered(0).Time)
+	{
+		OutState = GetOrdered(0);
+		return true;
+	}
+	for (int32 i = 1; i < Num; i++)
+	{
+		const FBubbleRewindState& Next = GetOrdered(i);
+		if (Time < Next.Time)
+		{
+			const FBubbleRewindState& Previous = GetOrdered(i - 1);
+			double Alpha = (Time - Previous.Time) / FMath::Max(Next.Time - Previous.Time, UE_DOUBLE_SMALL_NUMBER);
+			OutState = FBubbleRewindState::Lerp(Previous, Next, Alpha);
+			return true;
+		}
+	}
+	OutState = GetOrdered(Num - 1);
+	return true;
+}
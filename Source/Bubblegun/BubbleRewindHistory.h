@@ -0,0 +1,76 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+namespace UE::Geometry { class FDynamicMesh3; }
+
+/**
+ * Compact shape of a bubble at one point in time: the surface as a radius around the center plus
+ * a second order spherical harmonic expansion of the deviation from it, about 70 bytes however
+ * many vertices the mesh has.
+ */
+struct FBubbleRewindState
+{
+	static constexpr int32 NumCoefficients = 9;
+
+	double Time = 0.0;
+
+	/** World-space center of mass */
+	FVector3d Center = FVector3d::Zero();
+
+	float Radius = 0.0f;
+
+	/** Farthest vertex from the center, bounds every query */
+	float MaxRadius = 0.0f;
+
+	float Coefficients[NumCoefficients] = {};
+
+	/** Fits the state to a surface in actor space, whose world transform is a translation by ActorLocation */
+	void Fit(const UE::Geometry::FDynamicMesh3& Mesh, const FVector3d& ActorLocation, const FVector3d& CenterOfMass);
+
+	/** Distance from the center to the surface in a normalized direction */
+	double EvaluateRadius(const FVector3d& Direction) const;
+
+	/** First intersection of a world-space segment with the surface */
+	bool Raycast(const FVector3d& Start, const FVector3d& End, double& OutDistance) const;
+
+	/** Whether a world-space sphere touches the surface, measured along the direction from the center */
+	bool Overlaps(const FVector3d& SphereCenter, double SphereRadius) const;
+
+	static FBubbleRewindState Lerp(const FBubbleRewindState& A, const FBubbleRewindState& B, double Alpha);
+};
+
+/**
+ * Recent shapes of one bubble for lag compensation on the server. A fixed number of states is
+ * kept in a ring, recorded at most every History / Capacity seconds, and queries interpolate the
+ * two states around the requested time. The live mesh is never read by a query.
+ */
+class BUBBLEGUN_API FBubbleRewindHistory
+{
+public:
+	static constexpr int32 Capacity = 16;
+
+	/** Whether a state taken at Time is due, given the history length to cover */
+	bool WantsRecord(double Time, double History) const;
+
+	void Record(const FBubbleRewindState& State);
+
+	void Reset() { States.Reset(); Head = 0; }
+
+	bool IsEmpty() const { return States.IsEmpty(); }
+
+	/** State at Time, clamped to the oldest and newest recorded ones; false if nothing was recorded */
+	bool GetState(double Time, FBubbleRewindState& OutState) const;
+
+	SIZE_T GetAllocatedSize() const { return States.GetAllocatedSize(); }
+
+private:
+	const FBubbleRewindState& GetOrdered(int32 Index) const { return States[(Head + Index) % States.Num()]; }
+
+	/** Ring of up to Capacity states, the oldest at Head once it is full */
+	TArray<FBubbleRewindState> States;
+
+	int32 Head = 0;
+};
@@ -0,0 +1,305 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "BubbleSDFSubsystem.h"
+
+#include "Bubblegun.h"
+#include "Components/PrimitiveComponent.h"
+#include "Engine/OverlapResult.h"
+#include "Engine/World.h"
+#include "Misc/ScopeRWLock.h"
+
+static TAutoConsoleVariable<float> CVarBubbleSDFBrickSize(
+	TEXT("bubble.SDFBrickSize"),
+	512.0f,
+	TEXT("Edge length of one distance field brick of static geometry. Changing it drops the cache."),
+	ECVF_Default);
+
+static TAutoConsoleVariable<int32> CVarBubbleSDFBrickResolution(
+	TEXT("bubble.SDFBrickResolution"),
+	16,
+	TEXT("Cells along each edge of a distance field brick. Changing it drops the cache."),
+	ECVF_Default);
+
+static TAutoConsoleVariable<float> CVarBubbleSDFBakeBudgetMs(
+	TEXT("bubble.SDFBakeBudgetMs"),
+	1.0f,
+	TEXT("Game thread time in milliseconds spent baking distance field bricks per frame."),
+	ECVF_Default);
+
+static TAutoConsoleVariable<int32> CVarBubbleSDFMaxBricks(
+	TEXT("bubble.SDFMaxBricks"),
+	256,
+	TEXT("Bricks kept in the distance field cache, the least recently used ones are dropped beyond this."),
+	ECVF_Default);
+
+namespace
+{
+	/** Bricks used within this many seconds are never evicted */
+	constexpr double EvictionGracePeriod = 1.0;
+}
+
+void UBubbleSDFSubsystem::UpdateSettings()
+{
+	double NewBrickSize = FMath::Max(CVarBubbleSDFBrickSize.GetValueOnGameThread(), 16.0f);
+	int32 NewResolution = FMath::Clamp(CVarBubbleSDFBrickResolution.GetValueOnGameThread(), 2, 64);
+	if (NewBrickSize != BrickSize || NewResolution != BrickResolution)
+	{
+		FWriteScopeLock WriteLock(BricksLock);
+		BrickSize = NewBrickSize;
+		BrickResolution = NewResolution;
+		Bricks.Reset();
+		BakeQueue.Reset();
+	}
+}
+
+FIntVector UBubbleSDFSubsystem::GetBrickCoordinates(const FVector& Location) const
+{
+	return FIntVector(
+		FMath::FloorToInt32(Location.X / BrickSize),
+		FMath::FloorToInt32(Location.Y / BrickSize),
+		FMath::FloorToInt32(Location.Z / BrickSize));
+}
+
+void UBubbleSDFSubsystem::RequestRegion(const FBox& Box)
+{
+	LLM_SCOPE_BYTAG(BubbleCollision);
+
+	UpdateSettings();
+
+	double Now = GetWorld()->GetTimeSeconds();
+	FIntVector Min = GetBrickCoordinates(Box.Min);
+	FIntVector Max = GetBrickCoordinates(Box.Max);
+	FWriteScopeLock WriteLock(BricksLock);
+	for (int32 Z = Min.Z; Z <= Max.Z; Z++)
+	{
+		for (int32 Y = Min.Y; Y <= Max.Y; Y++)
+		{
+			for (int32 X = Min.X; X <= Max.X; X++)
+			{
+				FIntVector Coordinates(X, Y, Z);
+				TUniquePtr<FBubbleSDFBrick>& Brick = Bricks.FindOrAdd(Coordinates);
+				if (!Brick)
+				{
+					Brick = MakeUnique<FBubbleSDFBrick>();
+					Brick->Coordinates = Coordinates;
+					Brick->Origin = FVector(Coordinates) * BrickSize;
+					BakeQueue.Add(Coordinates);
+				}
+				Brick->LastUsedTime = Now;
+			}
+		}
+	}
+}
+
+bool UBubbleSDFSubsystem::Sample(const FVector& Location, float& OutDistance, FVector& OutGradient) const
+{
+	FReadScopeLock ReadLock(BricksLock);
+	if (BrickSize <= 0.0)
+	{
+		return false;
+	}
+
+	const TUniquePtr<FBubbleSDFBrick>* Found = Bricks.Find(GetBrickCoordinates(Location));
+	if (!Found || (*Found)->State != FBubbleSDFBrick::EState::Ready)
+	{
+		return false;
+	}
+	const FBubbleSDFBrick& Brick = **Found;
+
+	const int32 N = BrickResolution + 1;
+	const double VoxelSize = BrickSize / BrickResolution;
+	FVector Local = (Location - Brick.Origin) / VoxelSize;
+	int32 X = FMath::Clamp(FMath::FloorToInt32(Local.X), 0, BrickResolution - 1);
+	int32 Y = FMath::Clamp(FMath::FloorToInt32(Local.Y), 0, BrickResolution - 1);
+	int32 Z = FMath::Clamp(FMath::FloorToInt32(Local.Z), 0, BrickResolution - 1);
+	double Fx = FMath::Clamp(Local.X - X, 0.0, 1.0);
+	double Fy = FMath::Clamp(Local.Y - Y, 0.0, 1.0);
+	double Fz = FMath::Clamp(Local.Z - Z, 0.0, 1.0);
+
+	auto At = [&Brick, N](int32 I, int32 J, int32 K) { return (double)Brick.Distances[I + N * (J + N * K)]; };
+	double C000 = At(X, Y, Z), C100 = At(X + 1, Y, Z), C010 = At(X, Y + 1, Z), C110 = At(X + 1, Y + 1, Z);
+	double C001 = At(X, Y, Z + 1), C101 = At(X + 1, Y, Z + 1), C011 = At(X, Y + 1, Z + 1), C111 = At(X + 1, Y + 1, Z + 1);
+
+	// trilinear value and its exact derivative within the cell
+	double C00 = FMath::Lerp(C000, C100, Fx), C10 = FMath::Lerp(C010, C110, Fx);
+	double C01 = FMath::Lerp(C001, C101, Fx), C11 = FMath::Lerp(C011, C111, Fx);
+	double C0 = FMath::Lerp(C00, C10, Fy), C1 = FMath::Lerp(C01, C11, Fy);
+	OutDistance = FMath::Lerp(C0, C1, Fz);
+
+	double Dx = FMath::Lerp(FMath::Lerp(C100 - C000, C110 - C010, Fy), FMath::Lerp(C101 - C001, C111 - C011, Fy), Fz);
+	double Dy = FMath::Lerp(C10 - C00, C11 - C01, Fz);
+	double Dz = C1 - C0;
+	OutGradient = FVector(Dx, Dy, Dz).GetSafeNormal();
+	return true;
+}
+
+void UBubbleSDFSubsystem::InvalidateRegion(const FBox& Box)
+{
+	if (BrickSize <= 0.0)
+	{
+		return;
+	}
+
+	FIntVector Min = GetBrickCoordinates(Box.Min);
+	FIntVector Max = GetBrickCoordinates(Box.Max);
+	FWriteScopeLock WriteLock(BricksLock);
+	for (auto It = Bricks.CreateIterator(); It; ++It)
+	{
+		const FIntVector& C = It.Key();
+		if (C.X >= Min.X && C.X <= Max.X && C.Y >= Min.Y && C.Y <= Max.Y && C.Z >= Min.Z && C.Z <= Max.Z)
+		{
+			BakeQueue.Remove(C);
+			It.RemoveCurrent();
+		}
+	}
+}
+
+void UBubbleSDFSubsystem::BeginBake(FBubbleSDFBrick& Brick)
+{
+	const int32 N = BrickResolution + 1;
+	const double VoxelSize = BrickSize / BrickResolution;
+	SetBrickState(Brick, FBubbleSDFBrick::EState::Baking);
+	Brick.NextSample = 0;
+
+	// anything farther than a couple of cells from the brick does not change its samples near surfaces
+	FVector HalfExtent = FVector(BrickSize * 0.5 + VoxelSize * 2.0);
+	TArray<FOverlapResult> Overlaps;
+	FCollisionQueryParams QueryParams(SCENE_QUERY_STAT(BubbleSDFBake), false);
+	GetWorld()->OverlapMultiByObjectType(Overlaps, Brick.Origin + FVector(BrickSize * 0.5), FQuat::Identity, FCollisionObjectQueryParams(ECC_WorldStatic), FCollisionShape::MakeBox(HalfExtent), QueryParams);
+
+	Brick.Primitives.Reset();
+	for (const FOverlapResult& Overlap : Overlaps)
+	{
+		UPrimitiveComponent* Primitive = Overlap.GetComponent();
+		// movable shapes would go stale in the cache, vertices find them with the dynamic traces
+		if (Primitive && Primitive->Mobility != EComponentMobility::Movable)
+		{
+			Brick.Primitives.AddUnique(Primitive);
+		}
+	}
+
+	// empty space is the common case and needs no sampling
+	Brick.Distances.Init(Brick.Primitives.IsEmpty() ? BrickSize : 0.0f, N * N * N);
+	if (Brick.Primitives.IsEmpty())
+	{
+		SetBrickState(Brick, FBubbleSDFBrick::EState::Ready);
+	}
+}
+
+bool UBubbleSDFSubsystem::ContinueBake(FBubbleSDFBrick& Brick, double Deadline)
+{
+	const int32 N = BrickResolution + 1;
+	const double VoxelSize = BrickSize / BrickResolution;
+
+	while (Brick.NextSample < Brick.Distances.Num())
+	{
+		int32 Index = Brick.NextSample++;
+		FVector Location = Brick.Origin + FVector(Index % N, (Index / N) % N, Index / (N * N)) * VoxelSize;
+
+		double Distance = BrickSize;
+		for (const TWeakObjectPtr<UPrimitiveComponent>& Primitive : Brick.Primitives)
+		{
+			if (!Primitive.IsValid())
+			{
+				continue;
+			}
+
+			FVector ClosestPoint;
+			float PrimitiveDistance = Primitive->GetDistanceToCollision(Location, ClosestPoint);
+			if (PrimitiveDistance < 0.0f)
+			{
+				// no distance support for the shape, e.g. complex-only triangle meshes
+				SetBrickState(Brick, FBubbleSDFBrick::EState::Unsupported);
+				Brick.Distances.Empty();
+				Brick.Primitives.Empty();
+				return true;
+			}
+			Distance = FMath::Min(Distance, (double)PrimitiveDistance);
+		}
+
+		// the query reports zero anywhere inside, half a cell inwards keeps the gradient pointing out across the surface
+		Brick.Distances[Index] = Distance > 0.0 ? Distance : -VoxelSize * 0.5;
+
+		if ((Index & 63) == 63 && FPlatformTime::Seconds() >= Deadline)
+		{
+			break;
+		}
+	}
+
+	if (Brick.NextSample < Brick.Distances.Num())
+	{
+		return false;
+	}
+
+	SetBrickState(Brick, FBubbleSDFBrick::EState::Ready);
+	Brick.Primitives.Empty();
+	return true;
+}
+
+void UBubbleSDFSubsystem::SetBrickState(FBubbleSDFBrick& Brick, FBubbleSDFBrick::EState State)
+{
+	FWriteScopeLock WriteLock(BricksLock);
+	Brick.State = State;
+}
+
+void UBubbleSDFSubsystem::EvictUnused()
+{
+	int32 MaxBricks = FMath::Max(CVarBubbleSDFMaxBricks.GetValueOnGameThread(), 1);
+	if (Bricks.Num() <= MaxBricks)
+	{
+		return;
+	}
+
+	double Now = GetWorld()->GetTimeSeconds();
+	TArray<TPair<double, FIntVector>> Candidates;
+	for (const auto& [Coordinates, Brick] : Bricks)
+	{
+		if (Now - Brick->LastUsedTime > EvictionGracePeriod)
+		{
+			Candidates.Emplace(Brick->LastUsedTime, Coordinates);
+		}
+	}
+	Candidates.Sort([](const TPair<double, FIntVector>& A, const TPair<double, FIntVector>& B) { return A.Key < B.Key; });
+
+	FWriteScopeLock WriteLock(BricksLock);
+	for (int32 i = 0; i < Candidates.Num() && Bricks.Num() > MaxBricks; i++)
+	{
+		BakeQueue.Remove(Candidates[i].Value);
+		Bricks.Remove(Candidates[i].Value);
+	}
+}
+
+void UBubbleSDFSubsystem::Tick(float DeltaTime)
+{
+	LLM_SCOPE_BYTAG(BubbleCollision);
+
+	UpdateSettings();
+	EvictUnused();
+
+	double Deadline = FPlatformTime::Seconds() + CVarBubbleSDFBakeBudgetMs.GetValueOnGameThread() / 1000.0;
+	while (!BakeQueue.IsEmpty() && FPlatformTime::Seconds() < Deadline)
+	{
+		TUniquePtr<FBubbleSDFBrick>* Found = Bricks.Find(BakeQueue[0]);
+		if (!Found)
+		{
+			BakeQueue.RemoveAt(0, EAllowShrinking::No);
+			continue;
+		}
+
+		FBubbleSDFBrick& Brick = **Found;
+		if (Brick.State == FBubbleSDFBrick::EState::Queued)
+		{
+			BeginBake(Brick);
+		}
+		if (Brick.State != FBubbleSDFBrick::EState::Baking || ContinueBake(Brick, Deadline))
+		{
+			BakeQueue.RemoveAt(0, EAllowShrinking::No);
+		}
+	}
+}
+
+TStatId UBubbleSDFSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UBubbleSDFSubsystem, STATGROUP_Tickables);
+}
@@ -0,0 +1,99 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/CriticalSection.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "BubbleSDFSubsystem.generated.h"
+
+class UPrimitiveComponent;
+
+/** Distance samples of static collision on a regular grid covering one cell of the brick grid */
+struct FBubbleSDFBrick
+{
+	enum class EState : uint8
+	{
+		Queued,
+		Baking,
+		Ready,
+
+		/** Some static shape does not support distance queries, vertices here keep tracing the scene */
+		Unsupported,
+	};
+
+	EState State = EState::Queued;
+
+	FIntVector Coordinates = FIntVector::ZeroValue;
+
+	/** World position of sample (0, 0, 0) */
+	FVector Origin = FVector::ZeroVector;
+
+	/** Distance to the nearest static surface, negative inside */
+	TArray<float> Distances;
+
+	/** Static primitives near the brick, gathered before baking */
+	TArray<TWeakObjectPtr<UPrimitiveComponent>> Primitives;
+
+	/** Samples baked so far, in the order of Distances */
+	int32 NextSample = 0;
+
+	double LastUsedTime = 0.0;
+};
+
+/**
+ * Caches signed distances to static level geometry in bricks on a world-aligned grid, shared by
+ * all bubbles. Bubbles request the bricks around them, the bricks are baked from the static
+ * collision within a per-frame time budget, and vertex collision against static geometry becomes
+ * a trilinear lookup with a gradient instead of a scene trace. Static geometry is assumed not to
+ * move; InvalidateRegion rebakes bricks after it does. Sample may be called from bubble solves on
+ * worker threads, everything else belongs to the game thread.
+ */
+UCLASS()
+class BUBBLEGUN_API UBubbleSDFSubsystem : public UTickableWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	/** Queues the bricks overlapping the box for baking and marks them as used */
+	void RequestRegion(const FBox& Box);
+
+	/** Distance and its gradient at a world location, false if the brick is not baked. Thread safe. */
+	bool Sample(const FVector& Location, float& OutDistance, FVector& OutGradient) const;
+
+	/** Drops the bricks overlapping the box, e.g. after static geometry moved */
+	void InvalidateRegion(const FBox& Box);
+
+	// FTickableGameObject
+	virtual void Tick(float DeltaTime) override;
+	virtual TStatId GetStatId() const override;
+
+private:
+	FIntVector GetBrickCoordinates(const FVector& Location) const;
+
+	/** Gathers the static primitives of a brick, a brick without any is ready right away */
+	void BeginBake(FBubbleSDFBrick& Brick);
+
+	/** Drops the cache when the brick CVars changed */
+	void UpdateSettings();
+
+	/** Bakes samples until the deadline, returns true when the brick is done */
+	bool ContinueBake(FBubbleSDFBrick& Brick, double Deadline);
+
+	void EvictUnused();
+
+	/** Marks a brick baked or unsupported, only then does Sample start or stop reading its distances */
+	void SetBrickState(FBubbleSDFBrick& Brick, FBubbleSDFBrick::EState State);
+
+	TMap<FIntVector, TUniquePtr<FBubbleSDFBrick>> Bricks;
+
+	TArray<FIntVector> BakeQueue;
+
+	/** Brick size and resolution the cache was built with, bricks are dropped when the CVars change */
+	double BrickSize = 0.0;
+
+	int32 BrickResolution = 0;
+
+	/** Held for reading by Sample, for writing by the game thread whenever it changes the map, the settings or a brick state */
+	mutable FRWLock BricksLock;
+};
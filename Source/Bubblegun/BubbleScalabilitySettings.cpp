@@ -0,0 +1,53 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "BubbleScalabilitySettings.h"
+
+static TAutoConsoleVariable<int32> CVarBubbleQuality(
+	TEXT("sg.BubbleQuality"),
+	-1,
+	TEXT("Bubble quality level, 0 (low) to 3 (epic). -1 follows sg.EffectsQuality."),
+	ECVF_ScalabilityGroup);
+
+UBubbleScalabilitySettings::UBubbleScalabilitySettings()
+{
+	FBubbleQualityLevel& Low = QualityLevels.AddDefaulted_GetRef();
+	Low.MaxSubdivisions = 1;
+	Low.MaxSimRate = 30.0f;
+	Low.CollisionMode = EBubbleCollisionMode::SurfaceOnly;
+	Low.MaxActiveBubbles = 8;
+	Low.RenderPath = EBubbleRenderPath::FarFieldWhenDistant;
+
+	FBubbleQualityLevel& Medium = QualityLevels.AddDefaulted_GetRef();
+	Medium.MaxSubdivisions = 2;
+	Medium.MaxSimRate = 30.0f;
+	Medium.CollisionMode = EBubbleCollisionMode::StaticSDF;
+	Medium.MaxActiveBubbles = 24;
+
+	FBubbleQualityLevel& High = QualityLevels.AddDefaulted_GetRef();
+	High.MaxSubdivisions = 3;
+	High.MaxActiveBubbles = 64;
+
+	FBubbleQualityLevel& Epic = QualityLevels.AddDefaulted_GetRef();
+	Epic.MaxSubdivisions = 4;
+}
+
+int32 UBubbleScalabilitySettings::GetActiveLevelIndex()
+{
+	int32 Level = CVarBubbleQuality.GetValueOnGameThread();
+	if (Level < 0)
+	{
+		static const IConsoleVariable* EffectsQuality = IConsoleManager::Get().FindConsoleVariable(TEXT("sg.EffectsQuality"));
+		Level = EffectsQuality ? EffectsQuality->GetInt() : 3;
+	}
+
+	int32 NumLevels = GetDefault<UBubbleScalabilitySettings>()->QualityLevels.Num();
+	return FMath::Clamp(Level, 0, FMath::Max(NumLevels - 1, 0));
+}
+
+const FBubbleQualityLevel& UBubbleScalabilitySettings::GetActiveLevel()
+{
+	static const FBubbleQualityLevel Fallback;
+	const TArray<FBubbleQualityLevel>& Levels = GetDefault<UBubbleScalabilitySettings>()->QualityLevels;
+	return Levels.IsEmpty() ? Fallback : Levels[GetActiveLevelIndex()];
+}
@@ -0,0 +1,83 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Engine/DeveloperSettings.h"
+#include "BubbleScalabilitySettings.generated.h"
+
+UENUM(BlueprintType)
+enum class EBubbleCollisionMode : uint8
+{
+	/** Collision of the deformed surface, and every vertex traces against the world each step */
+	Full,
+
+	/** Collision of the deformed surface only, vertices pass through the world */
+	SurfaceOnly,
+
+	/**
+	 * Collision of the deformed surface, vertices collide with a cached distance field of static
+	 * geometry and trace only against dynamic objects, and only when one is near the bubble
+	 */
+	StaticSDF,
+};
+
+UENUM(BlueprintType)
+enum class EBubbleRenderPath : uint8
+{
+	/** Every bubble draws its own dynamic mesh */
+	DynamicMesh,
+
+	/** Bubbles beyond bubble.FarFieldDistance are drawn as shared instances */
+	FarFieldWhenDistant,
+
+	/** All bubbles are drawn as shared instances */
+	FarFieldAlways,
+};
+
+USTRUCT(BlueprintType)
+struct FBubbleQualityLevel
+{
+	GENERATED_BODY()
+
+	/** Bubbles with more subdivisions are simulated at this level */
+	UPROPERTY(EditAnywhere, Category = "Bubble", meta = (ClampMin = "0", ClampMax = "6"))
+	int32 MaxSubdivisions = 3;
+
+	/** Most steps per second a bubble takes, 0 for one every frame */
+	UPROPERTY(EditAnywhere, Category = "Bubble", meta = (ClampMin = "0"))
+	float MaxSimRate = 0.0f;
+
+	UPROPERTY(EditAnywhere, Category = "Bubble")
+	EBubbleCollisionMode CollisionMode = EBubbleCollisionMode::Full;
+
+	/** Bubbles beyond this many get only the cheap catch-up step, nearest and touched ones first; 0 for no limit */
+	UPROPERTY(EditAnywhere, Category = "Bubble", meta = (ClampMin = "0"))
+	int32 MaxActiveBubbles = 0;
+
+	UPROPERTY(EditAnywhere, Category = "Bubble")
+	EBubbleRenderPath RenderPath = EBubbleRenderPath::FarFieldWhenDistant;
+};
+
+/**
+ * Maps the bubble quality level to the cost knobs of the bubble simulation. The level is
+ * sg.BubbleQuality, or sg.EffectsQuality while that is -1, and changes apply to live bubbles on
+ * the next simulation tick.
+ */
+UCLASS(Config = Game, DefaultConfig, meta = (DisplayName = "Bubble Scalability"))
+class BUBBLEGUN_API UBubbleScalabilitySettings : public UDeveloperSettings
+{
+	GENERATED_BODY()
+
+public:
+	UBubbleScalabilitySettings();
+
+	/** Low, Medium, High and Epic; higher scalability levels use the last entry */
+	UPROPERTY(Config, EditAnywhere, Category = "Bubble")
+	TArray<FBubbleQualityLevel> QualityLevels;
+
+	/** Index into QualityLevels currently in effect */
+	static int32 GetActiveLevelIndex();
+
+	static const FBubbleQualityLevel& GetActiveLevel();
+};
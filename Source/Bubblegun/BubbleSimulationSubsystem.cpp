@@ -0,0 +1,330 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "BubbleSimulationSubsystem.h"
+
+#include "Bubble.h"
+#include "Bubblegun.h"
+#include "BubbleScalabilitySettings.h"
+#include "Engine/World.h"
+#include "GameFramework/PlayerController.h"
+
+static TAutoConsoleVariable<float> CVarBubbleSimBudgetMs(
+	TEXT("bubble.SimBudgetMs"),
+	2.0f,
+	TEXT("Time in milliseconds the bubble simulation may use per frame: the game thread part of each step plus the worker time its last solve took. The most overdue bubble is always stepped."),
+	ECVF_Default);
+
+static TAutoConsoleVariable<int32> CVarBubbleSimMaxSubsteps(
+	TEXT("bubble.SimMaxSubsteps"),
+	4,
+	TEXT("Maximum number of solver substeps a bubble takes to integrate the time it waited, the rest is caught up cheaply."),
+	ECVF_Default);
+
+static TAutoConsoleVariable<float> CVarBubbleSimFullRateDistance(
+	TEXT("bubble.SimFullRateDistance"),
+	3000.0f,
+	TEXT("Visible bubbles closer than this to a viewer are stepped every frame, farther ones down to 15 times a second."),
+	ECVF_Default);
+
+static TAutoConsoleVariable<float> CVarBubbleSimDormantInterval(
+	TEXT("bubble.SimDormantInterval"),
+	0.5f,
+	TEXT("Seconds between the cheap catch-up steps of bubbles that are not rendered and not touched."),
+	ECVF_Default);
+
+static TAutoConsoleVariable<int32> CVarBubbleRemeshMaxPerFrame(
+	TEXT("bubble.RemeshMaxPerFrame"),
+	2,
+	TEXT("Bubbles moved to another subdivision level per frame at most. Each move rebuilds the mesh and its collision."),
+	ECVF_Default);
+
+static FAutoConsoleCommandWithWorldArgsAndOutputDevice BubbleMemReportCommand(
+	TEXT("bubble.MemReport"),
+	TEXT("Prints the estimated memory held by live bubbles, grouped by subdivision level."),
+	FConsoleCommandWithWorldArgsAndOutputDeviceDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World, FOutputDevice& Ar)
+	{
+		if (UBubbleSimulationSubsystem* Subsystem = World ? World->GetSubsystem<UBubbleSimulationSubsystem>() : nullptr)
+		{
+			Subsystem->ReportMemory(Ar);
+		}
+	}));
+
+namespace
+{
+	/** Bubbles hit within this many seconds stay at full rate even when off-screen */
+	constexpr double InteractionGracePeriod = 1.0;
+
+	/** Longest interval of a visible bubble, the solver's maximum stable step */
+	constexpr double MaxVisibleInterval = 1.0 / 15.0;
+
+	/** Half-angle of the cone in front of a viewpoint that counts as in view, wider than any gameplay FOV */
+	const double ViewConeCos = FMath::Cos(FMath::DegreesToRadians(70.0));
+}
+
+void UBubbleSimulationSubsystem::RegisterBubble(ABubble* Bubble)
+{
+	LLM_SCOPE_BYTAG(BubbleSimulation);
+
+	FScheduledBubble& Scheduled = Bubbles.AddDefaulted_GetRef();
+	Scheduled.Bubble = Bubble;
+
+	// restored snapshots may come from a higher quality level
+	Bubble->SetSubdivisionCap(UBubbleScalabilitySettings::GetActiveLevel().MaxSubdivisions);
+}
+
+void UBubbleSimulationSubsystem::UnregisterBubble(ABubble* Bubble)
+{
+	Bubbles.RemoveAllSwap([Bubble](const FScheduledBubble& Scheduled) { return Scheduled.Bubble.Get() == Bubble; }, EAllowShrinking::No);
+}
+
+void UBubbleSimulationSubsystem::GatherViewLocations()
+{
+	ViewLocations.Reset();
+	ViewDirections.Reset();
+	for (FConstPlayerControllerIterator It = GetWorld()->GetPlayerControllerIterator(); It; ++It)
+	{
+		if (const APlayerController* PlayerController = It->Get())
+		{
+			FVector Location;
+			FRotator Rotation;
+			PlayerController->GetPlayerViewPoint(Location, Rotation);
+			ViewLocations.Add(Location);
+			ViewDirections.Add(Rotation.Vector());
+		}
+	}
+}
+
+double UBubbleSimulationSubsystem::GetViewDistance(const FVector& Location) const
+{
+	double DistanceSquared = ViewLocations.Num() > 0 ? UE_BIG_NUMBER : 0.0;
+	for (const FVector& ViewLocation : ViewLocations)
+	{
+		DistanceSquared = FMath::Min(DistanceSquared, FVector::DistSquared(Location, ViewLocation));
+	}
+	return FMath::Sqrt(DistanceSquared);
+}
+
+bool UBubbleSimulationSubsystem::IsInView(const FVector& Location, double Radius) const
+{
+	for (int32 i = 0; i < ViewLocations.Num(); i++)
+	{
+		FVector Offset = Location - ViewLocations[i];
+		double Distance = Offset.Size();
+		if (Distance <= Radius || FVector::DotProduct(Offset, ViewDirections[i]) + Radius >= Distance * ViewConeCos)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+double UBubbleSimulationSubsystem::GetUpdateInterval(const ABubble* Bubble, double Now, bool& bOutFullStep, double& OutWeight) const
+{
+	bOutFullStep = true;
+
+	if (Bubble->Contacts.Num() > 0 || Now - Bubble->GetLastInteractionTime() < InteractionGracePeriod)
+	{
+		OutWeight = 4.0;
+		return 0.0;
+	}
+
+	// headless bubbles render nothing and are scheduled by distance alone; far-field bubbles are drawn as
+	// instances and have no render proxy of their own to ask
+	FVector Center = Bubble->GetActorLocation() + Bubble->CenterOfMass;
+	bool bVisible = Bubble->IsHeadless()
+		|| (Bubble->IsFarField() ? IsInView(Center, Bubble->ActualRadius) : Bubble->WasRecentlyRendered(0.25f));
+	if (!bVisible)
+	{
+		bOutFullStep = false;
+		OutWeight = 1.0;
+		return CVarBubbleSimDormantInterval.GetValueOnGameThread();
+	}
+
+	// full rate up to the distance, then slowing down to the maximum interval at four times the distance
+	double FullRateDistance = FMath::Max(CVarBubbleSimFullRateDistance.GetValueOnGameThread(), 1.0f);
+	double Falloff = FMath::Clamp((GetViewDistance(Center) / FullRateDistance - 1.0) / 3.0, 0.0, 1.0);
+	OutWeight = 2.0;
+	return Falloff * MaxVisibleInterval;
+}
+
+void UBubbleSimulationSubsystem::Tick(float DeltaTime)
+{
+	LLM_SCOPE_BYTAG(BubbleSimulation);
+
+	GatherViewLocations();
+
+	// a quality change reaches existing bubbles here, the other knobs are read every tick
+	const FBubbleQualityLevel& Quality = UBubbleScalabilitySettings::GetActiveLevel();
+	int32 QualityLevel = UBubbleScalabilitySettings::GetActiveLevelIndex();
+	bool bQualityChanged = QualityLevel != AppliedQualityLevel;
+	AppliedQualityLevel = QualityLevel;
+	double MinInterval = Quality.MaxSimRate > 0.0f ? 1.0 / Quality.MaxSimRate : 0.0;
+
+	double Now = GetWorld()->GetTimeSeconds();
+	int32 RemeshBudget = CVarBubbleRemeshMaxPerFrame.GetValueOnGameThread();
+	DueBubbles.Reset();
+
+	// destroyed bubbles go first, the due list below refers to the others by index
+	Bubbles.RemoveAllSwap([](const FScheduledBubble& Scheduled) { return !IsValid(Scheduled.Bubble.Get()); }, EAllowShrinking::No);
+
+	for (int32 i = Bubbles.Num() - 1; i >= 0; i--)
+	{
+		FScheduledBubble& Scheduled = Bubbles[i];
+		ABubble* Bubble = Scheduled.Bubble.Get();
+
+		// solves launched last frame become visible here, the ones still running are waited for when the bubble is stepped again
+		Bubble->CompleteSimulation(false);
+		Bubble->ProcessCommands();
+
+		if (bQualityChanged)
+		{
+			Bubble->SetSubdivisionCap(Quality.MaxSubdivisions);
+		}
+
+		Scheduled.PendingTime += DeltaTime;
+
+		FDueBubble& Due = DueBubbles.AddDefaulted_GetRef();
+		Due.Index = i;
+		Due.Interval = GetUpdateInterval(Bubble, Now, Due.bFullStep, Due.Weight);
+		Due.Distance = GetViewDistance(Bubble->GetActorLocation() + Bubble->CenterOfMass);
+		if (Due.bFullStep)
+		{
+			Due.Interval = FMath::Max(Due.Interval, MinInterval);
+		}
+
+		// bubbles that grew, shrank or moved away get a subdivision level matching their size on screen
+		int32 Subdivisions = Bubble->GetAdaptiveSubdivisions(Due.Distance);
+		if (RemeshBudget > 0 && Subdivisions != Bubble->GetMeshSubdivisions())
+		{
+			Bubble->Remesh(Subdivisions);
+			RemeshBudget--;
+		}
+	}
+
+	// only the touched and then the nearest bubbles keep full steps, the rest just catch up
+	if (Quality.MaxActiveBubbles > 0)
+	{
+		TArray<FDueBubble*, TInlineAllocator<128>> Active;
+		for (FDueBubble& Due : DueBubbles)
+		{
+			if (Due.bFullStep)
+			{
+				Active.Add(&Due);
+			}
+		}
+
+		if (Active.Num() > Quality.MaxActiveBubbles)
+		{
+			Active.Sort([](const FDueBubble& A, const FDueBubble& B)
+			{
+				return A.Weight != B.Weight ? A.Weight > B.Weight : A.Distance < B.Distance;
+			});
+			for (int32 i = Quality.MaxActiveBubbles; i < Active.Num(); i++)
+			{
+				Active[i]->bFullStep = false;
+				Active[i]->Interval = CVarBubbleSimDormantInterval.GetValueOnGameThread();
+				Active[i]->Weight = 1.0;
+			}
+		}
+	}
+
+	for (int32 i = DueBubbles.Num() - 1; i >= 0; i--)
+	{
+		FDueBubble& Due = DueBubbles[i];
+		double PendingTime = Bubbles[Due.Index].PendingTime;
+		if (PendingTime < Due.Interval)
+		{
+			DueBubbles.RemoveAtSwap(i, EAllowShrinking::No);
+			continue;
+		}
+
+		// how many frames the bubble is overdue, scaled by how much it matters
+		Due.Priority = PendingTime / FMath::Max(Due.Interval, (double)DeltaTime) * Due.Weight;
+	}
+
+	DueBubbles.Sort([](const FDueBubble& A, const FDueBubble& B) { return A.Priority > B.Priority; });
+
+	double BudgetSeconds = CVarBubbleSimBudgetMs.GetValueOnGameThread() / 1000.0;
+	int32 MaxSubsteps = CVarBubbleSimMaxSubsteps.GetValueOnGameThread();
+	double StartTime = FPlatformTime::Seconds();
+	double WorkerSeconds = 0.0;
+	for (int32 i = 0; i < DueBubbles.Num(); i++)
+	{
+		// bubbles left over keep their pending time and rise in priority next frame
+		if (i > 0 && FPlatformTime::Seconds() - StartTime + WorkerSeconds >= BudgetSeconds)
+		{
+			break;
+		}
+
+		FScheduledBubble& Scheduled = Bubbles[DueBubbles[i].Index];
+		ABubble* Bubble = Scheduled.Bubble.Get();
+		if (!IsValid(Bubble))
+		{
+			continue;
+		}
+
+		if (DueBubbles[i].bFullStep)
+		{
+			Bubble->StepSimulation(Scheduled.PendingTime, MaxSubsteps);
+		}
+		else
+		{
+			Bubble->CatchUpSimulation(Scheduled.PendingTime);
+		}
+		Scheduled.PendingTime = 0.0;
+
+		// a solve launched on a worker costs about what the bubble's last one did, inline ones were timed above
+		if (Bubble->IsSolvePending())
+		{
+			WorkerSeconds += Bubble->GetLastSolveSeconds();
+		}
+	}
+}
+
+void UBubbleSimulationSubsystem::ReportMemory(FOutputDevice& Ar) const
+{
+	struct FLevelUsage
+	{
+		int32 Count = 0;
+		FBubbleMemoryUsage Usage;
+	};
+
+	TSortedMap<int32, FLevelUsage> Levels;
+	FLevelUsage Total;
+	for (const FScheduledBubble& Scheduled : Bubbles)
+	{
+		if (const ABubble* Bubble = Scheduled.Bubble.Get())
+		{
+			FBubbleMemoryUsage Usage = Bubble->GetMemoryUsage();
+			FLevelUsage& Level = Levels.FindOrAdd(Bubble->GetMeshSubdivisions());
+			Level.Count++;
+			Level.Usage += Usage;
+			Total.Count++;
+			Total.Usage += Usage;
+		}
+	}
+
+	auto LogRow = [&Ar](const TCHAR* Label, const FLevelUsage& Level)
+	{
+		Ar.Logf(TEXT("%-10s %6d %12.1f %12.1f %12.1f %12.1f %12.1f %12.1f"), Label, Level.Count,
+			Level.Usage.Simulation / 1024.0, Level.Usage.Mesh / 1024.0, Level.Usage.Collision / 1024.0, Level.Usage.Material / 1024.0,
+			Level.Usage.GetTotal() / 1024.0, Level.Count > 0 ? Level.Usage.GetTotal() / 1024.0 / Level.Count : 0.0);
+	};
+
+	Ar.Logf(TEXT("Bubble memory in KiB, mesh sizes are estimated from element counts"));
+	Ar.Logf(TEXT("%-10s %6s %12s %12s %12s %12s %12s %12s"), TEXT("Subdiv"), TEXT("Count"), TEXT("Simulation"), TEXT("Mesh"), TEXT("Collision"), TEXT("Material"), TEXT("Total"), TEXT("PerBubble"));
+	for (const auto& [Subdivisions, Level] : Levels)
+	{
+		LogRow(*FString::FromInt(Subdivisions), Level);
+	}
+	LogRow(TEXT("All"), Total);
+
+	SIZE_T SchedulerBytes = Bubbles.GetAllocatedSize() + DueBubbles.GetAllocatedSize() + ViewLocations.GetAllocatedSize() + ViewDirections.GetAllocatedSize();
+	Ar.Logf(TEXT("Scheduler: %.1f KiB"), SchedulerBytes / 1024.0);
+}
+
+TStatId UBubbleSimulationSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UBubbleSimulationSubsystem, STATGROUP_Tickables);
+}
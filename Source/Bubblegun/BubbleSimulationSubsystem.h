@@ -0,0 +1,85 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "BubbleSimulationSubsystem.generated.h"
+
+class ABubble;
+
+/**
+ * Steps all bubbles of the world within a per-frame time budget. Each bubble gets an update
+ * interval from recent interaction, visibility and distance to the nearest viewer; due bubbles are
+ * stepped in order of how overdue they are until the budget runs out, and the time a bubble waited
+ * is integrated when it is next stepped. Bubbles nobody has seen for a while only get a cheap
+ * catch-up step. With bubble.AsyncSolve the solve runs on a worker task and is published at the
+ * start of the next tick; the budget counts the game thread part of a step plus the worker time
+ * of the bubble's last solve. A few bubbles per tick are remeshed to the subdivision level
+ * matching their size and distance.
+ */
+UCLASS()
+class BUBBLEGUN_API UBubbleSimulationSubsystem : public UTickableWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	void RegisterBubble(ABubble* Bubble);
+
+	void UnregisterBubble(ABubble* Bubble);
+
+	/** Distance from the location to the nearest player viewpoint of the last tick, 0 if there are none */
+	double GetViewDistance(const FVector& Location) const;
+
+	bool HasViewers() const { return ViewLocations.Num() > 0; }
+
+	/** Coarse check whether a sphere is in front of any viewpoint, for bubbles without their own render proxy */
+	bool IsInView(const FVector& Location, double Radius) const;
+
+	/** Prints the memory of all registered bubbles per subdivision level, backs bubble.MemReport */
+	void ReportMemory(FOutputDevice& Ar) const;
+
+	// FTickableGameObject
+	virtual void Tick(float DeltaTime) override;
+	virtual TStatId GetStatId() const override;
+
+private:
+	struct FScheduledBubble
+	{
+		TWeakObjectPtr<ABubble> Bubble;
+
+		/** Simulation time not yet integrated */
+		double PendingTime = 0.0;
+	};
+
+	struct FDueBubble
+	{
+		int32 Index = INDEX_NONE;
+
+		double Interval = 0.0;
+
+		double Weight = 1.0;
+
+		double Distance = 0.0;
+
+		double Priority = 0.0;
+
+		bool bFullStep = true;
+	};
+
+	void GatherViewLocations();
+
+	/** Seconds between steps for the bubble, sets bOutFullStep to false for the cheap catch-up */
+	double GetUpdateInterval(const ABubble* Bubble, double Now, bool& bOutFullStep, double& OutWeight) const;
+
+	TArray<FScheduledBubble> Bubbles;
+
+	TArray<FVector> ViewLocations;
+
+	TArray<FVector> ViewDirections;
+
+	TArray<FDueBubble> DueBubbles;
+
+	/** Quality level the bubbles' subdivision caps were last set for */
+	int32 AppliedQualityLevel = INDEX_NONE;
+};
@@ -0,0 +1,73 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/**
+ * Binary layout of a bubble snapshot. A snapshot is one contiguous block: the header followed by
+ * the vertex arrays and the contacts at the offsets recorded in the header, each 16-byte aligned,
+ * so the arrays can be read in place from a loaded or memory-mapped buffer. Topology is not
+ * stored, only the subdivision level it is generated from.
+ */
+enum class EBubbleSnapshotFlags : uint16
+{
+	None = 0,
+
+	/** Positions and velocities are stored as float16 instead of float32 */
+	HalfPrecision = 1 << 0,
+};
+ENUM_CLASS_FLAGS(EBubbleSnapshotFlags);
+
+struct FBubbleSnapshotHeader
+{
+	static constexpr uint32 MagicValue = 0x4E534242; // "BBSN"
+
+	/** 2: template vertices are sorted along a space-filling curve; 3: color seed */
+	static constexpr uint16 CurrentVersion = 3;
+
+	uint32 Magic = MagicValue;
+	uint16 Version = CurrentVersion;
+	uint16 Flags = 0;
+
+	/** Topology reference, the mesh is the shared template for this subdivision level */
+	int32 Subdivisions = 0;
+	int32 VertexCount = 0;
+	int32 ContactCount = 0;
+
+	/** ABubble::ColorSeed, 0 if the color is not randomized yet */
+	int32 ColorSeed = 0;
+
+	float Radius = 0;
+	float InitialRadius = 0;
+	float ActualRadius = 0;
+
+	/** Positions are stored relative to the center of mass and divided by this */
+	float PositionScale = 1;
+
+	double AirPressureForce = 0;
+
+	FVector3f CenterOfMass = FVector3f::ZeroVector;
+	FVector3f GlobalForce = FVector3f::ZeroVector;
+	FVector3f BigNoiseVector = FVector3f::ZeroVector;
+	float BigNoiseChangeTimer = 0;
+
+	uint32 PositionsOffset = 0;
+	uint32 VelocitiesOffset = 0;
+	uint32 ContactsOffset = 0;
+
+	/** Serialized path names of the contact actors, one per contact */
+	uint32 ActorPathsOffset = 0;
+
+	uint32 TotalSize = 0;
+};
+
+struct FBubbleSnapshotContact
+{
+	int32 FaceIndex = INDEX_NONE;
+	FVector3f Barycentric = FVector3f::ZeroVector;
+	FVector3f Normal = FVector3f::ZeroVector;
+	float EngageDistance = 0;
+	float VertexFactor = 1;
+	float GlobalFactor = 1;
+};
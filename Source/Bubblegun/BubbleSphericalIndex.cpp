@@ -0,0 +1,386 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "BubbleSphericalIndex.h"
+
+#include "DynamicMesh/DynamicMesh3.h"
+
+using UE::Geometry::FDynamicMesh3;
+using UE::Geometry::FIndex3i;
+
+namespace
+{
+	// Conservative angular width of one cell of the octahedral map, relative to 1 / Resolution.
+	// The whole sphere is 4 pi steradians over Resolution^2 cells and the map distorts areas by up to 2x.
+	constexpr double CellAngleScale = 1.5;
+
+	constexpr double IntersectionTolerance = 1e-6;
+
+	// How far the surface may drift from the built one before NeedsRebuild, relative to the largest radius.
+	// Ray queries clip to the bounding sphere grown by the same amount, so they stay exact until then.
+	constexpr double RadiusTolerance = 0.05;
+
+	// How far a vertex may turn around the center before NeedsRebuild, relative to 1 / Resolution.
+	// Half a cell keeps every triangle within the neighbours FindFace searches.
+	constexpr double DirectionTolerance = 0.5;
+}
+
+FBubbleSphericalIndex::FBubbleSphericalIndex(int32 InResolution)
+	: Resolution(FMath::Max(InResolution, 2))
+{
+}
+
+FVector2d FBubbleSphericalIndex::DirectionToOctahedral(const FVector3d& Direction)
+{
+	double L1 = FMath::Abs(Direction.X) + FMath::Abs(Direction.Y) + FMath::Abs(Direction.Z);
+	if (L1 <= UE_DOUBLE_SMALL_NUMBER)
+	{
+		return FVector2d(0.5, 0.5);
+	}
+
+	FVector3d N = Direction / L1;
+	FVector2d P(N.X, N.Y);
+	if (N.Z < 0)
+	{
+		// fold the lower hemisphere over the diagonals
+		P = FVector2d(
+			(1.0 - FMath::Abs(N.Y)) * (N.X >= 0 ? 1.0 : -1.0),
+			(1.0 - FMath::Abs(N.X)) * (N.Y >= 0 ? 1.0 : -1.0));
+	}
+	return P * 0.5 + FVector2d(0.5, 0.5);
+}
+
+int32 FBubbleSphericalIndex::GetCellIndex(const FVector3d& Direction) const
+{
+	FVector2d UV = DirectionToOctahedral(Direction);
+	int32 X = FMath::Clamp(FMath::FloorToInt32(UV.X * Resolution), 0, Resolution - 1);
+	int32 Y = FMath::Clamp(FMath::FloorToInt32(UV.Y * Resolution), 0, Resolution - 1);
+	return Y * Resolution + X;
+}
+
+int32 FBubbleSphericalIndex::GetWrappedCellIndex(int32 X, int32 Y) const
+{
+	// the edges of the map are the folded lower hemisphere, each edge mirrors onto itself around its middle
+	if (X < 0 || X >= Resolution)
+	{
+		X = X < 0 ? -X - 1 : 2 * Resolution - 1 - X;
+		Y = Resolution - 1 - Y;
+	}
+	if (Y < 0 || Y >= Resolution)
+	{
+		Y = Y < 0 ? -Y - 1 : 2 * Resolution - 1 - Y;
+		X = Resolution - 1 - X;
+	}
+	return Y * Resolution + X;
+}
+
+void FBubbleSphericalIndex::Build(const FDynamicMesh3& Mesh, const FVector3d& InCenter)
+{
+	Center = InCenter;
+	MinRadius = TNumericLimits<double>::Max();
+	MaxRadius = 0.0;
+
+	const int32 NumCells = Resolution * Resolution;
+	const double CellAngle = CellAngleScale / Resolution;
+
+	VertexDirections.SetNumZeroed(Mesh.MaxVertexID());
+	for (int32 VertexId : Mesh.VertexIndicesItr())
+	{
+		VertexDirections[VertexId] = FVector3f((Mesh.GetVertex(VertexId) - Center).GetSafeNormal());
+	}
+
+	TArray<TPair<int32, int32>> CellTrianglePairs;
+	CellTrianglePairs.Reserve(Mesh.TriangleCount() * 2);
+
+	TArray<int32, TInlineAllocator<32>> TriangleCells;
+	for (int32 TriangleId : Mesh.TriangleIndicesItr())
+	{
+		FIndex3i Triangle = Mesh.GetTriangle(TriangleId);
+		FVector3d Directions[3];
+		for (int32 k = 0; k < 3; k++)
+		{
+			FVector3d Offset = Mesh.GetVertex(Triangle[k]) - Center;
+			double Distance = Offset.Size();
+			MinRadius = FMath::Min(MinRadius, Distance);
+			MaxRadius = FMath::Max(MaxRadius, Distance);
+			Directions[k] = Distance > UE_DOUBLE_SMALL_NUMBER ? Offset / Distance : FVector3d::UnitZ();
+		}
+
+		double MaxEdgeAngle = 0.0;
+		for (int32 k = 0; k < 3; k++)
+		{
+			double Cos = FMath::Clamp(Directions[k].Dot(Directions[(k + 1) % 3]), -1.0, 1.0);
+			MaxEdgeAngle = FMath::Max(MaxEdgeAngle, FMath::Acos(Cos));
+		}
+
+		// sample the spherical triangle densely enough that no covered cell is skipped
+		int32 Samples = FMath::Clamp(FMath::CeilToInt32(MaxEdgeAngle / (CellAngle * 0.5)), 1, 64);
+		TriangleCells.Reset();
+		for (int32 i = 0; i <= Samples; i++)
+		{
+			for (int32 j = 0; j <= Samples - i; j++)
+			{
+				double A = double(i) / Samples;
+				double B = double(j) / Samples;
+				FVector3d Direction = Directions[0] * A + Directions[1] * B + Directions[2] * (1.0 - A - B);
+				TriangleCells.AddUnique(GetCellIndex(Direction));
+			}
+		}
+
+		for (int32 Cell : TriangleCells)
+		{
+			CellTrianglePairs.Emplace(Cell, TriangleId);
+		}
+	}
+
+	// counting sort into a compressed cell -> triangles table
+	CellStart.Init(0, NumCells + 1);
+	for (const auto& Pair : CellTrianglePairs)
+	{
+		CellStart[Pair.Key + 1]++;
+	}
+	for (int32 i = 0; i < NumCells; i++)
+	{
+		CellStart[i + 1] += CellStart[i];
+	}
+
+	TArray<int32> Cursor(CellStart.GetData(), NumCells);
+	CellTriangles.SetNumUninitialized(CellTrianglePairs.Num());
+	for (const auto& Pair : CellTrianglePairs)
+	{
+		CellTriangles[Cursor[Pair.Key]++] = Pair.Value;
+	}
+
+	if (MaxRadius <= 0.0)
+	{
+		MinRadius = 0.0;
+	}
+	bValid = Mesh.TriangleCount() > 0;
+}
+
+bool FBubbleSphericalIndex::NeedsRebuild(const FDynamicMesh3& Mesh, const FVector3d& InCenter) const
+{
+	if (!bValid || Mesh.MaxVertexID() != VertexDirections.Num())
+	{
+		return true;
+	}
+
+	const double Tolerance = MaxRadius * RadiusTolerance;
+	if (FVector3d::DistSquared(InCenter, Center) > Tolerance * Tolerance)
+	{
+		return true;
+	}
+
+	const double MinDistance = FMath::Max(MinRadius - Tolerance, 0.0);
+	const double MaxDistance = MaxRadius + Tolerance;
+	const double MinCos = FMath::Cos(DirectionTolerance / Resolution);
+	for (int32 VertexId : Mesh.VertexIndicesItr())
+	{
+		FVector3d Offset = Mesh.GetVertex(VertexId) - Center;
+		double Distance = Offset.Size();
+		if (Distance < MinDistance || Distance > MaxDistance)
+		{
+			return true;
+		}
+		if (Distance > UE_DOUBLE_SMALL_NUMBER && Offset.Dot(FVector3d(VertexDirections[VertexId])) < MinCos * Distance)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+void FBubbleSphericalIndex::GatherCandidates(int32 Cell, TArray<int32, TInlineAllocator<64>>& OutTriangles) const
+{
+	for (int32 i = CellStart[Cell]; i < CellStart[Cell + 1]; i++)
+	{
+		OutTriangles.AddUnique(CellTriangles[i]);
+	}
+}
+
+double FBubbleSphericalIndex::IntersectTriangle(const FVector3d& Origin, const FVector3d& Direction, const FVector3d& V0, const FVector3d& V1, const FVector3d& V2)
+{
+	FVector3d E1 = V1 - V0;
+	FVector3d E2 = V2 - V0;
+	FVector3d P = Direction.Cross(E2);
+	double Det = E1.Dot(P);
+	if (FMath::Abs(Det) < UE_DOUBLE_SMALL_NUMBER)
+	{
+		return -1.0;
+	}
+
+	double InvDet = 1.0 / Det;
+	FVector3d T = Origin - V0;
+	double U = T.Dot(P) * InvDet;
+	if (U < -IntersectionTolerance || U > 1.0 + IntersectionTolerance)
+	{
+		return -1.0;
+	}
+
+	FVector3d Q = T.Cross(E1);
+	double V = Direction.Dot(Q) * InvDet;
+	if (V < -IntersectionTolerance || U + V > 1.0 + IntersectionTolerance)
+	{
+		return -1.0;
+	}
+
+	return E2.Dot(Q) * InvDet;
+}
+
+int32 FBubbleSphericalIndex::FindFace(const FDynamicMesh3& Mesh, const FVector3d& Direction) const
+{
+	if (!bValid || Direction.IsNearlyZero())
+	{
+		return INDEX_NONE;
+	}
+
+	FVector3d RayDirection = Direction.GetSafeNormal();
+	int32 Cell = GetCellIndex(RayDirection);
+
+	TArray<int32, TInlineAllocator<64>> Candidates;
+	GatherCandidates(Cell, Candidates);
+
+	auto TestCandidates = [&]() -> int32 {
+		for (int32 TriangleId : Candidates)
+		{
+			if (!Mesh.IsTriangle(TriangleId))
+			{
+				continue;
+			}
+			FVector3d V0, V1, V2;
+			Mesh.GetTriVertices(TriangleId, V0, V1, V2);
+			if (IntersectTriangle(Center, RayDirection, V0, V1, V2) >= 0.0)
+			{
+				return TriangleId;
+			}
+		}
+		return INDEX_NONE;
+	};
+
+	int32 Found = TestCandidates();
+	if (Found != INDEX_NONE)
+	{
+		return Found;
+	}
+
+	// the surface moved since the last build, look in the neighbouring cells as well
+	int32 CellX = Cell % Resolution;
+	int32 CellY = Cell / Resolution;
+	for (int32 Y = CellY - 1; Y <= CellY + 1; Y++)
+	{
+		for (int32 X = CellX - 1; X <= CellX + 1; X++)
+		{
+			GatherCandidates(GetWrappedCellIndex(X, Y), Candidates);
+		}
+	}
+	Found = TestCandidates();
+	if (Found != INDEX_NONE)
+	{
+		return Found;
+	}
+
+	// the index is further behind the surface than NeedsRebuild allows, test every triangle
+	Candidates.Reset();
+	for (int32 TriangleId : Mesh.TriangleIndicesItr())
+	{
+		Candidates.Add(TriangleId);
+	}
+	return TestCandidates();
+}
+
+bool FBubbleSphericalIndex::Raycast(const FDynamicMesh3& Mesh, const FVector3d& Origin, const FVector3d& Direction, double MaxDistance, double& OutDistance, int32& OutFaceIndex) const
+{
+	OutFaceIndex = INDEX_NONE;
+	if (!bValid)
+	{
+		return false;
+	}
+
+	// clip the ray to the bounding sphere around the center
+	double BoundingRadius = MaxRadius * (1.0 + RadiusTolerance);
+	FVector3d ToOrigin = Origin - Center;
+	double B = Direction.Dot(ToOrigin);
+	double C = ToOrigin.SizeSquared() - BoundingRadius * BoundingRadius;
+	double Discriminant = B * B - C;
+	if (Discriminant < 0.0)
+	{
+		return false;
+	}
+	double Sqrt = FMath::Sqrt(Discriminant);
+	double TMin = FMath::Max(-B - Sqrt, 0.0);
+	double TMax = FMath::Min(-B + Sqrt, MaxDistance);
+	if (TMin > TMax)
+	{
+		return false;
+	}
+
+	// walk the chord and collect the cells it passes over
+	double Step = FMath::Max(MinRadius * (1.0 - RadiusTolerance), 1.0) * CellAngleScale / Resolution * 0.5;
+	int32 Steps = FMath::Clamp(FMath::CeilToInt32((TMax - TMin) / Step), 1, Resolution * 4);
+	TArray<int32, TInlineAllocator<64>> Cells;
+	for (int32 i = 0; i <= Steps; i++)
+	{
+		FVector3d Point = ToOrigin + Direction * (TMin + (TMax - TMin) * i / Steps);
+		if (!Point.IsNearlyZero())
+		{
+			Cells.AddUnique(GetCellIndex(Point));
+		}
+	}
+
+	TArray<int32, TInlineAllocator<64>> Candidates;
+	for (int32 Cell : Cells)
+	{
+		GatherCandidates(Cell, Candidates);
+	}
+
+	auto TestCandidates = [&]() -> bool {
+		OutDistance = TNumericLimits<double>::Max();
+		for (int32 TriangleId : Candidates)
+		{
+			if (!Mesh.IsTriangle(TriangleId))
+			{
+				continue;
+			}
+			FVector3d V0, V1, V2;
+			Mesh.GetTriVertices(TriangleId, V0, V1, V2);
+			double T = IntersectTriangle(Origin, Direction, V0, V1, V2);
+			if (T >= 0.0 && T <= MaxDistance && T < OutDistance)
+			{
+				OutDistance = T;
+				OutFaceIndex = TriangleId;
+			}
+		}
+		return OutFaceIndex != INDEX_NONE;
+	};
+
+	if (TestCandidates())
+	{
+		return true;
+	}
+
+	// the surface moved since the last build, look in the neighbouring cells as well
+	TArray<int32, TInlineAllocator<64>> NeighbourCells;
+	for (int32 Cell : Cells)
+	{
+		int32 CellX = Cell % Resolution;
+		int32 CellY = Cell / Resolution;
+		for (int32 Y = CellY - 1; Y <= CellY + 1; Y++)
+		{
+			for (int32 X = CellX - 1; X <= CellX + 1; X++)
+			{
+				int32 Neighbour = GetWrappedCellIndex(X, Y);
+				if (!Cells.Contains(Neighbour))
+				{
+					NeighbourCells.AddUnique(Neighbour);
+				}
+			}
+		}
+	}
+
+	Candidates.Reset();
+	for (int32 Cell : NeighbourCells)
+	{
+		GatherCandidates(Cell, Candidates);
+	}
+	return TestCandidates();
+}
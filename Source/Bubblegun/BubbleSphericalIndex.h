@@ -0,0 +1,72 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+namespace UE::Geometry { class FDynamicMesh3; }
+
+/**
+ * Buckets the triangles of a star-shaped mesh by their direction from a center point, using an
+ * octahedral map of the sphere. Answers "which triangle is in direction d" and ray queries by
+ * testing only the few triangles in the cells the query touches, instead of the whole mesh.
+ *
+ * Only triangle ids are stored, queries test against the live mesh, so a slightly stale index
+ * still gives exact results. NeedsRebuild tells when the surface drifted too far for that.
+ */
+class BUBBLEGUN_API FBubbleSphericalIndex
+{
+public:
+	explicit FBubbleSphericalIndex(int32 InResolution = 16);
+
+	void Build(const UE::Geometry::FDynamicMesh3& Mesh, const FVector3d& InCenter);
+
+	void Invalidate() { bValid = false; }
+
+	bool IsValid() const { return bValid; }
+
+	/** True when the vertices moved too far from where the index was built to be found from their old cells */
+	bool NeedsRebuild(const UE::Geometry::FDynamicMesh3& Mesh, const FVector3d& InCenter) const;
+
+	const FVector3d& GetCenter() const { return Center; }
+
+	SIZE_T GetAllocatedSize() const { return CellStart.GetAllocatedSize() + CellTriangles.GetAllocatedSize() + VertexDirections.GetAllocatedSize(); }
+
+	/** Triangle the ray from the center in Direction passes through, or INDEX_NONE */
+	int32 FindFace(const UE::Geometry::FDynamicMesh3& Mesh, const FVector3d& Direction) const;
+
+	/** First intersection of a ray with the surface, in mesh space. Direction must be normalized. */
+	bool Raycast(const UE::Geometry::FDynamicMesh3& Mesh, const FVector3d& Origin, const FVector3d& Direction, double MaxDistance, double& OutDistance, int32& OutFaceIndex) const;
+
+	/** Maps a direction onto the unit square */
+	static FVector2d DirectionToOctahedral(const FVector3d& Direction);
+
+private:
+	int32 GetCellIndex(const FVector3d& Direction) const;
+
+	/** Cell at X, Y, continuing across the fold of the map when they are past its edges */
+	int32 GetWrappedCellIndex(int32 X, int32 Y) const;
+
+	void GatherCandidates(int32 Cell, TArray<int32, TInlineAllocator<64>>& OutTriangles) const;
+
+	/** Ray-triangle intersection, returns the ray parameter or a negative value on a miss */
+	static double IntersectTriangle(const FVector3d& Origin, const FVector3d& Direction, const FVector3d& V0, const FVector3d& V1, const FVector3d& V2);
+
+	int32 Resolution;
+
+	FVector3d Center = FVector3d::Zero();
+
+	double MinRadius = 0.0;
+
+	double MaxRadius = 0.0;
+
+	/** Triangles of cell i are CellTriangles[CellStart[i] .. CellStart[i + 1]) */
+	TArray<int32> CellStart;
+
+	TArray<int32> CellTriangles;
+
+	/** Direction of each vertex from the center when the index was built */
+	TArray<FVector3f> VertexDirections;
+
+	bool bValid = false;
+};
@@ -0,0 +1,168 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "BubbleStateSubsystem.h"
+
+#include "Bubble.h"
+#include "EngineUtils.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
+
+namespace
+{
+	constexpr int32 SaveVersion = 1;
+
+	struct FSavedBubble
+	{
+		FString ClassPath;
+
+		/** Empty for bubbles spawned at runtime */
+		FString ActorPath;
+
+		FTransform Transform;
+
+		TArray<uint8> Snapshot;
+
+		friend FArchive& operator<<(FArchive& Ar, FSavedBubble& Saved)
+		{
+			return Ar << Saved.ClassPath << Saved.ActorPath << Saved.Transform << Saved.Snapshot;
+		}
+	};
+}
+
+bool UBubbleStateSubsystem::IsLevelPlaced(const ABubble* Bubble)
+{
+	return Bubble->IsNetStartupActor();
+}
+
+void UBubbleStateSubsystem::StoreStreamedOut(ABubble* Bubble)
+{
+	if (!IsLevelPlaced(Bubble))
+	{
+		return;
+	}
+
+	TArray<uint8>& Data = StreamedOutBubbles.FindOrAdd(Bubble->GetPathName());
+	Bubble->WriteSnapshot(Data);
+}
+
+bool UBubbleStateSubsystem::TakeStoredState(const ABubble* Bubble, TArray<uint8>& OutData)
+{
+	if (!IsLevelPlaced(Bubble))
+	{
+		return false;
+	}
+
+	return StreamedOutBubbles.RemoveAndCopyValue(Bubble->GetPathName(), OutData);
+}
+
+void UBubbleStateSubsystem::MarkPopped(const ABubble* Bubble)
+{
+	if (IsLevelPlaced(Bubble))
+	{
+		PoppedBubbles.Add(Bubble->GetPathName());
+	}
+}
+
+bool UBubbleStateSubsystem::WasPopped(const ABubble* Bubble) const
+{
+	return IsLevelPlaced(Bubble) && PoppedBubbles.Contains(Bubble->GetPathName());
+}
+
+void UBubbleStateSubsystem::SaveBubbles(TArray<uint8>& OutData)
+{
+	TArray<FSavedBubble> SavedBubbles;
+	for (TActorIterator<ABubble> It(GetWorld()); It; ++It)
+	{
+		ABubble* Bubble = *It;
+		if (Bubble->IsActorBeingDestroyed() || Bubble->IsPopping())
+		{
+			continue;
+		}
+
+		FSavedBubble& Saved = SavedBubbles.AddDefaulted_GetRef();
+		Saved.ClassPath = Bubble->GetClass()->GetPathName();
+		Saved.ActorPath = IsLevelPlaced(Bubble) ? Bubble->GetPathName() : FString();
+		Saved.Transform = Bubble->GetActorTransform();
+		Bubble->WriteSnapshot(Saved.Snapshot);
+	}
+
+	OutData.Reset();
+	FMemoryWriter Writer(OutData);
+	int32 Version = SaveVersion;
+	Writer << Version;
+	Writer << SavedBubbles;
+	Writer << StreamedOutBubbles;
+	Writer << PoppedBubbles;
+}
+
+bool UBubbleStateSubsystem::RestoreBubbles(const TArray<uint8>& Data)
+{
+	TArray<FSavedBubble> SavedBubbles;
+	TMap<FString, TArray<uint8>> SavedStreamedOut;
+	TSet<FString> SavedPopped;
+
+	FMemoryReader Reader(Data);
+	int32 Version = 0;
+	Reader << Version;
+	if (Version != SaveVersion)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Bubble save has version %d, expected %d"), Version, SaveVersion);
+		return false;
+	}
+	Reader << SavedBubbles;
+	Reader << SavedStreamedOut;
+	Reader << SavedPopped;
+	if (Reader.IsError())
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Bubble save is corrupted"));
+		return false;
+	}
+
+	StreamedOutBubbles = MoveTemp(SavedStreamedOut);
+	PoppedBubbles = MoveTemp(SavedPopped);
+
+	// runtime bubbles are all re-spawned from the save, placed ones that popped in the save go away
+	for (TActorIterator<ABubble> It(GetWorld()); It; ++It)
+	{
+		ABubble* Bubble = *It;
+		if (!IsLevelPlaced(Bubble) || PoppedBubbles.Contains(Bubble->GetPathName()))
+		{
+			Bubble->Destroy();
+		}
+	}
+
+	for (FSavedBubble& Saved : SavedBubbles)
+	{
+		if (!Saved.ActorPath.IsEmpty())
+		{
+			ABubble* Bubble = Cast<ABubble>(FSoftObjectPath(Saved.ActorPath).ResolveObject());
+			if (IsValid(Bubble) && Bubble->HasActorBegunPlay())
+			{
+				Bubble->SetActorTransform(Saved.Transform);
+				Bubble->RestoreSnapshot(Saved.Snapshot);
+			}
+			else
+			{
+				// its level is not loaded, restore it when it streams in
+				StreamedOutBubbles.Add(Saved.ActorPath, MoveTemp(Saved.Snapshot));
+			}
+			continue;
+		}
+
+		UClass* BubbleClass = FSoftClassPath(Saved.ClassPath).TryLoadClass<ABubble>();
+		if (!BubbleClass)
+		{
+			continue;
+		}
+
+		ABubble* Bubble = GetWorld()->SpawnActorDeferred<ABubble>(BubbleClass, Saved.Transform, nullptr, nullptr, ESpawnActorCollisionHandlingMethod::AlwaysSpawn);
+		if (Bubble)
+		{
+			Bubble->SetPendingSnapshot(MoveTemp(Saved.Snapshot));
+			Bubble->FinishSpawning(Saved.Transform);
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,48 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "BubbleStateSubsystem.generated.h"
+
+class ABubble;
+
+/**
+ * Keeps bubble snapshots alive across level streaming and packs all bubbles of the world into
+ * one buffer for save games. Level-placed bubbles are identified by their path name, bubbles
+ * spawned at runtime are re-spawned from their class when a save is restored.
+ */
+UCLASS()
+class BUBBLEGUN_API UBubbleStateSubsystem : public UWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	/** Stores the state of a level-placed bubble whose level is streaming out */
+	void StoreStreamedOut(ABubble* Bubble);
+
+	/** Removes and returns the state stored for a level-placed bubble that is streaming back in */
+	bool TakeStoredState(const ABubble* Bubble, TArray<uint8>& OutData);
+
+	/** Remembers that a level-placed bubble popped, so it does not come back when its level streams in again */
+	void MarkPopped(const ABubble* Bubble);
+
+	bool WasPopped(const ABubble* Bubble) const;
+
+	/** Writes every bubble in the world, and the state of streamed-out ones, into one buffer */
+	UFUNCTION(BlueprintCallable, Category = "Bubble")
+	void SaveBubbles(TArray<uint8>& OutData);
+
+	/** Replaces the bubbles in the world with the ones from a buffer written by SaveBubbles */
+	UFUNCTION(BlueprintCallable, Category = "Bubble")
+	bool RestoreBubbles(const TArray<uint8>& Data);
+
+private:
+	/** Only actors loaded with a level have a path that survives streaming */
+	static bool IsLevelPlaced(const ABubble* Bubble);
+
+	TMap<FString, TArray<uint8>> StreamedOutBubbles;
+
+	TSet<FString> PoppedBubbles;
+};
@@ -3,5 +3,9 @@
 #include "Bubblegun.h"
 #include "Modules/ModuleManager.h"
 
+LLM_DEFINE_TAG(BubbleSimulation);
+LLM_DEFINE_TAG(BubbleMesh);
+LLM_DEFINE_TAG(BubbleCollision);
+
 IMPLEMENT_PRIMARY_GAME_MODULE( FDefaultGameModuleImpl, Bubblegun, "Bubblegun" );
  
\ No newline at end of file
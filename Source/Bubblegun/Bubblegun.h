@@ -3,3 +3,13 @@
 #pragma once
 
 #include "CoreMinimal.h"
+#include "HAL/LowLevelMemTracker.h"
+
+// vertex velocities, rest lengths, contacts, lookup structures and the scheduler
+LLM_DECLARE_TAG_API(BubbleSimulation, BUBBLEGUN_API);
+
+// dynamic meshes with their attributes, and the far-field instances
+LLM_DECLARE_TAG_API(BubbleMesh, BUBBLEGUN_API);
+
+// collision rebuilt from the deformed bubble meshes
+LLM_DECLARE_TAG_API(BubbleCollision, BUBBLEGUN_API);
@@ -10,6 +10,7 @@
 #include "GameFramework/SpringArmComponent.h"
 #include "BubblegunWeaponComponent.h"
 #include "BubbleGameInstance.h"
+#include "BubbleCharacterMovementComponent.h"
 #include "GameFramework/CharacterMovementComponent.h"
 #include "EnhancedInputComponent.h"
 #include "EnhancedInputSubsystems.h"
@@ -22,7 +23,8 @@ DEFINE_LOG_CATEGORY(LogTemplateCharacter);
 //////////////////////////////////////////////////////////////////////////
 // ABubblegunCharacter
 
-ABubblegunCharacter::ABubblegunCharacter()
+ABubblegunCharacter::ABubblegunCharacter(const FObjectInitializer& ObjectInitializer)
+	: Super(ObjectInitializer.SetDefaultSubobjectClass<UBubbleCharacterMovementComponent>(ACharacter::CharacterMovementComponentName))
 {
 	// Set size for collision capsule
 	GetCapsuleComponent()->InitCapsuleSize(55.f, 96.0f);
@@ -52,25 +54,10 @@ ABubblegunCharacter::ABubblegunCharacter()
 
 void ABubblegunCharacter::InputDash()
 {
-	if (!CanDash())
+	if (UBubbleCharacterMovementComponent* BubbleMovement = GetBubbleMovement())
 	{
-		return;
+		BubbleMovement->Dash();
 	}
-
-	DashCooldownTimer = DashCooldown;
-	DashTimer = DashDuration;
-	PreDashJumpCount = JumpCurrentCount;
-
-	FVector2D Input = LastInput.IsSet()
-		? LastInput.GetValue()
-		: FVector2D(0, 1.f);
-
-	FVector MoveDir = FVector::ZeroVector;
-	MoveDir += GetActorRightVector() * Input.X;
-	MoveDir += GetActorForwardVector() * Input.Y;
-
-	GetCharacterMovement()->SetMovementMode(EMovementMode::MOVE_Flying);
-	GetCharacterMovement()->Velocity = MoveDir * DashInitialSpeed;
 }
 
 void ABubblegunCharacter::NotifyControllerChanged()
@@ -116,7 +103,6 @@ void ABubblegunCharacter::Tick(float DeltaTime)
 	Super::Tick(DeltaTime);
 	UpdateHeadBob(DeltaTime);
 	UpdateCameraOffset(DeltaTime);
-	UpdateDash(DeltaTime);
 	LastInput.Reset();
 }
 
@@ -159,6 +145,44 @@ void ABubblegunCharacter::FireSecondaryWeapon()
 	AltFireShot.Broadcast(LeftWeaponComp->GetCooldownRemaining());
 }
 
+void ABubblegunCharacter::ServerFire_Implementation(uint8 WeaponSlot, uint32 ShotId, FVector_NetQuantize10 Location, FRotator Rotation, double ClientServerTime)
+{
+	if (UBubblegunWeaponComponent* Weapon = GetWeaponInSlot(WeaponSlot))
+	{
+		Weapon->HandleServerFire(ShotId, Location, Rotation, ClientServerTime);
+	}
+}
+
+void ABubblegunCharacter::ClientRejectShot_Implementation(uint8 WeaponSlot, uint32 ShotId)
+{
+	if (UBubblegunWeaponComponent* Weapon = GetWeaponInSlot(WeaponSlot))
+	{
+		Weapon->HandleShotRejected(ShotId);
+	}
+}
+
+void ABubblegunCharacter::ClientConfirmHit_Implementation(uint8 WeaponSlot, uint32 ShotId, AActor* HitActor, FVector_NetQuantize HitLocation, bool bStopped)
+{
+	if (UBubblegunWeaponComponent* Weapon = GetWeaponInSlot(WeaponSlot))
+	{
+		Weapon->HandleHitConfirmed(ShotId, HitActor, HitLocation, bStopped);
+	}
+}
+
+void ABubblegunCharacter::MulticastFire_Implementation(uint8 WeaponSlot, FVector_NetQuantize10 Location, FRotator Rotation)
+{
+	// The owner predicted the shot; the server spawned the authoritative one but its host still sees and hears it
+	if (IsLocallyControlled())
+	{
+		return;
+	}
+
+	if (UBubblegunWeaponComponent* Weapon = GetWeaponInSlot(WeaponSlot))
+	{
+		Weapon->HandleRemoteFire(Location, Rotation, !HasAuthority());
+	}
+}
+
 void ABubblegunCharacter::UpdateHeadBob(float DeltaTime)
 {
 	if (LastInput.IsSet() && GetCharacterMovement()->IsWalking())
@@ -205,31 +229,21 @@ void ABubblegunCharacter::UpdateCameraOffset(float DeltaTime)
 	FirstPersonCameraComponent->AddRelativeLocation(FVector(0.f, 0.f, CameraOffset));
 }
 
-void ABubblegunCharacter::UpdateDash(float DeltaTime)
+UBubbleCharacterMovementComponent* ABubblegunCharacter::GetBubbleMovement() const
 {
-	if (DashTimer >= 0.f)
-	{
-		FVector Dir = GetCharacterMovement()->Velocity.GetSafeNormal();
-		float StoppingSpeed = GetCharacterMovement()->MaxWalkSpeed;
-		float T = 1.f - DashTimer / DashDuration;
-		GetCharacterMovement()->Velocity = Dir * FMath::Lerp(DashInitialSpeed, StoppingSpeed, T * T * T);
-
-		// Just finished dashing
-		if (DashTimer < DeltaTime)
-		{
-			GetCharacterMovement()->SetMovementMode(EMovementMode::MOVE_Falling);
-			GetCharacterMovement()->Velocity = GetCharacterMovement()->Velocity.GetClampedToSize(0.f, GetCharacterMovement()->MaxWalkSpeed);
-			JumpCurrentCount = PreDashJumpCount;
-		}
+	return Cast<UBubbleCharacterMovementComponent>(GetCharacterMovement());
+}
 
-		DashTimer -= DeltaTime;
-		return;
-	}
+bool ABubblegunCharacter::IsDashing() const
+{
+	UBubbleCharacterMovementComponent* BubbleMovement = GetBubbleMovement();
+	return BubbleMovement && BubbleMovement->IsDashing();
+}
 
-	if (DashCooldownTimer >= 0.f)
-	{
-		DashCooldownTimer -= DeltaTime;
-	}
+bool ABubblegunCharacter::CanDash() const
+{
+	UBubbleCharacterMovementComponent* BubbleMovement = GetBubbleMovement();
+	return BubbleMovement && BubbleMovement->CanDash();
 }
 
 
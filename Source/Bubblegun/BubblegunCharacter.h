@@ -15,6 +15,7 @@ class UInputMappingContext;
 class UCurveVector;
 class UBubblegunWeaponComponent;
 class USpringArmComponent;
+class UBubbleCharacterMovementComponent;
 struct FInputActionValue;
 
 DECLARE_LOG_CATEGORY_EXTERN(LogTemplateCharacter, Log, All);
@@ -103,15 +104,11 @@ private:
 	float HeadBobTransitionTimer = 0.f;
 	TOptional<FVector2D> LastInput;
 
-	float DashTimer = -1.f;
-	float DashCooldownTimer = -1.f;
-	int PreDashJumpCount = 0;
-
 	float LandedCameraTimer = 0.f;
 
 public:
 
-	ABubblegunCharacter();
+	ABubblegunCharacter(const FObjectInitializer& ObjectInitializer);
 
 protected:
 
@@ -137,15 +134,43 @@ public:
 	UFUNCTION(BlueprintCallable)
 	void FireSecondaryWeapon();
 
-	bool IsDashing() const { return DashTimer >= 0.f; }
-	bool CanDash() const { return DashCooldownTimer < 0.f && !IsDashing(); }
+	/** Returns the movement component, which owns the dash state **/
+	UBubbleCharacterMovementComponent* GetBubbleMovement() const;
+
+	bool IsDashing() const;
+	bool CanDash() const;
+
+	float GetDashInitialSpeed() const { return DashInitialSpeed; }
+	float GetDashDuration() const { return DashDuration; }
+	float GetDashCooldown() const { return DashCooldown; }
 
 	UPROPERTY(BlueprintAssignable)
 	FAltFireShot AltFireShot;
 
+	/** Slot of a weapon in the shot RPCs: 0 for WeaponComp, 1 for LeftWeaponComp */
+	uint8 GetWeaponSlot(const UBubblegunWeaponComponent* Weapon) const { return Weapon == LeftWeaponComp ? 1 : 0; }
+
+	UBubblegunWeaponComponent* GetWeaponInSlot(uint8 Slot) const { return Slot == 1 ? LeftWeaponComp : WeaponComp; }
+
+	// Shots go through the character, the weapons are created on every machine in BeginPlay and are not replicated
+
+	/** A shot the owning client has already shown, with its muzzle and the server time it was fired at */
+	UFUNCTION(Server, Reliable)
+	void ServerFire(uint8 WeaponSlot, uint32 ShotId, FVector_NetQuantize10 Location, FRotator Rotation, double ClientServerTime);
+
+	UFUNCTION(Client, Reliable)
+	void ClientRejectShot(uint8 WeaponSlot, uint32 ShotId);
+
+	/** The authoritative projectile of a shot hit an actor; bStopped if it was destroyed by the hit */
+	UFUNCTION(Client, Reliable)
+	void ClientConfirmHit(uint8 WeaponSlot, uint32 ShotId, AActor* HitActor, FVector_NetQuantize HitLocation, bool bStopped);
+
+	/** A shot the server accepted, shown by the other clients */
+	UFUNCTION(NetMulticast, Unreliable)
+	void MulticastFire(uint8 WeaponSlot, FVector_NetQuantize10 Location, FRotator Rotation);
+
 private:
 	void UpdateHeadBob(float DeltaTime);
 	void UpdateCameraOffset(float DeltaTime);
-	void UpdateDash(float DeltaTime);
 };
 
@@ -1,6 +1,8 @@
 // Copyright Epic Games, Inc. All Rights Reserved.
 
 #include "BubblegunProjectile.h"
+#include "Bubble.h"
+#include "BubblegunWeaponComponent.h"
 #include "GameFramework/ProjectileMovementComponent.h"
 #include "Components/SphereComponent.h"
 
@@ -30,19 +32,48 @@ ABubblegunProjectile::ABubblegunProjectile()
 
 	// Die after 3 seconds by default
 	InitialLifeSpan = 3.0f;
+
+	// Every machine spawns its own projectiles, shots are matched by ID and hits confirmed by the weapon
+	bReplicates = false;
 }
 
 void ABubblegunProjectile::OnHit(UPrimitiveComponent* HitComp, AActor* OtherActor, UPrimitiveComponent* OtherComp, FVector NormalImpulse, const FHitResult& Hit)
 {
+	if ((OtherActor == nullptr) || (OtherActor == this) || (OtherComp == nullptr))
+	{
+		return;
+	}
+
+	// Bubbles take the contact themselves, the server reports it as a hit of the shot
+	const bool bPhysicsHit = OtherComp->IsSimulatingPhysics();
+	if (!bCosmetic && (bPhysicsHit || OtherActor->IsA<ABubble>()) && LastHitActor != OtherActor)
+	{
+		LastHitActor = OtherActor;
+		if (UBubblegunWeaponComponent* ShotWeapon = Weapon.Get())
+		{
+			ShotWeapon->NotifyShotHit(ShotId, OtherActor, Hit.ImpactPoint, bPhysicsHit);
+		}
+	}
+
 	// Only add impulse and destroy projectile if we hit a physics
-	if ((OtherActor != nullptr) && (OtherActor != this) && (OtherComp != nullptr) && OtherComp->IsSimulatingPhysics())
+	if (bPhysicsHit)
 	{
-		OtherComp->AddImpulseAtLocation(GetVelocity() * ImpulseOnHit, GetActorLocation());
+		if (!bCosmetic)
+		{
+			OtherComp->AddImpulseAtLocation(GetVelocity() * ImpulseOnHit, GetActorLocation());
+		}
 
 		Destroy();
 	}
 }
 
+void ABubblegunProjectile::InitializeShot(UBubblegunWeaponComponent* InWeapon, uint32 InShotId, bool bInCosmetic)
+{
+	Weapon = InWeapon;
+	ShotId = InShotId;
+	bCosmetic = bInCosmetic;
+}
+
 void ABubblegunProjectile::BeginPlay()
 {
 	CollisionComp->IgnoreActorWhenMoving(GetInstigator(), true);
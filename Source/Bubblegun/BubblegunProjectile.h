@@ -8,6 +8,7 @@
 
 class USphereComponent;
 class UProjectileMovementComponent;
+class UBubblegunWeaponComponent;
 
 UCLASS(config=Game)
 class ABubblegunProjectile : public AActor
@@ -36,7 +37,25 @@ public:
 
 	virtual void BeginPlay() override;
 
+	/** Ties the projectile to a shot of a weapon; cosmetic projectiles are shown by clients and never affect the game */
+	void InitializeShot(UBubblegunWeaponComponent* InWeapon, uint32 InShotId, bool bInCosmetic);
+
+	uint32 GetShotId() const { return ShotId; }
+
+	bool IsCosmetic() const { return bCosmetic; }
+
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = Projectile)
 	float ImpulseOnHit = 100.f;
+
+private:
+	/** Weapon that fired the shot, told about hits of the authoritative projectile */
+	TWeakObjectPtr<UBubblegunWeaponComponent> Weapon;
+
+	/** Last actor reported as hit, a projectile rolling along a bubble hits it every frame */
+	TWeakObjectPtr<AActor> LastHitActor;
+
+	uint32 ShotId = 0;
+
+	bool bCosmetic = false;
 };
 
@@ -13,6 +13,17 @@
 #include "Engine/SkeletalMeshSocket.h"
 #include "Engine/LocalPlayer.h"
 #include "Engine/World.h"
+#include "Bubble.h"
+#include "Components/SphereComponent.h"
+#include "Engine/OverlapResult.h"
+#include "GameFramework/GameStateBase.h"
+#include "GameFramework/ProjectileMovementComponent.h"
+
+namespace
+{
+	/** How far a bubble's surface may have moved since the rewound time, candidates are gathered this far around the shot */
+	constexpr double RewindCandidateMargin = 300.0;
+}
 
 // Sets default values for this component's properties
 UBubblegunWeaponComponent::UBubblegunWeaponComponent()
@@ -37,32 +48,205 @@ void UBubblegunWeaponComponent::Fire()
 
 void UBubblegunWeaponComponent::FireProjectile()
 {
-	// Try and fire a projectile
-	if (ProjectileClass != nullptr)
+	// Shots of other characters are spawned from the server's RPCs
+	if (ProjectileClass == nullptr || Character == nullptr || !Character->IsLocallyControlled())
+	{
+		return;
+	}
+
+	APlayerController* PlayerController = Cast<APlayerController>(Character->GetController());
+	if (PlayerController == nullptr)
+	{
+		return;
+	}
+
+	const FVector SpawnLocation =
+		GetComponentTransform().TransformPosition(
+			GetMuzzlePoint()
+		);
+
+
+	const FRotator SpawnRotation = PlayerController->PlayerCameraManager->GetCameraRotation();
+	// MuzzleOffset is in camera space, so transform it to world space before offsetting from the character location to find the final muzzle position
+	//const FVector SpawnLocation = GetOwner()->GetActorLocation() + SpawnRotation.RotateVector(MuzzleOffset);
+
+	const uint8 WeaponSlot = Character->GetWeaponSlot(this);
+	if (Character->HasAuthority())
+	{
+		LastServerShotTime = GetWorld()->GetTimeSeconds();
+		SpawnProjectile(SpawnLocation, SpawnRotation, 0, false);
+		if (GetNetMode() != NM_Standalone)
+		{
+			Character->MulticastFire(WeaponSlot, SpawnLocation, SpawnRotation);
+		}
+		return;
+	}
+
+	// Show the shot right away and let the server catch up, the projectiles are matched by the shot ID
+	const uint32 ShotId = NextShotId++;
+	if (NextShotId == 0)
+	{
+		NextShotId = 1;
+	}
+
+	for (auto It = PredictedShots.CreateIterator(); It; ++It)
+	{
+		if (!It.Value().IsValid())
+		{
+			It.RemoveCurrent();
+		}
+	}
+	PredictedShots.Add(ShotId, SpawnProjectile(SpawnLocation, SpawnRotation, ShotId, true));
+
+	const AGameStateBase* GameState = GetWorld()->GetGameState();
+	const double ServerTime = GameState ? GameState->GetServerWorldTimeSeconds() : GetWorld()->GetTimeSeconds();
+	Character->ServerFire(WeaponSlot, ShotId, SpawnLocation, SpawnRotation, ServerTime);
+}
+
+void UBubblegunWeaponComponent::HandleServerFire(uint32 ShotId, const FVector& Location, const FRotator& Rotation, double ClientServerTime)
+{
+	if (ProjectileClass == nullptr || Character == nullptr)
+	{
+		return;
+	}
+
+	// The client runs its own cooldown, this only stops clients that skip it
+	const double Now = GetWorld()->GetTimeSeconds();
+	const bool bCooledDown = LastServerShotTime < 0.0 || Now - LastServerShotTime >= FireCooldown - ServerCooldownTolerance;
+	const FVector Muzzle = GetComponentTransform().TransformPosition(GetMuzzlePoint());
+	if (!bCooledDown || FVector::Dist(Location, Muzzle) > MaxMuzzleError)
+	{
+		Character->ClientRejectShot(Character->GetWeaponSlot(this), ShotId);
+		return;
+	}
+	LastServerShotTime = Now;
+
+	// The client's clock is not trusted beyond the fast-forward window, the bubbles are rewound by the clamped latency
+	const double Latency = FMath::Clamp(Now - ClientServerTime, 0.0, double(MaxFastForwardTime));
+	SpawnProjectile(FastForwardShot(Location, Rotation, Latency, Now - Latency), Rotation, ShotId, false);
+	Character->MulticastFire(Character->GetWeaponSlot(this), Location, Rotation);
+}
+
+void UBubblegunWeaponComponent::HandleShotRejected(uint32 ShotId)
+{
+	TWeakObjectPtr<ABubblegunProjectile> Projectile;
+	if (PredictedShots.RemoveAndCopyValue(ShotId, Projectile) && Projectile.IsValid())
+	{
+		Projectile->Destroy();
+	}
+	OnShotRejected();
+}
+
+void UBubblegunWeaponComponent::HandleHitConfirmed(uint32 ShotId, AActor* HitActor, const FVector& HitLocation, bool bStopped)
+{
+	// A predicted projectile that missed what the server's hit still disappears with it
+	if (bStopped)
 	{
-		UWorld* const World = GetWorld();
-		if (World != nullptr)
+		TWeakObjectPtr<ABubblegunProjectile> Projectile;
+		if (PredictedShots.RemoveAndCopyValue(ShotId, Projectile) && Projectile.IsValid())
 		{
-			APlayerController* PlayerController = Cast<APlayerController>(Character->GetController());
-			const FVector SpawnLocation =
-				GetComponentTransform().TransformPosition(
-					GetMuzzlePoint()
-				);
+			Projectile->Destroy();
+		}
+	}
+	OnShotConfirmed(HitActor, HitLocation);
+}
+
+void UBubblegunWeaponComponent::HandleRemoteFire(const FVector& Location, const FRotator& Rotation, bool bSpawnProjectile)
+{
+	if (bSpawnProjectile)
+	{
+		SpawnProjectile(Location, Rotation, 0, true);
+	}
+	PlayFireSound();
+	SpawnFireVFX();
+}
+
+void UBubblegunWeaponComponent::NotifyShotHit(uint32 ShotId, AActor* HitActor, const FVector& HitLocation, bool bStopped)
+{
+	if (Character == nullptr)
+	{
+		return;
+	}
+
+	if (Character->IsLocallyControlled())
+	{
+		OnShotConfirmed(HitActor, HitLocation);
+	}
+	else
+	{
+		Character->ClientConfirmHit(Character->GetWeaponSlot(this), ShotId, HitActor, HitLocation, bStopped);
+	}
+}
 
+ABubblegunProjectile* UBubblegunWeaponComponent::SpawnProjectile(const FVector& Location, const FRotator& Rotation, uint32 ShotId, bool bCosmetic)
+{
+	UWorld* const World = GetWorld();
+	if (World == nullptr || ProjectileClass == nullptr)
+	{
+		return nullptr;
+	}
+
+	//Set Spawn Collision Handling Override
+	FActorSpawnParameters ActorSpawnParams;
+	ActorSpawnParams.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AlwaysSpawn;
+	ActorSpawnParams.Instigator = Character;
+
+	// Spawn the projectile at the muzzle
+	ABubblegunProjectile* Projectile = World->SpawnActor<ABubblegunProjectile>(ProjectileClass, Location, Rotation, ActorSpawnParams);
+	if (Projectile != nullptr)
+	{
+		Projectile->InitializeShot(this, ShotId, bCosmetic);
+	}
+	return Projectile;
+}
+
+FVector UBubblegunWeaponComponent::FastForwardShot(const FVector& Location, const FRotator& Rotation, double Latency, double RewindTime) const
+{
+	const ABubblegunProjectile* DefaultProjectile = ProjectileClass->GetDefaultObject<ABubblegunProjectile>();
+	const double Distance = DefaultProjectile->GetProjectileMovement()->InitialSpeed * Latency;
+	if (Distance <= UE_KINDA_SMALL_NUMBER)
+	{
+		return Location;
+	}
 
-			const FRotator SpawnRotation = PlayerController->PlayerCameraManager->GetCameraRotation();
-			// MuzzleOffset is in camera space, so transform it to world space before offsetting from the character location to find the final muzzle position
-			//const FVector SpawnLocation = GetOwner()->GetActorLocation() + SpawnRotation.RotateVector(MuzzleOffset);
+	const FVector Direction = Rotation.Vector();
+	FVector End = Location + Direction * Distance;
 
-			//Set Spawn Collision Handling Override
-			FActorSpawnParameters ActorSpawnParams;
-			ActorSpawnParams.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AlwaysSpawn;
-			ActorSpawnParams.Instigator = Character;
+	// Bubbles move by their vertices, so they are tested as the client saw them from their rewind history; only the
+	// ones near the shot, gathered with one overlap around the segment
+	FCollisionQueryParams Params(SCENE_QUERY_STAT(BubblegunFastForward), false, Character);
+	TArray<FOverlapResult> Overlaps;
+	const FCollisionShape Capsule = FCollisionShape::MakeCapsule(RewindCandidateMargin, Distance * 0.5 + RewindCandidateMargin);
+	GetWorld()->OverlapMultiByObjectType(Overlaps, (Location + End) * 0.5, FRotationMatrix::MakeFromZ(Direction).ToQuat(),
+		FCollisionObjectQueryParams(FCollisionObjectQueryParams::InitType::AllObjects), Capsule, Params);
 
-			// Spawn the projectile at the muzzle
-			World->SpawnActor<ABubblegunProjectile>(ProjectileClass, SpawnLocation, SpawnRotation, ActorSpawnParams);
+	TArray<ABubble*, TInlineAllocator<8>> Bubbles;
+	for (const FOverlapResult& Overlap : Overlaps)
+	{
+		if (ABubble* Bubble = Cast<ABubble>(Overlap.GetActor()))
+		{
+			Bubbles.AddUnique(Bubble);
 		}
 	}
+	for (ABubble* Bubble : Bubbles)
+	{
+		Params.AddIgnoredActor(Bubble);
+		FVector HitLocation;
+		if (Bubble->RaycastRewound(RewindTime, Location, End, HitLocation))
+		{
+			End = HitLocation;
+		}
+	}
+
+	FHitResult Hit;
+	if (GetWorld()->LineTraceSingleByProfile(Hit, Location, End, TEXT("Projectile"), Params))
+	{
+		End = Hit.Location;
+	}
+
+	// Stop short of what was hit so the projectile still collides with it
+	const double Radius = DefaultProjectile->GetCollisionComp()->GetScaledSphereRadius();
+	return Location + Direction * FMath::Max((End - Location).Size() - Radius, 0.0);
 }
 
 void UBubblegunWeaponComponent::PlayFireSound()
@@ -47,6 +47,18 @@ public:
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = Gameplay)
 	float FireCooldown = 0.5f;
 
+	/** How much sooner than FireCooldown the server accepts a shot after the previous one, for jitter in the network */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = Network)
+	float ServerCooldownTolerance = 0.1f;
+
+	/** How far from the muzzle on the server a client may fire from */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = Network)
+	float MaxMuzzleError = 150.f;
+
+	/** Most latency the server advances an authoritative projectile by, so it flies where the client's does */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = Network)
+	float MaxFastForwardTime = 0.25f;
+
 	/** Sets default values for this component's properties */
 	UBubblegunWeaponComponent();
 
@@ -58,6 +70,7 @@ public:
 	UFUNCTION(BlueprintCallable, Category="Weapon")
 	void Fire();
 
+	/** Fires a shot from the locally controlled character: authoritative on the server, predicted on a client */
 	UFUNCTION(BlueprintCallable)
 	void FireProjectile();
 
@@ -79,13 +92,49 @@ public:
 
 	FVector GetMuzzlePoint() const { return GetSocketTransform("MuzzleSocket", RTS_Component).GetTranslation(); }
 
+	/** Server: validates a shot predicted by the owning client and spawns its authoritative projectile */
+	void HandleServerFire(uint32 ShotId, const FVector& Location, const FRotator& Rotation, double ClientServerTime);
+
+	/** Owning client: removes the projectile of a shot the server refused */
+	void HandleShotRejected(uint32 ShotId);
+
+	void HandleHitConfirmed(uint32 ShotId, AActor* HitActor, const FVector& HitLocation, bool bStopped);
+
+	/** Other clients and a listen server host: shows a shot of this weapon the server accepted, the server already has its projectile */
+	void HandleRemoteFire(const FVector& Location, const FRotator& Rotation, bool bSpawnProjectile);
+
+	/** Server: called by an authoritative projectile when it hits something */
+	void NotifyShotHit(uint32 ShotId, AActor* HitActor, const FVector& HitLocation, bool bStopped);
+
+	/** The server confirmed that a shot of the local player hit an actor */
+	UFUNCTION(BlueprintImplementableEvent)
+	void OnShotConfirmed(AActor* HitActor, FVector HitLocation);
+
+	/** The server refused a shot of the local player */
+	UFUNCTION(BlueprintImplementableEvent)
+	void OnShotRejected();
+
 protected:
 	/** Ends gameplay for this component. */
 	UFUNCTION()
 	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
 
 private:
+	ABubblegunProjectile* SpawnProjectile(const FVector& Location, const FRotator& Rotation, uint32 ShotId, bool bCosmetic);
+
+	/** Where the projectile of a shot would be after Latency, tested against the bubbles near it as they were at RewindTime */
+	FVector FastForwardShot(const FVector& Location, const FRotator& Rotation, double Latency, double RewindTime) const;
+
 	/** The Character holding this weapon*/
 	ABubblegunCharacter* Character;
 	float FireCooldownTimer = -1.f;
+
+	/** Owning client: ID of the next shot, 0 is never used */
+	uint32 NextShotId = 1;
+
+	/** Owning client: projectiles of shots waiting for the server */
+	TMap<uint32, TWeakObjectPtr<ABubblegunProjectile>> PredictedShots;
+
+	/** Server: world time of the last accepted shot */
+	double LastServerShotTime = -1.0;
 };
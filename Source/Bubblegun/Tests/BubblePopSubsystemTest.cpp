@@ -0,0 +1,43 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "Bubble.h"
+#include "BubblePopSubsystem.h"
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FBubbleChainPopReachTest, "Bubblegun.Pop.ChainPopReach",
+	EAutomationTestFlags::EditorContext | EAutomationTestFlags::ClientContext | EAutomationTestFlags::EngineFilter)
+
+bool FBubbleChainPopReachTest::RunTest(const FString& Parameters)
+{
+	const ABubble* Defaults = GetDefault<ABubble>();
+	const double Radius = Defaults->InitialRadius;
+	const double ImpulseScale = UBubblePopSubsystem::GetImpulseScale(Radius, Defaults->PopForceBase);
+	const double ShockwaveRadius = UBubblePopSubsystem::GetShockwaveRadius(ImpulseScale, Defaults->PopImpulseEpsilon, Defaults->PopMaxRadius);
+
+	TestTrue(TEXT("Impulse at the edge of the shockwave is at most epsilon"),
+		UBubblePopSubsystem::GetImpulse(ImpulseScale, ShockwaveRadius, ShockwaveRadius) <= Defaults->PopImpulseEpsilon);
+	TestTrue(TEXT("Impulse fades toward the edge of the shockwave"),
+		UBubblePopSubsystem::GetImpulse(ImpulseScale, ShockwaveRadius, ShockwaveRadius * 0.99) < UBubblePopSubsystem::GetImpulse(ImpulseScale, ShockwaveRadius, ShockwaveRadius * 0.5));
+	TestEqual(TEXT("No impulse beyond the shockwave"), UBubblePopSubsystem::GetImpulse(ImpulseScale, ShockwaveRadius, ShockwaveRadius * 2.0), 0.0);
+
+	// a small bubble's shockwave is bounded by its epsilon rather than by the cap
+	const double SmallScale = UBubblePopSubsystem::GetImpulseScale(35.0, Defaults->PopForceBase);
+	const double SmallRadius = UBubblePopSubsystem::GetShockwaveRadius(SmallScale, Defaults->PopImpulseEpsilon, Defaults->PopMaxRadius);
+	TestTrue(TEXT("Small bubble's shockwave ends before the cap"), SmallRadius < Defaults->PopMaxRadius);
+	TestTrue(TEXT("Impulse at the edge of a small bubble's shockwave is at most epsilon"),
+		UBubblePopSubsystem::GetImpulse(SmallScale, SmallRadius, SmallRadius) <= Defaults->PopImpulseEpsilon);
+
+	TestTrue(TEXT("Touching bubble pops"),
+		UBubblePopSubsystem::ReachesChainPop(ImpulseScale, ShockwaveRadius, Radius, Defaults->ChainPopReach, Radius * 0.5, Defaults->ChainPopImpulseThreshold));
+	TestFalse(TEXT("Bubble beyond the reach survives"),
+		UBubblePopSubsystem::ReachesChainPop(ImpulseScale, ShockwaveRadius, Radius, Defaults->ChainPopReach, Radius * Defaults->ChainPopReach + 1.0, Defaults->ChainPopImpulseThreshold));
+	TestFalse(TEXT("Bubble 40 m away survives"),
+		UBubblePopSubsystem::ReachesChainPop(ImpulseScale, ShockwaveRadius, Radius, Defaults->ChainPopReach, 4000.0, Defaults->ChainPopImpulseThreshold));
+
+	return true;
+}
+
+#endif